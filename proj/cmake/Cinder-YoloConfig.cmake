@@ -8,6 +8,7 @@ if( NOT Cinder-Yolo )
 	option( USE_GPU "Enable Darknet gpu support through Cuda" OFF )
 	option( USE_OPENCV "Enable OpenCV" OFF )
 	option( USE_CUDNN "Enable CudaNN" OFF )
+	option( BUILD_BENCHMARK "Build the darknet_bench executable" OFF )
 	# compile darknet
 	add_subdirectory( ${DARKNET_PATH} ${CMAKE_CURRENT_BINARY_DIR}/darknet )
 	if( USE_GPU )
@@ -41,7 +41,7 @@ void BasicDarknetApp::setup()
 	mSurface = Surface::create( loadImage( loadAsset( "dog.jpg" ) ) );
 	mTexture = gl::Texture::create( *(mSurface.get()) );
 #endif
-	mCiDarknet = std::make_unique<yolo::CinderYolo>( getAssetPath( "yolov3-tiny.cfg" ), getAssetPath( "yolov3-tiny.weights" ), getAssetPath( "coco.names" ) );
+	mCiDarknet = std::make_unique<yolo::CinderYolo>( getAssetPath( "yolov3-tiny.cfg" ), getAssetPath( "yolov3-tiny.weights" ), getAssetPath( "coco.names" ), yolo::CinderYolo::Options().motionThreshold( 2.f ) );
 }
 
 void BasicDarknetApp::update()
@@ -61,7 +61,7 @@ void BasicDarknetApp::update()
 void BasicDarknetApp::draw()
 {
 	gl::clear( Color( .2f, .2f, .2f ) );
-	auto detections = mCiDarknet->getDetections();
+	const auto& detections = mCiDarknet->getDetections();
 #if defined( USE_CAPTURE )
 	if( mCapture && mCapture->getSurface() ) {
 		if( ! mTexture )
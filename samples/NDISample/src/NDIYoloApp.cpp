@@ -66,7 +66,7 @@ void NDIYoloApp::sourceRemoved( std::string sourceName )
 void NDIYoloApp::setup()
 {
 	// Create Yolo detector
-	mCiDarknet = std::make_unique<yolo::CinderYolo>( getAssetPath( "yolov3-tiny.cfg" ), getAssetPath( "yolov3-tiny.weights" ), getAssetPath( "coco.names" ) );
+	mCiDarknet = std::make_unique<yolo::CinderYolo>( getAssetPath( "yolov3-tiny.cfg" ), getAssetPath( "yolov3-tiny.weights" ), getAssetPath( "coco.names" ), yolo::CinderYolo::Options().motionThreshold( 2.f ) );
 
 	// Create the NDI finder
 	CinderNDIFinder::Description finderDscr;
@@ -97,7 +97,7 @@ void NDIYoloApp::update()
 void NDIYoloApp::draw()
 {
 	gl::clear( Color( .2f, .2f, .2f ) );
-	auto detections = mCiDarknet->getDetections();
+	const auto& detections = mCiDarknet->getDetections();
 	gl::draw( mTexture );
 	for( const auto& detectedObject : detections ) {
 			gl::ScopedColor scopedColor( detectedObject.mColor );
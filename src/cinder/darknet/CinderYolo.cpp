@@ -1,18 +1,31 @@
 #include "CinderYolo.h"
-#include "cinder/ip/Resize.h"
 #include "cinder/Filter.h"
 #include "cinder/Log.h"
 #include "cinder/app/AppBase.h"
+#include <algorithm>
+#include <cstdlib>
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#include <emmintrin.h>
+#endif
 
 extern "C" float get_color( int c, int x, int max );
 namespace cinder { namespace yolo {
 
-CinderYolo::CinderYolo( const fs::path& cfgFilepath, const fs::path& weightsFilepath, const fs::path& labelsFilepath )
+CinderYolo::CinderYolo( const fs::path& cfgFilepath, const fs::path& weightsFilepath, const fs::path& labelsFilepath, const Options& options )
+	: mOptions( options )
 {
-	// Load the network
+	// Size the thread pool the CPU layers run on before the network first uses it
+	if( mOptions.getPoolThreads() > 0 ) {
+		auto& cpus = mOptions.getPoolCpus();
+		configure_thread_pool( static_cast<int>( mOptions.getPoolThreads() ), cpus.empty() ? nullptr : cpus.data() );
+	}
+	// Load the network once, the workers run it concurrently
 	auto cfgFilepathStr = cfgFilepath.string();
 	auto weightsFilepathStr = weightsFilepath.string();
-	mDetector = std::unique_ptr<Detector>( new Detector( &cfgFilepathStr[0], &weightsFilepathStr[0] ) );
+	mDetector = std::make_unique<Detector>( &cfgFilepathStr[0], &weightsFilepathStr[0] );
+	if( mOptions.isTracking() ) {
+		mTracker = std::make_unique<Tracker>();
+	}
 	// Load labels ( if defined )
 	if( ! labelsFilepath.empty() ) { 
 		auto labelsFilepathStr = labelsFilepath.string();
@@ -23,88 +36,348 @@ CinderYolo::CinderYolo( const fs::path& cfgFilepath, const fs::path& weightsFile
 			}
 		}
 	}
-	// Create the input queue
-	mSurfaceQueue = std::make_unique<ConcurrentCircularBuffer<Surface>>( 15 );
-	// Start the processing thread
-	auto futureObj = mTerminateProcessSignal.get_future();
-	mNetworkProcessThread = std::thread( &CinderYolo::networkProcessFn, this, std::move( futureObj ) );
+	// Create the hand-offs between the stages, only frames of runYolo() are dropped
+	auto isDroppable = []( const FrameRef& frame ) { return ! frame->mCallback; };
+	mInputMailbox = std::make_unique<Mailbox<FrameRef>>( mOptions.getQueueSize(), isDroppable );
+	mInferMailbox = std::make_unique<Mailbox<FrameRef>>( mOptions.getQueueSize(), isDroppable );
+	mPostprocessMailbox = std::make_unique<Mailbox<FrameRef>>( mOptions.getQueueSize(), isDroppable );
+	// Start the processing threads
+	if( mOptions.isPipelined() ) {
+		mThreads.emplace_back( &CinderYolo::preprocessFn, this );
+		for( size_t i = 0; i < mOptions.getWorkers(); ++i ) {
+			mThreads.emplace_back( &CinderYolo::inferFn, this );
+		}
+		mThreads.emplace_back( &CinderYolo::postprocessFn, this );
+	}
+	else {
+		for( size_t i = 0; i < mOptions.getWorkers(); ++i ) {
+			mThreads.emplace_back( &CinderYolo::workerFn, this );
+		}
+	}
 }
 
 CinderYolo::~CinderYolo()
 {
-	// Exit and terminate the processing thread
-	mTerminateProcessSignal.set_value();
-	mNetworkProcessThread.join();
-	// Clear the queues
-	mSurfaceQueue->cancel();
+	// Wake up and terminate the processing threads
+	mInputMailbox->cancel();
+	mInferMailbox->cancel();
+	mPostprocessMailbox->cancel();
+	for( auto& thread : mThreads ) {
+		thread.join();
+	}
+}
 
-	std::lock_guard<std::mutex> guard( mMutex );
-	mDetections.clear();
-	
+const CinderYolo::Snapshot& CinderYolo::getSnapshot()
+{
+	if( mMiddleSnapshot.load( std::memory_order_relaxed ) & kSnapshotFresh )
+		mFrontSnapshot = mMiddleSnapshot.exchange( mFrontSnapshot, std::memory_order_acq_rel ) & kSnapshotIndexMask;
+	return mSnapshots[ mFrontSnapshot ];
 }
 
 void CinderYolo::runYolo( const Surface& surface, const float threshold )
 {
-	mSurfaceQueue->tryPushFront( surface );	
-	mThreshold = threshold;
+	const auto timestamp = Clock::now();
+	// with tracking the network only sees every detectEvery()th frame
+	bool detect = mFramesToDetect == 0;
+	mFramesToDetect = detect ? mOptions.getDetectEvery() - 1 : mFramesToDetect - 1;
+	// a static scene keeps the detections of the last frame sent
+	bool still = false;
+	if( detect && mOptions.getMotionThreshold() > 0.f && ! hasMotion( surface, threshold ) ) {
+		detect = false;
+		still = true;
+	}
+	if( ! detect && ! mTracker )
+		return;
+
+	const uint64_t frameId = ++mFrameCount;
+	if( detect ) {
+		auto frame = acquireFrame();
+		frame->mId = frameId;
+		frame->mTimestamp = timestamp;
+		frame->mThreshold = threshold;
+		copySurface( surface, frame.get() );
+		dropFrame( mInputMailbox->push( std::move( frame ) ) );
+	}
+	// the tracks are published for every frame, moved to the time it was passed in
+	if( mTracker )
+		publishTracks( frameId, timestamp, still );
+}
+
+std::future<CinderYolo::Result> CinderYolo::detectAsync( const Surface& surface, const float threshold )
+{
+	// std::function needs a copyable callback
+	auto promise = std::make_shared<std::promise<Result>>();
+	auto future = promise->get_future();
+	detectAsync( surface, threshold, [promise]( Result result ) { promise->set_value( std::move( result ) ); } );
+	return future;
 }
 
-void CinderYolo::networkProcessFn( std::future<void> futureObj )
+uint64_t CinderYolo::detectAsync( const Surface& surface, const float threshold, ResultCallback callback )
 {
-	while( futureObj.wait_for( std::chrono::milliseconds( 1 ) ) == std::future_status::timeout ) {
-		if( mDetector && mSurfaceQueue->isNotEmpty() ) {
-			Surface surface;
-			Surface surfaceCopy;
-			ci::vec2 scaleBRect( 1.0f );
-			if( mSurfaceQueue->tryPopBack( &surface ) ) {
-				if( surface.getWidth() != mDetector->get_net_width() || surface.getHeight() != mDetector->get_net_height() ) {
-					surfaceCopy = ip::resizeCopy( surface, surface.getBounds(), ivec2( mDetector->get_net_width(), mDetector->get_net_height() ) );
-					scaleBRect.x = (float)surface.getWidth() / (float)mDetector->get_net_width();
-					scaleBRect.y = (float)surface.getHeight() / (float)mDetector->get_net_height();
-				}
-				image_t yoloImage = surfaceToDarknetImage( surfaceCopy );
-				auto result = mDetector->detect( yoloImage, mThreshold );
-				Detector::free_image( yoloImage );
-				std::lock_guard<std::mutex> guard( mMutex );
-				mDetections.clear();
-				for( auto& d : result ) {
-					Detection detection;
-					detection.mBoundingRect = Rectf( d.x, d.y, d.x+d.w, d.y+d.h );
-					detection.mBoundingRect.scale( scaleBRect );
-					detection.mColor = getColorFromClassId( d.obj_id );
-					detection.mLabel = getLabelFromClassId( d.obj_id );
-					mDetections.push_back( detection );
-				}
-			}
+	const auto timestamp = Clock::now();
+	{
+		std::unique_lock<std::mutex> lock( mRequestMutex );
+		mRequestAnswered.wait( lock, [this] { return mRequests < mOptions.getMaxRequests(); } );
+		++mRequests;
+	}
+	auto frame = acquireFrame();
+	frame->mId = ++mFrameCount;
+	frame->mTimestamp = timestamp;
+	frame->mThreshold = threshold;
+	copySurface( surface, frame.get() );
+	frame->mCallback = std::move( callback );
+	const uint64_t frameId = frame->mId;
+	dropFrame( mInputMailbox->push( std::move( frame ) ) );
+	return frameId;
+}
+
+void CinderYolo::preprocessFn()
+{
+	FrameRef frame;
+	while( mInputMailbox->pop( &frame ) ) {
+		preprocess( frame.get() );
+		dropFrame( mInferMailbox->push( std::move( frame ) ) );
+	}
+}
+
+void CinderYolo::inferFn()
+{
+	FrameRef frame;
+	while( mInferMailbox->pop( &frame ) ) {
+		infer( frame.get() );
+		dropFrame( mPostprocessMailbox->push( std::move( frame ) ) );
+	}
+}
+
+void CinderYolo::postprocessFn()
+{
+	FrameRef frame;
+	while( mPostprocessMailbox->pop( &frame ) ) {
+		publish( frame.get() );
+		releaseFrame( std::move( frame ) );
+	}
+}
+
+void CinderYolo::workerFn()
+{
+	FrameRef frame;
+	while( mInputMailbox->pop( &frame ) ) {
+		preprocess( frame.get() );
+		infer( frame.get() );
+		publish( frame.get() );
+		releaseFrame( std::move( frame ) );
+	}
+}
+
+void CinderYolo::preprocess( Frame* frame )
+{
+	frame->mPreprocessStart = Clock::now();
+	// resize and normalize straight from the surface pixels into the network input
+	frame->mInput.resize( (size_t)mDetector->get_net_width() * mDetector->get_net_height() * 3 );
+	mDetector->preprocess( surfaceToPixels( frame->mSurface ), frame->mInput.data() );
+	frame->mPreprocessEnd = Clock::now();
+}
+
+void CinderYolo::infer( Frame* frame )
+{
+	frame->mInferenceStart = Clock::now();
+	// boxes come back in surface coordinates
+	frame->mBoxes = mDetector->detect_preprocessed( frame->mInput.data(), frame->mWidth, frame->mHeight, frame->mThreshold );
+	frame->mInferenceEnd = Clock::now();
+}
+
+void CinderYolo::publish( Frame* frame )
+{
+	if( frame->mCallback ) {
+		respond( frame );
+		return;
+	}
+	std::lock_guard<std::mutex> guard( mPublishMutex );
+	// workers can finish out of order, never replace newer detections with older ones
+	if( frame->mId <= mPublishedFrameId )
+		return;
+	mPublishedFrameId = frame->mId;
+	// with tracking the detections only correct the tracks, runYolo() publishes them
+	if( mTracker ) {
+		mTracker->update( frame->mBoxes, std::chrono::duration<double>( frame->mTimestamp.time_since_epoch() ).count() );
+		return;
+	}
+	writeSnapshot( frame->mId, frame->mTimestamp, frame->mBoxes );
+}
+
+void CinderYolo::respond( Frame* frame )
+{
+	const auto postprocessStart = Clock::now();
+	Result result;
+	result.mFrameId = frame->mId;
+	result.mTimestamp = frame->mTimestamp;
+	toDetections( frame->mBoxes, &result.mDetections );
+	const auto end = Clock::now();
+	result.mPreprocessLatency = frame->mPreprocessEnd - frame->mPreprocessStart;
+	result.mInferenceLatency = frame->mInferenceEnd - frame->mInferenceStart;
+	result.mPostprocessLatency = end - postprocessStart;
+	result.mTotalLatency = end - frame->mTimestamp;
+	auto callback = std::move( frame->mCallback );
+	frame->mCallback = nullptr;
+	// free the slot first, so that the callback can submit the next request
+	{
+		std::lock_guard<std::mutex> guard( mRequestMutex );
+		--mRequests;
+	}
+	mRequestAnswered.notify_one();
+	callback( std::move( result ) );
+}
+
+void CinderYolo::publishTracks( uint64_t frameId, Clock::time_point timestamp, bool still )
+{
+	const double time = std::chrono::duration<double>( timestamp.time_since_epoch() ).count();
+	std::lock_guard<std::mutex> guard( mPublishMutex );
+	// nothing moved since the last frame sent, so its tracks are neither moved nor aged, also while
+	// the detections of that frame are still in flight
+	if( still )
+		mTracker->hold( time );
+	writeSnapshot( frameId, timestamp, mTracker->predict( time ) );
+}
+
+void CinderYolo::writeSnapshot( uint64_t frameId, Clock::time_point timestamp, const std::vector<bbox_t>& boxes )
+{
+	auto& snapshot = mSnapshots[ mBackSnapshot ];
+	snapshot.mFrameId = frameId;
+	snapshot.mTimestamp = timestamp;
+	// the snapshots are reused, so their vectors and label strings keep their capacity
+	toDetections( boxes, &snapshot.mDetections );
+	mBackSnapshot = mMiddleSnapshot.exchange( mBackSnapshot | kSnapshotFresh, std::memory_order_acq_rel ) & kSnapshotIndexMask;
+}
+
+void CinderYolo::toDetections( const std::vector<bbox_t>& boxes, Detections* detections )
+{
+	detections->resize( boxes.size() );
+	for( size_t i = 0; i < boxes.size(); ++i ) {
+		const auto& d = boxes[ i ];
+		auto& detection = ( *detections )[ i ];
+		detection.mBoundingRect = Rectf( d.x, d.y, d.x+d.w, d.y+d.h );
+		detection.mColor = getColorFromClassId( d.obj_id );
+		detection.mLabel = getLabelFromClassId( d.obj_id );
+		detection.mProbability = d.prob;
+		detection.mTrackId = d.track_id;
+	}
+}
+
+CinderYolo::FrameRef CinderYolo::acquireFrame()
+{
+	std::lock_guard<std::mutex> guard( mFramePoolMutex );
+	if( mFramePool.empty() )
+		return std::make_unique<Frame>();
+	auto frame = std::move( mFramePool.back() );
+	mFramePool.pop_back();
+	return frame;
+}
+
+void CinderYolo::releaseFrame( FrameRef frame )
+{
+	if( ! frame )
+		return;
+	std::lock_guard<std::mutex> guard( mFramePoolMutex );
+	mFramePool.push_back( std::move( frame ) );
+}
+
+void CinderYolo::dropFrame( FrameRef frame )
+{
+	if( frame )
+		mMotionReferenceDropped = true;
+	releaseFrame( std::move( frame ) );
+}
+
+namespace {
+
+//! Largest sum of absolute differences of two thumbnails over their cellSize x cellSize cells
+template<int size, int cellSize>
+uint32_t maxCellSad( const uint8_t* a, const uint8_t* b )
+{
+	const int cells = size / cellSize;
+	uint32_t sums[ cells * cells ] = {};
+	for( int y = 0; y < size; ++y ) {
+		const uint8_t* rowA = a + y * size;
+		const uint8_t* rowB = b + y * size;
+		uint32_t* cellSums = sums + ( y / cellSize ) * cells;
+		int x = 0;
+#if defined( __SSE2__ ) || defined( _M_X64 )
+		static_assert( cellSize == 8, "the SSE2 path sums 8 pixel halves" );
+		for( ; x + 16 <= size; x += 16 ) {
+			// one sum for each 8 pixel half, that is for two horizontally adjacent cells
+			__m128i sad = _mm_sad_epu8( _mm_loadu_si128( (const __m128i*)( rowA + x ) ), _mm_loadu_si128( (const __m128i*)( rowB + x ) ) );
+			cellSums[ x / cellSize ] += _mm_cvtsi128_si32( sad );
+			cellSums[ x / cellSize + 1 ] += _mm_cvtsi128_si32( _mm_srli_si128( sad, 8 ) );
 		}
-		else std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) ) ;
-	}
-}
-
-image_t CinderYolo::surfaceToDarknetImage( const Surface& surface )
-{
-	// conversion routine from: darknet/src/image_opencv.cpp 	
-	auto makeYoloImage = [] ( int w, int h, int c ) -> image_t {
-		image_t out;
-		out.data = (float*)calloc( h*w*c, sizeof( float ) );
-		out.w = w;
-		out.h = h;
-		out.c = c; 
-		return out;
-	};
-	int w = surface.getWidth();
-	int h = surface.getHeight();
-	int c = surface.getPixelInc();
-	image_t yoloImage = makeYoloImage( w, h, c );
-	int widthStep = w * c;
-	for( int i = 0; i < h; ++i ) {
-		for( int k = 0; k < c ; ++k ) {
-			for( int j = 0; j < w; ++j ) {
-				yoloImage.data[ k*w*h+i*w+j ] = (float)surface.getData()[ i*widthStep+j*c+k ] / 255.0f;
+#endif
+		for( ; x < size; ++x )
+			cellSums[ x / cellSize ] += std::abs( rowA[ x ] - rowB[ x ] );
+	}
+	return *std::max_element( sums, sums + cells * cells );
+}
+
+} // anonymous namespace
+
+bool CinderYolo::hasMotion( const Surface& surface, float threshold )
+{
+	// grayscale thumbnail, every pixel averages a 4 x 4 grid of samples of its block of the surface
+	const uint8_t* data = surface.getData();
+	const int width = surface.getWidth();
+	const int height = surface.getHeight();
+	const ptrdiff_t rowBytes = surface.getRowBytes();
+	const int pixelInc = surface.getPixelInc();
+	const int r = surface.getRedOffset(), g = surface.getGreenOffset(), b = surface.getBlueOffset();
+	for( int ty = 0; ty < kThumbnailSize; ++ty ) {
+		for( int tx = 0; tx < kThumbnailSize; ++tx ) {
+			uint32_t sum = 0;
+			for( int sy = 0; sy < 4; ++sy ) {
+				const uint8_t* row = data + ( ( ty * 4 + sy ) * 2 + 1 ) * height / ( kThumbnailSize * 8 ) * rowBytes;
+				for( int sx = 0; sx < 4; ++sx ) {
+					const uint8_t* pixel = row + ( ( tx * 4 + sx ) * 2 + 1 ) * width / ( kThumbnailSize * 8 ) * pixelInc;
+					sum += pixel[ r ] + 2 * pixel[ g ] + pixel[ b ];
+				}
 			}
+			mThumbnail[ ty * kThumbnailSize + tx ] = (uint8_t)( sum / 64 );
 		}
 	}
-	return yoloImage;
+
+	// compared with the last frame sent, so that slow changes add up until they are sent too
+	bool motion = ! mHasMotionReference || threshold != mMotionReferenceThreshold || mMotionReferenceDropped.exchange( false );
+	if( ! motion ) {
+		const uint32_t maxSad = maxCellSad<kThumbnailSize, kMotionCellSize>( mThumbnail.data(), mMotionReference.data() );
+		motion = maxSad > mOptions.getMotionThreshold() * kMotionCellSize * kMotionCellSize;
+	}
+	if( motion ) {
+		std::swap( mThumbnail, mMotionReference );
+		mHasMotionReference = true;
+		mMotionReferenceThreshold = threshold;
+	}
+	return motion;
+}
+
+void CinderYolo::copySurface( const Surface& surface, Frame* frame )
+{
+	// assigning a Surface copies its pixels into a new allocation, copyFrom() writes into the existing one
+	Surface& target = frame->mSurface;
+	if( target.getSize() != surface.getSize() || target.hasAlpha() != surface.hasAlpha() || ! ( target.getChannelOrder() == surface.getChannelOrder() ) )
+		target = Surface( surface.getWidth(), surface.getHeight(), surface.hasAlpha(), surface.getChannelOrder() );
+	target.copyFrom( surface, surface.getBounds() );
+	frame->mWidth = surface.getWidth();
+	frame->mHeight = surface.getHeight();
+}
+
+pixels_t CinderYolo::surfaceToPixels( const Surface& surface )
+{
+	pixels_t pixels;
+	pixels.data = surface.getData();
+	pixels.w = surface.getWidth();
+	pixels.h = surface.getHeight();
+	pixels.row_bytes = (int)surface.getRowBytes();
+	pixels.pixel_inc = surface.getPixelInc();
+	pixels.r = surface.getRedOffset();
+	pixels.g = surface.getGreenOffset();
+	pixels.b = surface.getBlueOffset();
+	return pixels;
 }
 
 ci::Colorf CinderYolo::getColorFromClassId( const int classId )
@@ -117,9 +390,10 @@ ci::Colorf CinderYolo::getColorFromClassId( const int classId )
 	return ci::Colorf( r, g, b );
 }
 
-std::string CinderYolo::getLabelFromClassId( const int classId )
+const std::string& CinderYolo::getLabelFromClassId( const int classId )
 {
-	return mLabels.size() > 0 && mLabels.size() > classId ? mLabels[ classId ] : std::string();
+	static const std::string noLabel;
+	return classId >= 0 && classId < (int)mLabels.size() ? mLabels[ classId ] : noLabel;
 }
 
 } // namespace yolo
@@ -1,10 +1,16 @@
 #include "yolo_v2_class.hpp"
-#include "cinder/ConcurrentCircularBuffer.h"
 #include "cinder/Surface.h"
 #include <thread>
-#include <future>
-#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <future>
+#include <functional>
 
 namespace cinder { namespace yolo {
 
@@ -15,27 +21,232 @@ public:
 		ci::Colorf mColor;
 		std::string mLabel;
 		float mProbability{ 0.f };
+		uint32_t mTrackId{ 0 };			//! Id of the track with tracking enabled, 0 otherwise
 	};
 	using Detections = std::vector<Detection>;
+	using Clock = std::chrono::steady_clock;
+
+	//! Detections of one frame. A snapshot is never modified while it is visible to the reader.
+	struct Snapshot {
+		uint64_t mFrameId{ 0 };			//! Id of the frame in submission order, 0 before the first result
+		Clock::time_point mTimestamp;	//! When the frame was passed to runYolo()
+		Detections mDetections;
+	};
+
+	//! Answer to one detectAsync() request
+	struct Result {
+		uint64_t mFrameId{ 0 };				//! Id of the frame, shared with runYolo() frames in submission order
+		Clock::time_point mTimestamp;		//! When the request was submitted
+		Clock::duration mPreprocessLatency{};
+		Clock::duration mInferenceLatency{};
+		Clock::duration mPostprocessLatency{};
+		Clock::duration mTotalLatency{};	//! From submission to the result, including the time spent waiting between stages
+		Detections mDetections;
+	};
+	using ResultCallback = std::function<void( Result )>;
+
+	class Options {
+	public:
+		Options() {}
+		//! Number of inference workers. The workers share one Detector, so the weights are loaded once and
+		//! every worker adds only its own activations.
+		Options& workers( size_t count ) { mWorkers = count > 0 ? count : 1; return *this; }
+		//! Keeps only the newest frame waiting in front of every stage, older frames are dropped instead of queued.
+		Options& latestFrameOnly( bool latestOnly = true ) { mLatestFrameOnly = latestOnly; return *this; }
+		//! Frames waiting in front of every stage when latestFrameOnly is disabled, the oldest one is dropped on overflow.
+		Options& queueSize( size_t size ) { mQueueSize = size > 0 ? size : 1; return *this; }
+		//! Runs preprocessing, inference and postprocessing on their own threads. When disabled every worker runs all three.
+		Options& pipelined( bool enable = true ) { mPipelined = enable; return *this; }
+		//! Skips frames that look like the last frame sent to the network, their detections stay published. A frame
+		//! is sent when the mean difference of a grayscale thumbnail inside any of its 8 x 8 cells exceeds
+		//! threshold levels ( 0 - 255 ). 0 disables the gate and sends every frame.
+		Options& motionThreshold( float threshold ) { mMotionThreshold = threshold > 0.f ? threshold : 0.f; return *this; }
+		//! Tracks the detections, the published detections are then the tracks extrapolated to the time of every
+		//! frame passed to runYolo(), so boxes move at the frame rate even when the network runs slower.
+		Options& tracking( bool enable = true ) { mTracking = enable; return *this; }
+		//! With tracking, runs the network on every Nth frame only and lets the tracker move the boxes in between.
+		Options& detectEvery( size_t frames ) { mDetectEvery = frames > 0 ? frames : 1; return *this; }
+		//! Requests of detectAsync() in flight at once, further requests block until one is answered.
+		Options& maxRequests( size_t count ) { mMaxRequests = count > 0 ? count : 1; return *this; }
+		//! Threads of the pool every darknet CPU layer runs on, the inferring thread counted. The pool is shared by
+		//! the whole process, 0 leaves it as it is ( one thread per CPU unless configured otherwise ).
+		Options& poolThreads( size_t count ) { mPoolThreads = count; return *this; }
+		//! Pins the pool to these CPUs, one thread each ( Linux only ), e.g. to keep the render thread's core free.
+		//! The first CPU stands for the inferring thread, which is left unpinned.
+		Options& poolCpus( const std::vector<int>& cpus ) { mPoolCpus = cpus; return *this; }
 
-	CinderYolo( const fs::path& cfgFilepath, const fs::path& weightsFilepath, const fs::path& labelsFilepath = fs::path() );
+		size_t getWorkers() const { return mWorkers; }
+		bool isLatestFrameOnly() const { return mLatestFrameOnly; }
+		size_t getQueueSize() const { return mLatestFrameOnly ? 1 : mQueueSize; }
+		bool isPipelined() const { return mPipelined; }
+		float getMotionThreshold() const { return mMotionThreshold; }
+		bool isTracking() const { return mTracking; }
+		size_t getDetectEvery() const { return mTracking ? mDetectEvery : 1; }
+		size_t getMaxRequests() const { return mMaxRequests; }
+		size_t getPoolThreads() const { return mPoolCpus.empty() ? mPoolThreads : mPoolCpus.size(); }
+		const std::vector<int>& getPoolCpus() const { return mPoolCpus; }
+	private:
+		size_t mWorkers{ 1 };
+		bool mLatestFrameOnly{ true };
+		size_t mQueueSize{ 4 };
+		bool mPipelined{ true };
+		float mMotionThreshold{ 0.f };
+		bool mTracking{ false };
+		size_t mDetectEvery{ 1 };
+		size_t mMaxRequests{ 4 };
+		size_t mPoolThreads{ 0 };
+		std::vector<int> mPoolCpus;
+	};
+
+	CinderYolo( const fs::path& cfgFilepath, const fs::path& weightsFilepath, const fs::path& labelsFilepath = fs::path(), const Options& options = Options() );
 	~CinderYolo();
 	void runYolo( const Surface& pixels, const float threshold );
-	const Detections getDetections() const { return mDetections; }
+	//! Detects on one frame through the same stages as runYolo(), but the frame is never dropped, skipped by the
+	//! motion gate or tracked, and its detections are not published to the snapshot. Blocks while maxRequests()
+	//! requests are in flight.
+	std::future<Result> detectAsync( const Surface& surface, const float threshold );
+	//! Like detectAsync() above, calls callback from a processing thread instead and returns the frame id.
+	uint64_t detectAsync( const Surface& surface, const float threshold, ResultCallback callback );
+	//! Latest published detections. Lock and allocation free, but must always be called from the same thread
+	//! ( e.g. the render thread ): the returned reference stays valid until that thread calls it again.
+	const Snapshot& getSnapshot();
+	const Detections& getDetections() { return getSnapshot().mDetections; }
 private:
-	void networkProcessFn(std::future<void> test);
-	image_t surfaceToDarknetImage( const Surface& surface );
+	//! A frame travelling through the stages, recycled through mFramePool so buffers are allocated once.
+	struct Frame {
+		uint64_t mId{ 0 };
+		Clock::time_point mTimestamp;
+		float mThreshold{ 0.f };
+		//! Kept allocated while the frame is pooled, the next frame of the same format is copied into it
+		Surface mSurface;
+		int mWidth{ 0 };
+		int mHeight{ 0 };
+		std::vector<float> mInput;
+		std::vector<bbox_t> mBoxes;
+		//! Set for detectAsync() requests
+		ResultCallback mCallback;
+		Clock::time_point mPreprocessStart;
+		Clock::time_point mPreprocessEnd;
+		Clock::time_point mInferenceStart;
+		Clock::time_point mInferenceEnd;
+	};
+	using FrameRef = std::unique_ptr<Frame>;
+
+	//! Bounded hand-off between two stages. Pushing into a full mailbox drops the oldest item isDroppable
+	//! accepts and hands it back, popping blocks on a condition variable until an item or cancel() arrives.
+	template<typename T>
+	class Mailbox {
+	public:
+		Mailbox( size_t capacity, std::function<bool( const T& )> isDroppable ) : mCapacity( capacity ), mIsDroppable( isDroppable ) {}
+		T push( T item )
+		{
+			T dropped{};
+			{
+				std::lock_guard<std::mutex> guard( mMutex );
+				if( mItems.size() >= mCapacity ) {
+					// items that can't be dropped may overflow the mailbox, they are bounded elsewhere
+					auto it = std::find_if( mItems.begin(), mItems.end(), mIsDroppable );
+					if( it != mItems.end() ) {
+						dropped = std::move( *it );
+						mItems.erase( it );
+					}
+				}
+				mItems.push_back( std::move( item ) );
+			}
+			mCondition.notify_one();
+			return dropped;
+		}
+		bool pop( T* item )
+		{
+			std::unique_lock<std::mutex> lock( mMutex );
+			mCondition.wait( lock, [this] { return mCanceled || ! mItems.empty(); } );
+			if( mCanceled )
+				return false;
+			*item = std::move( mItems.front() );
+			mItems.pop_front();
+			return true;
+		}
+		void cancel()
+		{
+			{
+				std::lock_guard<std::mutex> guard( mMutex );
+				mCanceled = true;
+			}
+			mCondition.notify_all();
+		}
+	private:
+		std::deque<T> mItems;
+		size_t mCapacity;
+		std::function<bool( const T& )> mIsDroppable;
+		bool mCanceled{ false };
+		std::mutex mMutex;
+		std::condition_variable mCondition;
+	};
+
+	void preprocessFn();
+	void inferFn();
+	void postprocessFn();
+	void workerFn();
+
+	void preprocess( Frame* frame );
+	void infer( Frame* frame );
+	void publish( Frame* frame );
+	void respond( Frame* frame );
+	//! still - the motion gate skipped the frame, the tracks are held instead of extrapolated
+	void publishTracks( uint64_t frameId, Clock::time_point timestamp, bool still );
+	//! Fills the back snapshot and hands it to the reader, mPublishMutex must be held
+	void writeSnapshot( uint64_t frameId, Clock::time_point timestamp, const std::vector<bbox_t>& boxes );
+	void toDetections( const std::vector<bbox_t>& boxes, Detections* detections );
+
+	FrameRef acquireFrame();
+	void releaseFrame( FrameRef frame );
+	//! Releases a frame a full mailbox pushed out, so the motion gate sends the next one
+	void dropFrame( FrameRef frame );
+	bool hasMotion( const Surface& surface, float threshold );
+
+	//! Copies surface into the pooled frame, reusing its pixels when the size and channel order match
+	void copySurface( const Surface& surface, Frame* frame );
+	pixels_t surfaceToPixels( const Surface& surface );
 	ci::Colorf getColorFromClassId( const int classId );
-	std::string getLabelFromClassId( const int classId );
+	const std::string& getLabelFromClassId( const int classId );
 private:
+	Options mOptions;
 	std::unique_ptr<Detector> mDetector;
-	std::thread mNetworkProcessThread;
-	std::promise<void> mTerminateProcessSignal;
-	std::unique_ptr<ConcurrentCircularBuffer<Surface>> mSurfaceQueue;
-	Detections mDetections;
-	std::atomic<float> mThreshold{ 0.4f };
+	std::vector<std::thread> mThreads;
+	std::unique_ptr<Mailbox<FrameRef>> mInputMailbox;
+	std::unique_ptr<Mailbox<FrameRef>> mInferMailbox;
+	std::unique_ptr<Mailbox<FrameRef>> mPostprocessMailbox;
+	std::vector<FrameRef> mFramePool;
+	std::mutex mFramePoolMutex;
+	std::atomic<uint64_t> mFrameCount{ 0 };
+	// detectAsync() requests in flight, bounded by Options::maxRequests()
+	size_t mRequests{ 0 };
+	std::mutex mRequestMutex;
+	std::condition_variable mRequestAnswered;
+	// Motion gate, the thumbnails are only touched by the thread calling runYolo()
+	static const int kThumbnailSize = 64;
+	static const int kMotionCellSize = 8;
+	using Thumbnail = std::array<uint8_t, kThumbnailSize * kThumbnailSize>;
+	Thumbnail mThumbnail;
+	Thumbnail mMotionReference;
+	bool mHasMotionReference{ false };
+	float mMotionReferenceThreshold{ 0.f };
+	std::atomic<bool> mMotionReferenceDropped{ false };
+	//! Corrected by the detections in publish(), extrapolated or held for every frame in runYolo(), guarded by mPublishMutex
+	std::unique_ptr<Tracker> mTracker;
+	size_t mFramesToDetect{ 0 };
 	std::vector<std::string> mLabels;
-	std::mutex mMutex;
+	// Triple buffer: the writer fills mSnapshots[ mBackSnapshot ] and swaps it with the middle one,
+	// the reader swaps mFrontSnapshot with the middle one when it has been marked fresh
+	static const uint32_t kSnapshotIndexMask = 0x3;
+	static const uint32_t kSnapshotFresh = 0x4;
+	std::array<Snapshot, 3> mSnapshots;
+	std::atomic<uint32_t> mMiddleSnapshot{ 2 };
+	uint32_t mBackSnapshot{ 1 };
+	uint32_t mFrontSnapshot{ 0 };
+	//! Serializes writers when every worker publishes its own results ( pipelined( false ) ) or with tracking
+	std::mutex mPublishMutex;
+	uint64_t mPublishedFrameId{ 0 };
 };
 
 
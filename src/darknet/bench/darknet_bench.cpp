@@ -0,0 +1,377 @@
+// darknet_bench - CPU inference benchmarks for regression gating
+//
+//   darknet_bench [-suite all|gemm|im2col|resize|nms|detect] [-cfg a.cfg,b.cfg]
+//                 [-iters 20] [-warmup 3] [-batch 4] [-threads <cores>] [-thresh .5]
+//                 [-format csv|json] [-out file]
+//
+// The networks are built from the cfgs with random weights, so only the timings
+// are meaningful. Results go to stdout (or -out) as one row per measurement,
+// progress and darknet's own output go to stderr.
+
+#include "yolo_v2_class.hpp"
+// the library internals are included by path, the src directory holds a unistd.h for Windows
+extern "C" {
+#include "../src/network.h"
+#include "../src/parser.h"
+#include "../src/gemm.h"
+#include "../src/im2col.h"
+#include "../src/image.h"
+#include "../src/box.h"
+#include "../src/utils.h"
+#include "../src/threadpool.h"
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef DARKNET_BENCH_ASSETS
+#define DARKNET_BENCH_ASSETS "."
+#endif
+
+struct bench_result_t {
+    std::string suite;
+    std::string name;
+    std::string params;
+    int iterations;
+    double mean_ms, min_ms, p50_ms, p90_ms, p99_ms;
+    double gflops_per_s;        // 0 when not applicable
+    double gbytes_per_s;
+    double items_per_s;         // images, frames or calls per second
+};
+
+struct bench_options_t {
+    int iters;
+    int warmup;
+    int max_batch;
+    int max_threads;
+    float thresh;
+};
+
+static std::vector<bench_result_t> results;
+
+// runs setup (untimed) then body, warmup + iters times, and returns the timed milliseconds
+static std::vector<double> time_runs(bench_options_t const &opt, std::function<void()> const &setup,
+    std::function<void()> const &body)
+{
+    std::vector<double> ms;
+    for (int i = 0; i < opt.warmup + opt.iters; ++i) {
+        if (setup) setup();
+        auto const start = std::chrono::steady_clock::now();
+        body();
+        auto const end = std::chrono::steady_clock::now();
+        if (i >= opt.warmup) ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return ms;
+}
+
+static double percentile(std::vector<double> const &sorted, double p)
+{
+    size_t const rank = (size_t)std::ceil(p / 100. * sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank ? rank - 1 : 0)];
+}
+
+// flops and bytes are per call, items is the number of things processed per call
+static void add_result(std::string suite, std::string name, std::string params, std::vector<double> ms,
+    double flops, double bytes, double items)
+{
+    bench_result_t r;
+    std::sort(ms.begin(), ms.end());
+    double sum = 0;
+    for (double t : ms) sum += t;
+    r.suite = suite;
+    r.name = name;
+    r.params = params;
+    r.iterations = (int)ms.size();
+    r.mean_ms = sum / ms.size();
+    r.min_ms = ms.front();
+    r.p50_ms = percentile(ms, 50);
+    r.p90_ms = percentile(ms, 90);
+    r.p99_ms = percentile(ms, 99);
+    r.gflops_per_s = flops / (r.mean_ms / 1000.) / 1e9;
+    r.gbytes_per_s = bytes / (r.mean_ms / 1000.) / 1e9;
+    r.items_per_s = items / (r.mean_ms / 1000.);
+    results.push_back(r);
+    fprintf(stderr, "%-7s %-28s %-34s mean %9.3f ms  p99 %9.3f ms\n", suite.c_str(), name.c_str(), params.c_str(),
+        r.mean_ms, r.p99_ms);
+}
+
+static std::vector<float> random_floats(size_t n, float min = -1, float max = 1)
+{
+    std::vector<float> v(n);
+    for (auto &x : v) x = rand_uniform(min, max);
+    return v;
+}
+
+static std::string cfg_name(std::string const &path)
+{
+    size_t const slash = path.find_last_of("/\\");
+    std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    size_t const dot = name.rfind('.');
+    return (dot == std::string::npos) ? name : name.substr(0, dot);
+}
+
+static void set_threads(int threads)
+{
+    configure_thread_pool(threads, 0);
+}
+
+// every distinct convolution GEMM (filters x output pixels x filter size) of the cfgs
+static void bench_gemm(std::vector<std::string> const &cfgs, bench_options_t const &opt)
+{
+    std::set<std::tuple<int, int, int> > done;
+    for (auto const &cfg : cfgs) {
+        network net = parse_network_cfg_inference(const_cast<char *>(cfg.c_str()), 1);
+        for (int i = 0; i < net.n; ++i) {
+            layer const &l = net.layers[i];
+            if (l.type != CONVOLUTIONAL) continue;
+            int const m = l.n, n = l.out_w*l.out_h, k = l.size*l.size*l.c;
+            if (!done.insert(std::make_tuple(m, n, k)).second) continue;
+
+            std::vector<float> a = random_floats((size_t)m*k), b = random_floats((size_t)k*n), c((size_t)m*n);
+            auto ms = time_runs(opt, nullptr, [&]() {
+                gemm(0, 0, m, n, k, 1, a.data(), k, b.data(), n, 1, c.data(), n);
+            });
+            std::ostringstream params;
+            params << "M=" << m << " N=" << n << " K=" << k;
+            add_result("gemm", cfg_name(cfg) + " layer " + std::to_string(i), params.str(), ms,
+                2. * m * n * k, ((double)m*k + (double)k*n + 2. * m * n) * sizeof(float), 1);
+        }
+        free_network(net);
+    }
+}
+
+// every distinct im2col of the cfgs, 1x1 convolutions included
+static void bench_im2col(std::vector<std::string> const &cfgs, bench_options_t const &opt)
+{
+    std::set<std::tuple<int, int, int, int, int, int> > done;
+    for (auto const &cfg : cfgs) {
+        network net = parse_network_cfg_inference(const_cast<char *>(cfg.c_str()), 1);
+        for (int i = 0; i < net.n; ++i) {
+            layer const &l = net.layers[i];
+            if (l.type != CONVOLUTIONAL) continue;
+            if (!done.insert(std::make_tuple(l.c, l.h, l.w, l.size, l.stride, l.pad)).second) continue;
+
+            size_t const in = (size_t)l.c*l.h*l.w, out = (size_t)l.size*l.size*l.c*l.out_w*l.out_h;
+            std::vector<float> src = random_floats(in), col(out);
+            auto ms = time_runs(opt, nullptr, [&]() {
+                im2col_cpu(src.data(), l.c, l.h, l.w, l.size, l.stride, l.pad, col.data());
+            });
+            std::ostringstream params;
+            params << l.w << "x" << l.h << "x" << l.c << " " << l.size << "x" << l.size << "/" << l.stride;
+            add_result("im2col", cfg_name(cfg) + " layer " + std::to_string(i), params.str(), ms,
+                0, (double)(in + out) * sizeof(float), 1);
+        }
+        free_network(net);
+    }
+}
+
+// camera sized frames into the network input: float planar and 8-bit interleaved sources
+static void bench_resize(std::vector<std::string> const &cfgs, bench_options_t const &opt)
+{
+    int const sources[][2] = { { 1280, 720 }, { 1920, 1080 } };
+    std::set<std::pair<int, int> > done;
+    for (auto const &cfg : cfgs) {
+        network net = parse_network_cfg_inference(const_cast<char *>(cfg.c_str()), 1);
+        int const w = net.w, h = net.h;
+        free_network(net);
+        if (!done.insert(std::make_pair(w, h)).second) continue;
+
+        for (auto const &s : sources) {
+            std::ostringstream params;
+            params << s[0] << "x" << s[1] << " -> " << w << "x" << h;
+
+            image src = make_random_image(s[0], s[1], 3);
+            auto ms = time_runs(opt, nullptr, [&]() {
+                image sized = resize_image(src, w, h);
+                free_image(sized);
+            });
+            add_result("resize", "resize_image", params.str(), ms, 0,
+                ((double)s[0] * s[1] + (double)w * h) * 3 * sizeof(float), 1);
+            free_image(src);
+
+            std::vector<unsigned char> rgba((size_t)s[0] * s[1] * 4);
+            for (auto &p : rgba) p = (unsigned char)(rand() & 255);
+            std::vector<float> dst((size_t)w * h * 3);
+            packed_resizer resizer = make_packed_resizer(w, h, 3);
+            int const offsets[3] = { 0, 1, 2 };
+            ms = time_runs(opt, nullptr, [&]() {
+                resize_packed_into(&resizer, rgba.data(), s[0], s[1], s[0] * 4, 4, offsets, dst.data());
+            });
+            add_result("resize", "resize_packed_into", params.str(), ms, 0,
+                (double)rgba.size() + (double)dst.size() * sizeof(float), 1);
+            free_packed_resizer(resizer);
+        }
+    }
+}
+
+// do_nms_sort over candidates with one confident class each, as get_network_boxes returns them;
+// the single class case stands for a crowded scene or a tiled frame at a low threshold
+static void bench_nms(bench_options_t const &opt)
+{
+    struct nms_case_t { int total, classes; float min_size, max_size; };
+    nms_case_t const cases[] = { { 100, 80, .02f, .3f }, { 500, 80, .02f, .3f }, { 2500, 80, .02f, .3f },
+        { 10000, 80, .02f, .3f }, { 10000, 1, .005f, .03f } };
+    for (nms_case_t const &c : cases) {
+        int const total = c.total, classes = c.classes;
+        std::vector<detection> dets(total);
+        std::vector<float> probs((size_t)total * classes);
+        std::vector<detection> source(total);
+        std::vector<float> source_probs((size_t)total * classes, 0);
+        for (int i = 0; i < total; ++i) {
+            detection &d = source[i];
+            d.bbox.x = rand_uniform(0, 1);
+            d.bbox.y = rand_uniform(0, 1);
+            d.bbox.w = rand_uniform(c.min_size, c.max_size);
+            d.bbox.h = rand_uniform(c.min_size, c.max_size);
+            d.classes = classes;
+            d.objectness = rand_uniform(.25f, 1);
+            d.mask = 0;
+            d.sort_class = 0;
+            source_probs[(size_t)i * classes + rand() % classes] = d.objectness * rand_uniform(.5f, 1);
+        }
+        // do_nms_sort zeroes suppressed probabilities, so every run starts from a fresh copy
+        auto reset = [&]() {
+            probs = source_probs;
+            for (int i = 0; i < total; ++i) {
+                dets[i] = source[i];
+                dets[i].prob = &probs[(size_t)i * classes];
+            }
+        };
+        auto ms = time_runs(opt, reset, [&]() { do_nms_sort(dets.data(), total, classes, .45f); });
+        add_result("nms", "do_nms_sort", std::to_string(total) + " boxes " + std::to_string(classes) + " classes",
+            ms, 0, 0, 1);
+    }
+}
+
+static std::vector<int> sweep(int max)
+{
+    std::vector<int> v;
+    for (int i = 1; i < max; i *= 2) v.push_back(i);
+    v.push_back(max);
+    return v;
+}
+
+// Detector::detect / detect_batch on network sized images, so no resize is timed
+static void bench_detect(std::vector<std::string> const &cfgs, bench_options_t const &opt)
+{
+    for (auto const &cfg : cfgs) {
+        Detector detector(cfg, std::string());
+        int const w = detector.get_net_width(), h = detector.get_net_height();
+        network net = parse_network_cfg_inference(const_cast<char *>(cfg.c_str()), 1);
+        double bflops = 0;
+        for (int i = 0; i < net.n; ++i) bflops += net.layers[i].bflops;
+        free_network(net);
+
+        std::vector<std::vector<float> > data;
+        std::vector<image_t> images;
+        for (int b = 0; b < opt.max_batch; ++b) data.push_back(random_floats((size_t)w * h * 3, 0, 1));
+        for (auto &d : data) images.push_back(image_t{ h, w, 3, d.data() });
+
+        for (int threads : sweep(opt.max_threads)) {
+            set_threads(threads);
+            for (int batch : sweep(opt.max_batch)) {
+                std::vector<image_t> input(images.begin(), images.begin() + batch);
+                auto ms = time_runs(opt, nullptr, [&]() {
+                    if (batch == 1) detector.detect(input[0], opt.thresh);
+                    else detector.detect_batch(input, opt.thresh);
+                });
+                std::ostringstream params;
+                params << w << "x" << h << " batch=" << batch << " threads=" << threads;
+                add_result("detect", cfg_name(cfg), params.str(), ms, bflops * 1e9 * batch, 0, batch);
+            }
+        }
+    }
+    set_threads(opt.max_threads);
+}
+
+static void write_csv(FILE *fp)
+{
+    fprintf(fp, "suite,name,params,iterations,mean_ms,min_ms,p50_ms,p90_ms,p99_ms,gflops_per_s,gbytes_per_s,items_per_s\n");
+    for (auto const &r : results) {
+        fprintf(fp, "%s,%s,%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.3f,%.3f,%.3f\n", r.suite.c_str(), r.name.c_str(),
+            r.params.c_str(), r.iterations, r.mean_ms, r.min_ms, r.p50_ms, r.p90_ms, r.p99_ms,
+            r.gflops_per_s, r.gbytes_per_s, r.items_per_s);
+    }
+}
+
+static void write_json(FILE *fp)
+{
+    fprintf(fp, "[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto const &r = results[i];
+        fprintf(fp, "  {\"suite\":\"%s\",\"name\":\"%s\",\"params\":\"%s\",\"iterations\":%d,"
+            "\"mean_ms\":%.4f,\"min_ms\":%.4f,\"p50_ms\":%.4f,\"p90_ms\":%.4f,\"p99_ms\":%.4f,"
+            "\"gflops_per_s\":%.3f,\"gbytes_per_s\":%.3f,\"items_per_s\":%.3f}%s\n",
+            r.suite.c_str(), r.name.c_str(), r.params.c_str(), r.iterations, r.mean_ms, r.min_ms, r.p50_ms,
+            r.p90_ms, r.p99_ms, r.gflops_per_s, r.gbytes_per_s, r.items_per_s, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(fp, "]\n");
+}
+
+int main(int argc, char **argv)
+{
+    int const cores = std::max(1, (int)std::thread::hardware_concurrency());
+    std::string const default_cfgs = std::string(DARKNET_BENCH_ASSETS) + "/yolov3-tiny.cfg," +
+        DARKNET_BENCH_ASSETS + "/yolov3.cfg";
+
+    bench_options_t opt;
+    std::string const suite = find_char_arg(argc, argv, (char *)"-suite", (char *)"all");
+    std::string const cfg_list = find_char_arg(argc, argv, (char *)"-cfg", const_cast<char *>(default_cfgs.c_str()));
+    std::string const format = find_char_arg(argc, argv, (char *)"-format", (char *)"csv");
+    char *out = find_char_arg(argc, argv, (char *)"-out", 0);
+    opt.iters = std::max(1, find_int_arg(argc, argv, (char *)"-iters", 20));
+    opt.warmup = std::max(0, find_int_arg(argc, argv, (char *)"-warmup", 3));
+    opt.max_batch = std::max(1, find_int_arg(argc, argv, (char *)"-batch", 4));
+    opt.max_threads = std::max(1, find_int_arg(argc, argv, (char *)"-threads", cores));
+    opt.thresh = find_float_arg(argc, argv, (char *)"-thresh", .5f);
+
+    std::vector<std::string> cfgs;
+    std::stringstream list(cfg_list);
+    for (std::string cfg; std::getline(list, cfg, ',');) if (!cfg.empty()) cfgs.push_back(cfg);
+
+    // darknet prints to stdout as well, so stdout is sent to stderr while the suites run
+    fflush(stdout);
+    int const results_fd = dup(fileno(stdout));
+    dup2(fileno(stderr), fileno(stdout));
+
+    srand(2222222);
+    set_threads(opt.max_threads);
+    bool const all = (suite == "all");
+    if (all || suite == "gemm") bench_gemm(cfgs, opt);
+    if (all || suite == "im2col") bench_im2col(cfgs, opt);
+    if (all || suite == "resize") bench_resize(cfgs, opt);
+    if (all || suite == "nms") bench_nms(opt);
+    if (all || suite == "detect") bench_detect(cfgs, opt);
+    fflush(stdout);
+    dup2(results_fd, fileno(stdout));
+    close(results_fd);
+    if (results.empty()) {
+        fprintf(stderr, "usage: %s [-suite all|gemm|im2col|resize|nms|detect] [-cfg a.cfg,b.cfg] [-iters n] [-warmup n]"
+            " [-batch n] [-threads n] [-thresh t] [-format csv|json] [-out file]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *fp = out ? fopen(out, "w") : stdout;
+    if (!fp) file_error(out);
+    if (format == "json") write_json(fp);
+    else write_csv(fp);
+    if (out) fclose(fp);
+    return 0;
+}
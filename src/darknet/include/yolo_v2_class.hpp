@@ -28,6 +28,20 @@ struct image_t {
     float *data;                // pointer to the image data
 };
 
+struct pixels_t {
+    const unsigned char *data;  // pointer to the first byte of the first row of 8-bit interleaved pixels
+    int h;                      // height
+    int w;                      // width
+    int row_bytes;              // distance in bytes between the starts of two consecutive rows
+    int pixel_inc;              // distance in bytes between two consecutive pixels (3 - RGB, 4 - RGBA)
+    int r, g, b;                // byte offsets of the red, green and blue channel inside a pixel
+};
+
+struct tile_t {
+    int x, y;                   // top-left corner of the tile in the frame
+    int w, h;                   // size of the tile, resized to the network input
+};
+
 #define C_SHARP_MAX_OBJECTS 1000
 struct bbox_t_container {
     bbox_t candidates[C_SHARP_MAX_OBJECTS];
@@ -35,9 +49,11 @@ struct bbox_t_container {
 
 #ifdef __cplusplus
 #include <memory>
+#include <string>
 #include <vector>
 #include <deque>
 #include <algorithm>
+#include <stdexcept>
 
 #ifdef OPENCV
 #include <opencv2/opencv.hpp>            // C++
@@ -52,6 +68,51 @@ extern "C" YOLODLL_API int dispose();
 extern "C" YOLODLL_API int get_device_count();
 extern "C" YOLODLL_API int get_device_name(int gpu, char* deviceName);
 
+// the thread pool every CPU layer runs on, shared with the application ( see threadpool.h )
+typedef void (*parallel_for_fn)(void *arg, int begin, int end);
+extern "C" YOLODLL_API void parallel_for(int n, int grain, parallel_for_fn fn, void *arg);
+extern "C" YOLODLL_API void configure_thread_pool(int threads, const int *cpus);
+extern "C" YOLODLL_API int thread_pool_size();
+
+struct layer_profile_t {
+    int index;
+    std::string type;           // "convolutional", "maxpool", ...
+    double avg_ms, min_ms, max_ms;
+    double bflops;              // billions of operations per forward pass
+    double gflops_per_s;        // achieved, bflops / average time
+    double bytes;               // estimated activation and weight bytes touched per forward pass
+    double gbytes_per_s;
+};
+
+struct network_profile_t {
+    int frames;                 // forward passes aggregated
+    double avg_ms;              // whole forward pass
+    std::vector<layer_profile_t> layers;
+};
+
+// multi-object tracker for the boxes of Detector, without OpenCV: tracks are matched to the detections of their
+// class by an optimal (Hungarian) assignment on IoU and move with a constant-velocity Kalman filter of the box
+// center and size, so that boxes can be extrapolated to frames the network did not run on
+class Tracker {
+    std::shared_ptr<void> tracks_ptr;
+public:
+    // capacity - most tracks kept at once, iou_thresh - least IoU of a detection and a predicted track to match,
+    // max_age - seconds between the detections passed to update() a track goes unmatched before it is dropped
+    YOLODLL_API Tracker(int capacity = 256, float iou_thresh = 0.3, double max_age = 1.0);
+    YOLODLL_API ~Tracker();
+
+    // advances the tracks to time (seconds of any steady clock), corrects them with the detections of the frame
+    // of that time and returns all tracks; track_id is set, frames_counter counts the matched detections
+    YOLODLL_API std::vector<bbox_t> update(std::vector<bbox_t> const &detections, double time);
+    // all tracks extrapolated to time, the tracks themselves are not changed
+    YOLODLL_API std::vector<bbox_t> predict(double time) const;
+    // the scene did not change from the last frame detected until time (e.g. the frames a motion gate
+    // skipped): the tracks count as seen and predict() does not move them before time. The detections of
+    // that frame can still come later, update() applies them at their own time
+    YOLODLL_API void hold(double time);
+    YOLODLL_API void clear();
+};
+
 class Detector {
     std::shared_ptr<void> detector_gpu_ptr;
     std::deque<std::vector<bbox_t> > prev_bbox_vec_deque;
@@ -59,12 +120,50 @@ class Detector {
 public:
     float nms = .4;
     bool wait_stream;
+    // the most tiles detect_tiled() and detect_tiles() run through the network as one batch, the
+    // activations of a call grow with it
+    int max_tile_batch = 4;
 	
-    YOLODLL_API Detector(std::string cfg_filename, std::string weight_filename, int gpu_id = 0);
+    // the detect*() calls can run on several threads at once: the weights are loaded once and every
+    // concurrent call gets its own activations and workspace, kept for reuse by later calls (CPU only,
+    // the GPU and networks with layers outside the activation memory plan run one call at a time).
+    // tracking_id() keeps a history and is not reentrant.
+    //
+    // weight_filename is a darknet .weights or a .dnpack file written by save_dnpack(), which is
+    // memory-mapped instead of read; an empty one keeps the random initialization of the cfg (benchmarking).
+    // a non-empty int8_calibration_dir quantizes the network to INT8 for CPU inference,
+    // calibrating the activation ranges on the .jpg/.png/.bmp images in that directory
+    YOLODLL_API Detector(std::string cfg_filename, std::string weight_filename, int gpu_id = 0,
+        std::string int8_calibration_dir = std::string());
     YOLODLL_API ~Detector();
 
     YOLODLL_API std::vector<bbox_t> detect(std::string image_filename, float thresh = 0.2, bool use_mean = false);
     YOLODLL_API std::vector<bbox_t> detect(image_t img, float thresh = 0.2, bool use_mean = false);
+    // resizes and normalizes the pixels straight into the network input, boxes are in pixels coordinates
+    YOLODLL_API std::vector<bbox_t> detect(pixels_t pixels, float thresh = 0.2, bool use_mean = false);
+    // resizes and normalizes the pixels into input (net width x height x 3 floats, planar) without running
+    // the network, safe to call from another thread
+    YOLODLL_API void preprocess(pixels_t pixels, float *input) const;
+    // runs the network on an input filled by preprocess(), boxes are scaled to init_w x init_h
+    YOLODLL_API std::vector<bbox_t> detect_preprocessed(float const *input, int init_w, int init_h, float thresh = 0.2, bool use_mean = false);
+    // runs all images through the network as one batch, results are returned in the same order as the images
+    YOLODLL_API std::vector<std::vector<bbox_t> > detect_batch(const std::vector<image_t> &imgs, float thresh = 0.2);
+    YOLODLL_API std::vector<std::vector<bbox_t> > detect_batch(const std::vector<pixels_t> &pixels, float thresh = 0.2);
+
+    // tiled detection of frames much larger than the network, where small objects would be lost by resizing
+    // the whole frame: tiles of tile_w x tile_h pixels (0 - the network size) overlapping by at least overlap
+    // pixels cover the frame, every tile is detected at the network resolution, max_tile_batch tiles at a time,
+    // and one NMS over the candidates of all the tiles removes the duplicates along the tile seams
+    YOLODLL_API std::vector<bbox_t> detect_tiled(pixels_t pixels, float thresh = 0.2, int tile_w = 0, int tile_h = 0,
+        int overlap = 64);
+    // the steps of detect_tiled() for spreading the tiles of one frame over several threads: each thread runs
+    // detect_tiles() on its share of get_tiles(), which returns boxes in frame coordinates, and merge_tiles()
+    // removes the duplicates along the tile seams with one NMS over the boxes of all the tiles (on the pixel
+    // boxes, so the results can differ slightly from detect_tiled())
+    YOLODLL_API std::vector<tile_t> get_tiles(int frame_w, int frame_h, int tile_w = 0, int tile_h = 0, int overlap = 64) const;
+    YOLODLL_API std::vector<bbox_t> detect_tiles(pixels_t pixels, const std::vector<tile_t> &tiles, float thresh = 0.2);
+    YOLODLL_API std::vector<bbox_t> merge_tiles(std::vector<bbox_t> boxes) const;
+
     static YOLODLL_API image_t load_image(std::string image_filename);
     static YOLODLL_API void free_image(image_t m);
     YOLODLL_API int get_net_width() const;
@@ -72,6 +171,17 @@ public:
     YOLODLL_API int get_net_color_depth() const;
 	YOLODLL_API int get_num_classes() const;
 
+    // writes the fused weights in the .dnpack format for fast, shared loading by other Detectors
+    YOLODLL_API bool save_dnpack(std::string filename);
+
+    // times every layer of the next frames forward passes on the CPU (0 - until disabled),
+    // restarting the aggregation; the profile is read with get_profile()
+    YOLODLL_API void enable_profiling(int frames = 0);
+    YOLODLL_API void disable_profiling();
+    YOLODLL_API network_profile_t get_profile() const;
+    // writes the recorded passes as Chrome trace event JSON (chrome://tracing, ui.perfetto.dev)
+    YOLODLL_API bool save_profile_trace(std::string filename) const;
+
     YOLODLL_API std::vector<bbox_t> tracking_id(std::vector<bbox_t> cur_bbox_vec, bool const change_history = true,
                                                 int const frames_story = 10, int const max_dist = 150);
 
@@ -1,4 +1,5 @@
 #include "activations.h"
+#include "threadpool.h"
 
 #include <math.h>
 #include <stdio.h>
@@ -97,22 +98,36 @@ float activate(float x, ACTIVATION a)
     return 0;
 }
 
-void activate_array(float *x, const int n, const ACTIVATION a)
+typedef struct activate_args {
+    float *x;
+    ACTIVATION a;
+} activate_args;
+
+static void activate_array_range(void *arg, int begin, int end)
 {
+    const activate_args *args = (const activate_args *)arg;
+    float *x = args->x;
+    const ACTIVATION a = args->a;
     int i;
-    if (a == LINEAR) {}
-    else if (a == LEAKY) {
-        for (i = 0; i < n; ++i) {
+    if (a == LEAKY) {
+        for (i = begin; i < end; ++i) {
             x[i] = leaky_activate(x[i]);
         }
     }
     else {
-        for (i = 0; i < n; ++i) {
+        for (i = begin; i < end; ++i) {
             x[i] = activate(x[i], a);
         }
     }
 }
 
+void activate_array(float *x, const int n, const ACTIVATION a)
+{
+    activate_args args = { x, a };
+    if (a == LINEAR) return;
+    parallel_for(n, parallel_grain(n, sizeof(float)), activate_array_range, &args);
+}
+
 float gradient(float x, ACTIVATION a)
 {
     switch(a){
@@ -9,7 +9,7 @@
 typedef layer avgpool_layer;
 
 image get_avgpool_image(avgpool_layer l);
-avgpool_layer make_avgpool_layer(int batch, int w, int h, int c);
+avgpool_layer make_avgpool_layer(int batch, int w, int h, int c, int train);
 void resize_avgpool_layer(avgpool_layer *l, int w, int h);
 void forward_avgpool_layer(const avgpool_layer l, network_state state);
 void backward_avgpool_layer(const avgpool_layer l, network_state state);
@@ -1,4 +1,5 @@
 #include "blas.h"
+#include "threadpool.h"
 
 #include <math.h>
 #include <assert.h>
@@ -68,6 +69,30 @@ void weighted_delta_cpu(float *a, float *b, float *s, float *da, float *db, floa
     }
 }
 
+typedef struct shortcut_args {
+    int w1, h1, c1, w2, h2, c2;
+    int stride, sample, minw, minh, minc;
+    float *add, *out;
+} shortcut_args;
+
+// the channels [begin, end) of all the batch, counted batch-major
+static void shortcut_channels(void *arg, int begin, int end)
+{
+    const shortcut_args *a = (const shortcut_args *)arg;
+    int i,j,t;
+    for(t = begin; t < end; ++t){
+        const int b = t / a->minc;
+        const int k = t % a->minc;
+        for(j = 0; j < a->minh; ++j){
+            for(i = 0; i < a->minw; ++i){
+                int out_index = i*a->sample + a->w2*(j*a->sample + a->h2*(k + a->c2*b));
+                int add_index = i*a->stride + a->w1*(j*a->stride + a->h1*(k + a->c1*b));
+                a->out[out_index] += a->add[add_index];
+            }
+        }
+    }
+}
+
 void shortcut_cpu(int batch, int w1, int h1, int c1, float *add, int w2, int h2, int c2, float *out)
 {
     int stride = w1/w2;
@@ -80,18 +105,8 @@ void shortcut_cpu(int batch, int w1, int h1, int c1, float *add, int w2, int h2,
     int minh = (h1 < h2) ? h1 : h2;
     int minc = (c1 < c2) ? c1 : c2;
 
-    int i,j,k,b;
-    for(b = 0; b < batch; ++b){
-        for(k = 0; k < minc; ++k){
-            for(j = 0; j < minh; ++j){
-                for(i = 0; i < minw; ++i){
-                    int out_index = i*sample + w2*(j*sample + h2*(k + c2*b));
-                    int add_index = i*stride + w1*(j*stride + h1*(k + c1*b));
-                    out[out_index] += add[add_index];
-                }
-            }
-        }
-    }
+    shortcut_args args = { w1, h1, c1, w2, h2, c2, stride, sample, minw, minh, minc, add, out };
+    parallel_for(batch*minc, parallel_grain(batch*minc, 2*minw*minh*sizeof(float)), shortcut_channels, &args);
 }
 
 void mean_cpu(float *x, int batch, int filters, int spatial, float *mean)
@@ -313,17 +328,45 @@ void softmax_cpu(float *input, int n, int batch, int batch_offset, int groups, i
     }
 }
 
+typedef struct upsample_args {
+    float *in;
+    int w, stride;
+    float scale;
+    float *out;
+} upsample_args;
+
+// every output is written: each input row is widened once and repeated stride times
+static void upsample_rows(void *arg, int begin, int end)
+{
+    const upsample_args *a = (const upsample_args *)arg;
+    const int w = a->w, stride = a->stride, out_w = w*stride;
+    int i, j, k;
+    for (k = begin; k < end; ++k) {
+        const float *src = a->in + (size_t)k*w;
+        float *dst = a->out + (size_t)k*out_w*stride;
+        for (i = 0; i < w; ++i) {
+            const float v = a->scale*src[i];
+            for (j = 0; j < stride; ++j) dst[i*stride + j] = v;
+        }
+        for (j = 1; j < stride; ++j) memcpy(dst + j*out_w, dst, out_w*sizeof(float));
+    }
+}
+
 void upsample_cpu(float *in, int w, int h, int c, int batch, int stride, int forward, float scale, float *out)
 {
     int i, j, k, b;
+    if (forward) {
+        upsample_args args = { in, w, stride, scale, out };
+        parallel_for(batch*c*h, parallel_grain(batch*c*h, (stride*stride + 1)*w*sizeof(float)), upsample_rows, &args);
+        return;
+    }
     for (b = 0; b < batch; ++b) {
         for (k = 0; k < c; ++k) {
             for (j = 0; j < h*stride; ++j) {
                 for (i = 0; i < w*stride; ++i) {
                     int in_index = b*w*h*c + k*w*h + (j / stride)*w + i / stride;
                     int out_index = b*w*h*c*stride*stride + k*w*h*stride*stride + j*w*stride + i;
-                    if (forward) out[out_index] = scale*in[in_index];
-                    else in[in_index] += scale*out[out_index];
+                    in[in_index] += scale*out[out_index];
                 }
             }
         }
@@ -39,6 +39,15 @@ typedef struct detection_with_class {
 	int best_class;
 } detection_with_class;
 
+// one class of a decoded box, as get_yolo_candidates() writes them: the classes
+// of a box are consecutive, in descending probability, and share its box_id
+typedef struct box_candidate {
+	box bbox;
+	float prob;
+	int class_id;
+	int box_id;
+} box_candidate;
+
 box float_to_box(float *f);
 float box_iou(box a, box b);
 float box_rmse(box a, box b);
@@ -10,7 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-connected_layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activation, int batch_normalize)
+connected_layer make_connected_layer(int batch, int inputs, int outputs, ACTIVATION activation, int batch_normalize, int train)
 {
     int i;
     connected_layer l = {0};
@@ -28,10 +28,12 @@ connected_layer make_connected_layer(int batch, int inputs, int outputs, ACTIVAT
     l.out_c = outputs;
 
     l.output = calloc(batch*outputs, sizeof(float));
-    l.delta = calloc(batch*outputs, sizeof(float));
+    if (train) {
+        l.delta = calloc(batch*outputs, sizeof(float));
 
-    l.weight_updates = calloc(inputs*outputs, sizeof(float));
-    l.bias_updates = calloc(outputs, sizeof(float));
+        l.weight_updates = calloc(inputs*outputs, sizeof(float));
+        l.bias_updates = calloc(outputs, sizeof(float));
+    }
 
     l.weights = calloc(outputs*inputs, sizeof(float));
     l.biases = calloc(outputs, sizeof(float));
@@ -52,21 +54,24 @@ connected_layer make_connected_layer(int batch, int inputs, int outputs, ACTIVAT
 
     if(batch_normalize){
         l.scales = calloc(outputs, sizeof(float));
-        l.scale_updates = calloc(outputs, sizeof(float));
         for(i = 0; i < outputs; ++i){
             l.scales[i] = 1;
         }
 
-        l.mean = calloc(outputs, sizeof(float));
-        l.mean_delta = calloc(outputs, sizeof(float));
-        l.variance = calloc(outputs, sizeof(float));
-        l.variance_delta = calloc(outputs, sizeof(float));
+        if (train) {
+            l.scale_updates = calloc(outputs, sizeof(float));
+
+            l.mean = calloc(outputs, sizeof(float));
+            l.mean_delta = calloc(outputs, sizeof(float));
+            l.variance = calloc(outputs, sizeof(float));
+            l.variance_delta = calloc(outputs, sizeof(float));
+
+            l.x = calloc(batch*outputs, sizeof(float));
+            l.x_norm = calloc(batch*outputs, sizeof(float));
+        }
 
         l.rolling_mean = calloc(outputs, sizeof(float));
         l.rolling_variance = calloc(outputs, sizeof(float));
-
-        l.x = calloc(batch*outputs, sizeof(float));
-        l.x_norm = calloc(batch*outputs, sizeof(float));
     }
 
 #ifdef GPU
@@ -410,7 +410,7 @@ void forward_convolutional_layer_gpu(convolutional_layer l, network_state state)
         float * a = l.weights_gpu;
         float * b = state.workspace;
         float * c = l.output_gpu;
-        if (l.size == 1) {
+        if (convolutional_input_as_columns(l)) {
             b = im;
         }
         else {
@@ -613,7 +613,8 @@ void backward_convolutional_layer_gpu(convolutional_layer l, network_state state
         float * b = state.workspace;
         float * c = l.weight_updates_gpu;
 
-        im2col_ongpu(state.input + i*l.c*l.h*l.w, l.c,  l.h,  l.w,  l.size,  l.stride, l.pad, state.workspace);
+        if (convolutional_input_as_columns(l)) b = state.input + i*l.c*l.h*l.w;
+        else im2col_ongpu(state.input + i*l.c*l.h*l.w, l.c,  l.h,  l.w,  l.size,  l.stride, l.pad, state.workspace);
         gemm_ongpu(0,1,m,n,k,1,a + i*m*k,k,b,k,1,c,n);
 
         if(state.delta){
@@ -622,9 +623,12 @@ void backward_convolutional_layer_gpu(convolutional_layer l, network_state state
             float * b = l.delta_gpu;
             float * c = state.workspace;
 
-            gemm_ongpu(1,0,n,k,m,1,a,n,b + i*k*m,k,0,c,k);
+            if (convolutional_input_as_columns(l)) gemm_ongpu(1,0,n,k,m,1,a,n,b + i*k*m,k,1,state.delta + i*l.c*l.h*l.w,k);
+            else {
+                gemm_ongpu(1,0,n,k,m,1,a,n,b + i*k*m,k,0,c,k);
 
-            col2im_ongpu(state.workspace, l.c,  l.h,  l.w,  l.size,  l.stride, l.pad, state.delta + i*l.c*l.h*l.w);
+                col2im_ongpu(state.workspace, l.c,  l.h,  l.w,  l.size,  l.stride, l.pad, state.delta + i*l.c*l.h*l.w);
+            }
             if(l.binary || l.xnor) {
                 swap_binary(&l);
             }
@@ -5,6 +5,9 @@
 #include "col2im.h"
 #include "blas.h"
 #include "gemm.h"
+#include "winograd.h"
+#include "quantize.h"
+#include "threadpool.h"
 #include <stdio.h>
 #include <time.h>
 
@@ -100,6 +103,15 @@ image get_convolutional_delta(convolutional_layer l)
     return float_to_image(w,h,c,l.delta);
 }
 
+// im2col of these layers is a plain copy, so the input is used as the column matrix:
+// 1x1 / stride 1 kernels, and unpadded kernels that cover the whole input (one output pixel)
+int convolutional_input_as_columns(layer l)
+{
+    if (l.pad) return 0;
+    if (l.size == 1 && l.stride == 1) return 1;
+    return l.size == l.w && l.size == l.h;
+}
+
 size_t get_workspace_size(layer l){
 #ifdef CUDNN
     if(gpu_index >= 0){
@@ -133,6 +145,9 @@ size_t get_workspace_size(layer l){
     }
     #endif
     if(l.xnor) return (size_t)l.bit_align*l.size*l.size*l.c * sizeof(float);
+    if(l.int8) return get_int8_workspace_size(l);
+    if(l.winograd) return get_winograd_workspace_size(l);
+    if(convolutional_input_as_columns(l)) return 0;
     return (size_t)l.out_h*l.out_w*l.size*l.size*l.c*sizeof(float);
 }
 
@@ -260,7 +275,7 @@ void cudnn_convolutional_setup(layer *l, int cudnn_preference)
 #endif
 #endif
 
-convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int use_bin_output)
+convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int n, int size, int stride, int padding, ACTIVATION activation, int batch_normalize, int binary, int xnor, int adam, int use_bin_output, int train)
 {
     int i;
     convolutional_layer l = {0};
@@ -280,10 +295,11 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     l.batch_normalize = batch_normalize;
 
     l.weights = calloc(c*n*size*size, sizeof(float));
-    l.weight_updates = calloc(c*n*size*size, sizeof(float));
-
     l.biases = calloc(n, sizeof(float));
-    l.bias_updates = calloc(n, sizeof(float));
+    if (train) {
+        l.weight_updates = calloc(c*n*size*size, sizeof(float));
+        l.bias_updates = calloc(n, sizeof(float));
+    }
 
     // float scale = 1./sqrt(size*size*c);
     float scale = sqrt(2./(size*size*c));
@@ -297,7 +313,7 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
     l.inputs = l.w * l.h * l.c;
 
     l.output = calloc(l.batch*l.outputs, sizeof(float));
-    l.delta  = calloc(l.batch*l.outputs, sizeof(float));
+    if (train) l.delta = calloc(l.batch*l.outputs, sizeof(float));
 
     l.forward = forward_convolutional_layer;
     l.backward = backward_convolutional_layer;
@@ -320,26 +336,37 @@ convolutional_layer make_convolutional_layer(int batch, int h, int w, int c, int
 
     if(batch_normalize){
         l.scales = calloc(n, sizeof(float));
-        l.scale_updates = calloc(n, sizeof(float));
         for(i = 0; i < n; ++i){
             l.scales[i] = 1;
         }
 
-        l.mean = calloc(n, sizeof(float));
-        l.variance = calloc(n, sizeof(float));
+        // batch statistics and their gradients are only used while training
+        if (train) {
+            l.scale_updates = calloc(n, sizeof(float));
 
-        l.mean_delta = calloc(n, sizeof(float));
-        l.variance_delta = calloc(n, sizeof(float));
+            l.mean = calloc(n, sizeof(float));
+            l.variance = calloc(n, sizeof(float));
+
+            l.mean_delta = calloc(n, sizeof(float));
+            l.variance_delta = calloc(n, sizeof(float));
+
+            l.x = calloc(l.batch*l.outputs, sizeof(float));
+            l.x_norm = calloc(l.batch*l.outputs, sizeof(float));
+        }
 
         l.rolling_mean = calloc(n, sizeof(float));
         l.rolling_variance = calloc(n, sizeof(float));
-        l.x = calloc(l.batch*l.outputs, sizeof(float));
-        l.x_norm = calloc(l.batch*l.outputs, sizeof(float));
+        // unit variance keeps the fused weights of an untrained network finite
+        for(i = 0; i < n; ++i){
+            l.rolling_variance[i] = 1;
+        }
     }
     if(adam){
         l.adam = 1;
-        l.m = calloc(c*n*size*size, sizeof(float));
-        l.v = calloc(c*n*size*size, sizeof(float));
+        if (train) {
+            l.m = calloc(c*n*size*size, sizeof(float));
+            l.v = calloc(c*n*size*size, sizeof(float));
+        }
     }
 
 #ifdef GPU
@@ -434,9 +461,30 @@ void denormalize_convolutional_layer(convolutional_layer l)
     }
 }
 
+// after fuse_conv_batchnorm(): the scales and statistics are folded into the
+// weights and biases, only binary layers keep using l.scales
+void free_convolutional_batchnorm(convolutional_layer *l)
+{
+    if (!l->binary) {
+        free(l->scales);
+        l->scales = 0;
+    }
+    free(l->scale_updates);
+    free(l->mean);
+    free(l->variance);
+    free(l->mean_delta);
+    free(l->variance_delta);
+    free(l->rolling_mean);
+    free(l->rolling_variance);
+    free(l->x);
+    free(l->x_norm);
+    l->scale_updates = l->mean = l->variance = l->mean_delta = l->variance_delta = 0;
+    l->rolling_mean = l->rolling_variance = l->x = l->x_norm = 0;
+}
+
 void test_convolutional_layer()
 {
-    convolutional_layer l = make_convolutional_layer(1, 5, 5, 3, 2, 5, 2, 1, LEAKY, 1, 0, 0, 0, 0);
+    convolutional_layer l = make_convolutional_layer(1, 5, 5, 3, 2, 5, 2, 1, LEAKY, 1, 0, 0, 0, 0, 1);
     l.batch_normalize = 1;
     float data[] = {1,1,1,1,1,
         1,1,1,1,1,
@@ -460,8 +508,6 @@ void test_convolutional_layer()
 
 void resize_convolutional_layer(convolutional_layer *l, int w, int h)
 {
-    int old_w = l->w;
-    int old_h = l->h;
     l->w = w;
     l->h = h;
     int out_w = convolutional_out_width(*l);
@@ -474,8 +520,8 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
     l->inputs = l->w * l->h * l->c;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta  = realloc(l->delta,  l->batch*l->outputs*sizeof(float));
-    if(l->batch_normalize){
+    if (l->delta) l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if(l->batch_normalize && l->x){
         l->x = realloc(l->x, l->batch*l->outputs*sizeof(float));
         l->x_norm  = realloc(l->x_norm, l->batch*l->outputs*sizeof(float));
     }
@@ -485,7 +531,8 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
     }
 
 #ifdef GPU
-    if (old_w < w || old_h < h) {
+    // also reached from resize_network_batch(), so the gpu buffers are always rebuilt like in the other layers
+    {
         cuda_free(l->delta_gpu);
         cuda_free(l->output_gpu);
 
@@ -524,18 +571,31 @@ void resize_convolutional_layer(convolutional_layer *l, int w, int h)
 #endif
 }
 
-void add_bias(float *output, float *biases, int batch, int n, int size)
+typedef struct add_bias_args {
+    float *output, *biases;
+    int n, size;
+} add_bias_args;
+
+// the planes [begin, end) of all the batch, counted batch-major
+static void add_bias_planes(void *arg, int begin, int end)
 {
-    int i,j,b;
-    for(b = 0; b < batch; ++b){
-        for(i = 0; i < n; ++i){
-            for(j = 0; j < size; ++j){
-                output[(b*n + i)*size + j] += biases[i];
-            }
+    const add_bias_args *a = (const add_bias_args *)arg;
+    int t,j;
+    for(t = begin; t < end; ++t){
+        const float bias = a->biases[t % a->n];
+        float *out = a->output + (size_t)t*a->size;
+        for(j = 0; j < a->size; ++j){
+            out[j] += bias;
         }
     }
 }
 
+void add_bias(float *output, float *biases, int batch, int n, int size)
+{
+    add_bias_args args = { output, biases, n, size };
+    parallel_for(batch*n, parallel_grain(batch*n, size*sizeof(float)), add_bias_planes, &args);
+}
+
 void scale_bias(float *output, float *scales, int batch, int n, int size)
 {
     int i,j,b;
@@ -685,7 +745,16 @@ void forward_convolutional_layer(convolutional_layer l, network_state state)
     int out_w = convolutional_out_width(l);
     int i;
 
-    fill_cpu(l.outputs*l.batch, 0, l.output, 1);
+    if (l.int8) {
+        forward_convolutional_layer_int8(l, state);
+        return;
+    }
+
+    // Without batchnorm the bias and activation are applied to each output tile by the
+    // blocked GEMM or the Winograd output transform, both of which overwrite the output,
+    // instead of zeroing it first and making two more passes over it afterwards
+    const int fused = !l.xnor && !l.batch_normalize && (l.winograd || gemm_nn_fused_available());
+    if (!fused) fill_cpu(l.outputs*l.batch, 0, l.output, 1);
 
     if(l.xnor){
         if (!l.align_bit_weights || state.train) {
@@ -705,9 +774,6 @@ void forward_convolutional_layer(convolutional_layer l, network_state state)
     float *b = state.workspace;
     float *c = l.output;
 
-    static int u = 0;
-    u++;
-
     for(i = 0; i < l.batch; ++i){
         //im2col_cpu(state.input, l.c, l.h, l.w, l.size, l.stride, l.pad, b);
 
@@ -857,23 +923,34 @@ void forward_convolutional_layer(convolutional_layer l, network_state state)
             //free(bit_weights);
             //free(mean_arr);
         }
+        else if (l.winograd) {
+            forward_winograd_convolution(l, state.input, b, c, fused);
+        }
         else {
-            im2col_cpu_custom(state.input, l.c, l.h, l.w, l.size, l.stride, l.pad, b);
+            float *columns = state.input;
+            if (!convolutional_input_as_columns(l)) {
+                im2col_cpu_custom(state.input, l.c, l.h, l.w, l.size, l.stride, l.pad, b);
+                columns = b;
+            }
 
-            gemm(0, 0, m, n, k, 1, a, k, b, n, 1, c, n);
+            if (fused) gemm_nn_fused(m, n, k, a, k, l.weights_packed, columns, n, c, n, l.biases, l.activation);
+            else if (!l.weights_packed || !gemm_nn_prepacked(m, n, k, l.weights_packed, columns, n, c, n))
+                gemm(0, 0, m, n, k, 1, a, k, columns, n, 1, c, n);
             // bit-count to float
         }
         c += n*m;
         state.input += l.c*l.h*l.w;
     }
 
-    if(l.batch_normalize){
-        forward_batchnorm_layer(l, state);
-    }
-    add_bias(l.output, l.biases, l.batch, l.n, out_h*out_w);
+    if (!fused) {
+        if(l.batch_normalize){
+            forward_batchnorm_layer(l, state);
+        }
+        add_bias(l.output, l.biases, l.batch, l.n, out_h*out_w);
 
-    //activate_array(l.output, m*n*l.batch, l.activation);
-    activate_array_cpu_custom(l.output, m*n*l.batch, l.activation);
+        //activate_array(l.output, m*n*l.batch, l.activation);
+        activate_array_cpu_custom(l.output, m*n*l.batch, l.activation);
+    }
 
     if(l.binary || l.xnor) swap_binary(&l);
 }
@@ -885,6 +962,7 @@ void backward_convolutional_layer(convolutional_layer l, network_state state)
     int n = l.size*l.size*l.c;
     int k = convolutional_out_height(l)*
         convolutional_out_width(l);
+    int as_columns = convolutional_input_as_columns(l);
 
     gradient_array(l.output, m*k*l.batch, l.activation, l.delta);
     backward_bias(l.bias_updates, l.delta, l.batch, l.n, k);
@@ -900,7 +978,8 @@ void backward_convolutional_layer(convolutional_layer l, network_state state)
 
         float *im = state.input+i*l.c*l.h*l.w;
 
-        im2col_cpu(im, l.c, l.h, l.w,
+        if (as_columns) b = im;
+        else im2col_cpu(im, l.c, l.h, l.w,
                 l.size, l.stride, l.pad, b);
         gemm(0,1,m,n,k,1,a,k,b,k,1,c,n);
 
@@ -909,9 +988,13 @@ void backward_convolutional_layer(convolutional_layer l, network_state state)
             b = l.delta + i*m*k;
             c = state.workspace;
 
-            gemm(1,0,n,k,m,1,a,n,b,k,0,c,k);
+            // col2im of these layers only adds the columns to the input delta
+            if (as_columns) gemm(1,0,n,k,m,1,a,n,b,k,1,state.delta+i*l.c*l.h*l.w,k);
+            else {
+                gemm(1,0,n,k,m,1,a,n,b,k,0,c,k);
 
-            col2im_cpu(state.workspace, l.c,  l.h,  l.w,  l.size,  l.stride, l.pad, state.delta+i*l.c*l.h*l.w);
+                col2im_cpu(state.workspace, l.c,  l.h,  l.w,  l.size,  l.stride, l.pad, state.delta+i*l.c*l.h*l.w);
+            }
         }
     }
 }
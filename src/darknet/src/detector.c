@@ -1121,6 +1121,7 @@ void test_detector(char *datacfg, char *cfgfile, char *weightfile, char *filenam
     //set_batch_network(&net, 1);
     fuse_conv_batchnorm(net);
     calculate_binary_weights(net);
+    calculate_winograd_weights(&net);
     if (net.layers[net.n - 1].classes != names_size) {
         printf(" Error: in the file %s number of names %d that isn't equal to classes=%d in the file %s \n",
             name_list, names_size, net.layers[net.n - 1].classes, cfgfile);
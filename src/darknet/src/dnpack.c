@@ -0,0 +1,264 @@
+#include "dnpack.h"
+#include "convolutional_layer.h"
+#include "winograd.h"
+#include "gemm.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define DNPACK_ALIGN 64
+#define DNPACK_PACKED 1
+
+typedef struct dnpack_header {
+    char magic[4];              // "DNPK"
+    int32_t version;
+    int32_t layers;             // number of dnpack_layer records
+    int32_t net_layers;         // layers of the cfg the file was made from
+    int32_t mr, kc;             // blocked SGEMM layout of the packed weights, 0 if none
+    int32_t reserved[10];
+} dnpack_header;
+
+typedef struct dnpack_layer {
+    int32_t index;
+    int32_t n, c, size;
+    int32_t flags;
+    int32_t reserved;
+    uint64_t biases;            // byte offsets from the start of the file
+    uint64_t weights;
+    uint64_t packed;
+} dnpack_layer;
+
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + DNPACK_ALIGN - 1) & ~(uint64_t)(DNPACK_ALIGN - 1);
+}
+
+static int pack_layer_weights(layer l, int mr)
+{
+    return mr && !l.xnor && !l.binary && !winograd_tile_size(l);
+}
+
+static void write_padding(FILE *fp, uint64_t *offset, uint64_t to)
+{
+    static const char zeros[DNPACK_ALIGN] = { 0 };
+    fwrite(zeros, 1, (size_t)(to - *offset), fp);
+    *offset = to;
+}
+
+int is_dnpack_file(char *filename)
+{
+    size_t len = strlen(filename);
+    return len > 7 && 0 == strcmp(filename + len - 7, ".dnpack");
+}
+
+int save_dnpack(network *net, char *filename)
+{
+    dnpack_header header = { { 'D', 'N', 'P', 'K' }, DNPACK_VERSION };
+    dnpack_layer *records;
+    uint64_t offset;
+    int i, r;
+    FILE *fp;
+
+    for (i = 0; i < net->n; ++i) {
+        LAYER_TYPE t = net->layers[i].type;
+        if (t == CONVOLUTIONAL) ++header.layers;
+        else if (t == CONNECTED || t == LOCAL || t == DECONVOLUTIONAL || t == BATCHNORM || t == RNN || t == GRU || t == CRNN) {
+            fprintf(stderr, "dnpack: %s layer %d is not supported\n", get_layer_string(t), i);
+            return 0;
+        }
+    }
+    fuse_conv_batchnorm(*net);
+
+    header.net_layers = net->n;
+    gemm_packed_weights_layout(&header.mr, &header.kc);
+    records = calloc(header.layers, sizeof(dnpack_layer));
+
+    offset = sizeof(dnpack_header) + (uint64_t)header.layers * sizeof(dnpack_layer);
+    for (i = 0, r = 0; i < net->n; ++i) {
+        layer l = net->layers[i];
+        if (l.type != CONVOLUTIONAL) continue;
+        const int k = l.size*l.size*l.c;
+        records[r].index = i;
+        records[r].n = l.n;
+        records[r].c = l.c;
+        records[r].size = l.size;
+        records[r].biases = offset = align_offset(offset);
+        offset += (uint64_t)l.n * sizeof(float);
+        records[r].weights = offset = align_offset(offset);
+        offset += (uint64_t)l.n * k * sizeof(float);
+        if (pack_layer_weights(l, header.mr)) {
+            records[r].flags |= DNPACK_PACKED;
+            records[r].packed = offset = align_offset(offset);
+            offset += gemm_packed_weights_size(l.n, k) * sizeof(float);
+        }
+        ++r;
+    }
+
+    fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "dnpack: couldn't open %s\n", filename);
+        free(records);
+        return 0;
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(records, sizeof(dnpack_layer), header.layers, fp);
+    offset = sizeof(dnpack_header) + (uint64_t)header.layers * sizeof(dnpack_layer);
+    for (r = 0; r < header.layers; ++r) {
+        layer l = net->layers[records[r].index];
+        const int k = l.size*l.size*l.c;
+        write_padding(fp, &offset, records[r].biases);
+        fwrite(l.biases, sizeof(float), l.n, fp);
+        offset += (uint64_t)l.n * sizeof(float);
+        write_padding(fp, &offset, records[r].weights);
+        fwrite(l.weights, sizeof(float), (size_t)l.n*k, fp);
+        offset += (uint64_t)l.n * k * sizeof(float);
+        if (records[r].flags & DNPACK_PACKED) {
+            size_t size = gemm_packed_weights_size(l.n, k);
+            float *packed = calloc(size, sizeof(float));
+            gemm_pack_weights(l.n, k, l.weights, k, packed);
+            write_padding(fp, &offset, records[r].packed);
+            fwrite(packed, sizeof(float), size, fp);
+            offset += size * sizeof(float);
+            free(packed);
+        }
+    }
+    r = !ferror(fp);
+    fclose(fp);
+    free(records);
+    return r;
+}
+
+static void *map_file(char *filename, size_t *size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    HANDLE mapping;
+    LARGE_INTEGER file_size;
+    void *data;
+    if (file == INVALID_HANDLE_VALUE) return 0;
+    if (!GetFileSizeEx(file, &file_size) || !file_size.QuadPart) {
+        CloseHandle(file);
+        return 0;
+    }
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) return 0;
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    *size = (size_t)file_size.QuadPart;
+    return data;
+#else
+    struct stat st;
+    void *data;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return 0;
+    if (fstat(fd, &st) || !st.st_size) {
+        close(fd);
+        return 0;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 0;
+    *size = st.st_size;
+    return data;
+#endif
+}
+
+static void unmap_file(void *data, size_t size)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+static int check_range(uint64_t offset, uint64_t bytes, size_t size)
+{
+    return offset && offset % DNPACK_ALIGN == 0 && offset + bytes <= size;
+}
+
+int load_dnpack(network *net, char *filename)
+{
+    size_t size = 0;
+    char *data = map_file(filename, &size);
+    dnpack_header header;
+    dnpack_layer *records;
+    int mr, kc, use_packed, r;
+
+    fprintf(stderr, "Mapping weights from %s...", filename);
+    if (!data) {
+        fprintf(stderr, " couldn't map the file\n");
+        return 0;
+    }
+    if (size < sizeof(header)) goto invalid;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, "DNPK", 4) || header.version != DNPACK_VERSION || header.net_layers != net->n ||
+        header.layers < 0 || sizeof(header) + (uint64_t)header.layers * sizeof(dnpack_layer) > size) goto invalid;
+
+    // packed weights of another SGEMM layout are ignored, the plain ones are always there
+    use_packed = gemm_packed_weights_layout(&mr, &kc) && mr == header.mr && kc == header.kc;
+
+    records = (dnpack_layer *)(data + sizeof(header));
+    for (r = 0; r < header.layers; ++r) {
+        dnpack_layer d = records[r];
+        layer l;
+        if (d.index < 0 || d.index >= net->n) goto invalid;
+        l = net->layers[d.index];
+        const uint64_t k = (uint64_t)l.size*l.size*l.c;
+        if (l.type != CONVOLUTIONAL || d.n != l.n || d.c != l.c || d.size != l.size) goto invalid;
+        if (!check_range(d.biases, l.n * sizeof(float), size) || !check_range(d.weights, l.n * k * sizeof(float), size))
+            goto invalid;
+        if ((d.flags & DNPACK_PACKED) && !check_range(d.packed, gemm_packed_weights_size(l.n, (int)k) * sizeof(float), size))
+            goto invalid;
+    }
+
+    for (r = 0; r < header.layers; ++r) {
+        dnpack_layer d = records[r];
+        layer *l = &net->layers[d.index];
+        if (!l->weights_mapped) {
+            free(l->biases);
+            free(l->weights);
+            free(l->weights_packed);
+        }
+        l->biases = (float *)(data + d.biases);
+        l->weights = (float *)(data + d.weights);
+        l->weights_packed = (use_packed && (d.flags & DNPACK_PACKED)) ? (float *)(data + d.packed) : 0;
+        l->weights_mapped = 1;
+        // the stored weights are fused already
+        l->batch_normalize = 0;
+        free_convolutional_batchnorm(l);
+#ifdef GPU
+        if (gpu_index >= 0) push_convolutional_layer(*l);
+#endif
+    }
+    unmap_dnpack(net);
+    net->weights_map = data;
+    net->weights_map_size = size;
+    fprintf(stderr, " Done!\n");
+    return 1;
+
+invalid:
+    fprintf(stderr, " %s does not match the cfg\n", filename);
+    unmap_file(data, size);
+    return 0;
+}
+
+void unmap_dnpack(network *net)
+{
+    if (!net->weights_map) return;
+    unmap_file(net->weights_map, net->weights_map_size);
+    net->weights_map = 0;
+    net->weights_map_size = 0;
+}
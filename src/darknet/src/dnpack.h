@@ -0,0 +1,27 @@
+#ifndef DNPACK_H
+#define DNPACK_H
+
+#include "network.h"
+
+// .dnpack: the convolutional weights of a network stored ready to run, to be
+// memory-mapped instead of parsed. Every layer keeps its batchnorm-fused biases
+// and weights, plus the weights in the blocked SGEMM layout where that layout
+// applies, each array 64-byte aligned. The cfg still describes the network,
+// the file only replaces the .weights. Pages are mapped read-only and shared,
+// so processes loading the same file share their memory.
+
+#define DNPACK_VERSION 1
+
+// fuses batchnorm into the weights of net and writes them, returns 0 on failure
+YOLODLL_API int save_dnpack(network *net, char *filename);
+
+// maps filename and points the layer weights of net (parsed from the matching cfg)
+// into it; returns 0, leaving net untouched, when the file does not match
+YOLODLL_API int load_dnpack(network *net, char *filename);
+
+// called by free_network()
+void unmap_dnpack(network *net);
+
+int is_dnpack_file(char *filename);
+
+#endif
@@ -2,16 +2,14 @@
 #include "utils.h"
 #include "im2col.h"
 #include "cuda.h"
+#include "threadpool.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 #include <float.h>
 #include <string.h>
 
-#if defined(_OPENMP)
-#include <omp.h>
-#endif
-
 void gemm_bin(int M, int N, int K, float ALPHA,
         char  *A, int lda,
         float *B, int ldb,
@@ -466,15 +464,19 @@ void transpose_bin(char *A, char *B, const int n, const int m,
 */
 
 
-// transpose by 32-bit
-void transpose_bin(uint32_t *A, uint32_t *B, const int n, const int m,
-    const int lda, const int ldb, const int block_size)
+typedef struct transpose_bin_args {
+    uint32_t *A, *B;
+    int m, lda, ldb;
+} transpose_bin_args;
+
+static void transpose_bin_rows(void *arg, int begin, int end)
 {
-    //printf("\n n = %d (n mod 32 = %d), m = %d (m mod 32 = %d) \n", n, n % 32, m, m % 32);
-    //printf("\n lda = %d (lda mod 32 = %d), ldb = %d (ldb mod 32 = %d) \n", lda, lda % 32, ldb, ldb % 32);
-    int i;
-    #pragma omp parallel for
-    for (i = 0; i < n; i += 32) {
+    const transpose_bin_args *a = (const transpose_bin_args *)arg;
+    uint32_t *A = a->A, *B = a->B;
+    const int m = a->m, lda = a->lda, ldb = a->ldb;
+    int t;
+    for (t = begin; t < end; ++t) {
+        const int i = t*32;
         int j;
         for (j = 0; j < m; j += 32) {
             int a_index = i*lda + j;
@@ -487,50 +489,29 @@ void transpose_bin(uint32_t *A, uint32_t *B, const int n, const int m,
         }
     }
 }
+
+// transpose by 32-bit
+void transpose_bin(uint32_t *A, uint32_t *B, const int n, const int m,
+    const int lda, const int ldb, const int block_size)
+{
+    //printf("\n n = %d (n mod 32 = %d), m = %d (m mod 32 = %d) \n", n, n % 32, m, m % 32);
+    //printf("\n lda = %d (lda mod 32 = %d), ldb = %d (ldb mod 32 = %d) \n", lda, lda % 32, ldb, ldb % 32);
+    transpose_bin_args args = { A, B, m, lda, ldb };
+    parallel_for((n + 31) / 32, 1, transpose_bin_rows, &args);
+}
 //----------------------------
 
 
-#if (defined(__AVX__) && defined(__x86_64__)) || defined(_WIN64)
+#if defined(__x86_64__) || defined(_WIN64)
 
 #ifdef _WIN64
 #include <intrin.h>
-#include <ammintrin.h>
 #include <immintrin.h>
-#include <smmintrin.h>
-
-#if defined(_MSC_VER) && _MSC_VER <= 1900
-static inline __int32 _mm256_extract_epi64(__m256i a, const int index) {
-    return a.m256i_i64[index];
-}
-
-static inline __int32 _mm256_extract_epi32(__m256i a, const int index) {
-    return a.m256i_i32[index];
-}
-#endif
-
-static inline float _castu32_f32(uint32_t a) {
-    return *((float *)&a);
-}
-
-static inline float _mm256_extract_float32(__m256 a, const int index) {
-    return a.m256_f32[index];
-}
-
 #else    // Linux GCC/Clang
 #include <x86intrin.h>
-#include <ammintrin.h>
 #include <immintrin.h>
-#include <smmintrin.h>
 #include <cpuid.h>
 
-static inline float _castu32_f32(uint32_t a) {
-    return *((float *)&a);
-}
-
-static inline float _mm256_extract_float32(__m256 a, const int index) {
-    return _castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), index));
-}
-
 void asm_cpuid(uint32_t* abcd, uint32_t eax)
 {
     uint32_t ebx = 0, edx = 0, ecx = 0;
@@ -550,7 +531,6 @@ void asm_cpuid(uint32_t* abcd, uint32_t eax)
 #endif
 
 
-
 #ifdef _WIN32
 //  Windows
 #define cpuid(info, x)    __cpuidex(info, x, 0)
@@ -582,10 +562,27 @@ static int HW_AVX512BW;   //  AVX512 Byte + Word
 static int HW_AVX512DQ;   //  AVX512 Doubleword + Quadword
 static int HW_AVX512IFMA; //  AVX512 Integer 52-bit Fused Multiply-Add
 static int HW_AVX512VBMI; //  AVX512 Vector Byte Manipulation Instructions
+static int HW_AVX512VNNI; //  AVX512 Vector Neural Network Instructions
+
+static pthread_once_t cpu_features_once = PTHREAD_ONCE_INIT;
+
+// the register state the OS saves on context switches (XCR0)
+static uint64_t read_xcr0(void)
+{
+#ifdef _WIN32
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
 
 // https://stackoverflow.com/questions/6121792/how-to-check-if-a-cpu-supports-the-sse3-instruction-set
 void check_cpu_features(void) {
     int info[4];
+    int osxsave = 0;
+    uint64_t xcr0;
     cpuid(info, 0);
     int nIds = info[0];
 
@@ -609,6 +606,7 @@ void check_cpu_features(void) {
         HW_FMA3 = (info[2] & ((int)1 << 12)) != 0;
 
         HW_RDRAND = (info[2] & ((int)1 << 30)) != 0;
+        osxsave = (info[2] & ((int)1 << 27)) != 0;
     }
     if (nIds >= 0x00000007) {
         cpuid(info, 0x00000007);
@@ -629,6 +627,7 @@ void check_cpu_features(void) {
         HW_AVX512DQ = (info[1] & ((int)1 << 17)) != 0;
         HW_AVX512IFMA = (info[1] & ((int)1 << 21)) != 0;
         HW_AVX512VBMI = (info[2] & ((int)1 << 1)) != 0;
+        HW_AVX512VNNI = (info[2] & ((int)1 << 11)) != 0;
     }
     if (nExIds >= 0x80000001) {
         cpuid(info, 0x80000001);
@@ -638,12 +637,23 @@ void check_cpu_features(void) {
         HW_FMA4 = (info[2] & ((int)1 << 16)) != 0;
         HW_XOP = (info[2] & ((int)1 << 11)) != 0;
     }
+
+    // the CPU flags alone are not enough: AVX faults unless the OS saves the YMM registers,
+    // AVX-512 unless it saves the opmask and ZMM registers as well
+    xcr0 = osxsave ? read_xcr0() : 0;
+    if ((xcr0 & 0x6) != 0x6) {
+        HW_AVX = HW_AVX2 = HW_FMA3 = HW_FMA4 = HW_XOP = 0;
+    }
+    if ((xcr0 & 0xe6) != 0xe6) {
+        HW_AVX512F = HW_AVX512CD = HW_AVX512PF = HW_AVX512ER = HW_AVX512VL = 0;
+        HW_AVX512BW = HW_AVX512DQ = HW_AVX512IFMA = HW_AVX512VBMI = HW_AVX512VNNI = 0;
+    }
 }
 
 int is_avx() {
     static int result = -1;
     if (result == -1) {
-        check_cpu_features();
+        pthread_once(&cpu_features_once, check_cpu_features);
         result = HW_AVX;
         if (result == 1) printf(" Used AVX \n");
         else printf(" Not used AVX \n");
@@ -654,7 +664,7 @@ int is_avx() {
 int is_fma_avx2() {
     static int result = -1;
     if (result == -1) {
-        check_cpu_features();
+        pthread_once(&cpu_features_once, check_cpu_features);
         result = HW_FMA3 && HW_AVX2;
         if (result == 1) printf(" Used FMA & AVX2 \n");
         else printf(" Not used FMA & AVX2 \n");
@@ -662,6 +672,65 @@ int is_fma_avx2() {
     return result;
 }
 
+int is_avx512_vnni() {
+    static int result = -1;
+    if (result == -1) {
+        pthread_once(&cpu_features_once, check_cpu_features);
+        result = HW_AVX512F && HW_AVX512VNNI;
+    }
+    return result;
+}
+
+#else
+
+int is_avx() { return 0; }
+int is_fma_avx2() { return 0; }
+int is_avx512_vnni() { return 0; }
+
+#endif    // x86_64
+
+#if (defined(__AVX__) && defined(__x86_64__)) || defined(_WIN64)
+
+#ifdef _WIN64
+#include <intrin.h>
+#include <ammintrin.h>
+#include <immintrin.h>
+#include <smmintrin.h>
+
+#if defined(_MSC_VER) && _MSC_VER <= 1900
+static inline __int32 _mm256_extract_epi64(__m256i a, const int index) {
+    return a.m256i_i64[index];
+}
+
+static inline __int32 _mm256_extract_epi32(__m256i a, const int index) {
+    return a.m256i_i32[index];
+}
+#endif
+
+static inline float _castu32_f32(uint32_t a) {
+    return *((float *)&a);
+}
+
+static inline float _mm256_extract_float32(__m256 a, const int index) {
+    return a.m256_f32[index];
+}
+
+#else    // Linux GCC/Clang
+#include <x86intrin.h>
+#include <ammintrin.h>
+#include <immintrin.h>
+#include <smmintrin.h>
+#include <cpuid.h>
+
+static inline float _castu32_f32(uint32_t a) {
+    return *((float *)&a);
+}
+
+static inline float _mm256_extract_float32(__m256 a, const int index) {
+    return _castu32_f32(_mm256_extract_epi32(_mm256_castps_si256(a), index));
+}
+#endif
+
 // https://software.intel.com/sites/landingpage/IntrinsicsGuide
 void gemm_nn(int M, int N, int K, float ALPHA,
     float *A, int lda,
@@ -729,7 +798,6 @@ void convolution_2d_old(int w, int h, int ksize, int n, int c, int pad, int stri
 
     int fil;
     // filter index
-    #pragma omp parallel for      // "omp parallel for" - automatic parallelization of loop by using OpenMP
     for (fil = 0; fil < n; ++fil) {
         //int i, f, j;
         int chan, y, x, f_y, f_x;
@@ -776,14 +844,6 @@ void convolution_2d(int w, int h, int ksize, int n, int c, int pad, int stride,
     const int out_w = (w + 2 * pad - ksize) / stride + 1;    // output_width=input_width for stride=1 and pad=1
     int i;
 
-#if defined(_OPENMP)
-    static int max_num_threads = 0;
-    if (max_num_threads == 0) {
-        max_num_threads = omp_get_max_threads();
-        //omp_set_num_threads( max_num_threads / 2);
-    }
-#endif
-
     //convolution_2d_old(w, h, ksize, n, c, pad, stride, weights, input, output);
 
     __m256i all256_sing1 = _mm256_set_epi32(0x80000000, 0x80000000, 0x80000000, 0x80000000, 0x80000000, 0x80000000, 0x80000000, 0x80000000);
@@ -811,7 +871,6 @@ void convolution_2d(int w, int h, int ksize, int n, int c, int pad, int stride,
 
     int fil;
     // filter index
-    #pragma omp parallel for      // "omp parallel for" - automatic parallelization of loop by using OpenMP
     for (fil = 0; fil < n; ++fil) {
         int chan, y, x, f_y, f_x;
         float cur_mean = fabs(mean[fil]);
@@ -942,67 +1001,74 @@ static inline int popcnt256_custom(__m256i n) {
         + _mm256_extract_epi64(val, 3);
 }
 
-// 5x times faster than gemm()-float32
-// further optimizations: do mean-mult only for the last layer
-void gemm_nn_custom_bin_mean_transposed(int M, int N, int K, float ALPHA_UNUSED,
-    unsigned char *A, int lda,
-    unsigned char *B, int ldb,
-    float *C, int ldc, float *mean_arr)
+typedef struct gemm_bin_args {
+    unsigned char *A, *B;
+    float *C;
+    int N, K, lda, ldb, ldc;
+    float *mean_arr;
+} gemm_bin_args;
+
+static void gemm_nn_custom_bin_mean_rows(void *arg, int begin, int end)
 {
+    const gemm_bin_args *a = (const gemm_bin_args *)arg;
+    unsigned char *A = a->A, *B = a->B;
+    float *C = a->C, *mean_arr = a->mean_arr;
+    const int N = a->N, K = a->K, lda = a->lda, ldb = a->ldb, ldc = a->ldc;
     int i;
+    for (i = begin; i < end; ++i) {
+        // l.n - filters [16 - 55 - 1024]
+             float mean_val = mean_arr[i];
+             int j, k;
+             __m256i all_1 = _mm256_set1_epi8(255);
 
-#if defined(_OPENMP)
-    static int max_num_threads = 0;
-    if (max_num_threads == 0) {
-        max_num_threads = omp_get_max_threads();
-        //omp_set_num_threads(max_num_threads / 2);
-    }
-#endif
-
-    #pragma omp parallel for
-    for (i = 0; i < M; ++i)
-    {   // l.n - filters [16 - 55 - 1024]
-        float mean_val = mean_arr[i];
-        int j, k;
-        __m256i all_1 = _mm256_set1_epi8(255);
-
-        for (j = 0; j < N; ++j) { // out_h*out_w - one channel output size [169 - 173056]
-            int count = 0;
-            const int bit_step = 256;
-            __m256i count_sum = _mm256_set1_epi8(0);
+             for (j = 0; j < N; ++j) { // out_h*out_w - one channel output size [169 - 173056]
+                 int count = 0;
+                 const int bit_step = 256;
+                 __m256i count_sum = _mm256_set1_epi8(0);
 
-            for (k = 0; k < K; k += bit_step) {   // l.size*l.size*l.c - one filter size [27 - 9216]
-                __m256i a_bit256 = _mm256_loadu_si256((__m256i *)(A + (i*lda + k) / 8));
-                __m256i b_bit256 = _mm256_loadu_si256((__m256i *)(B + (j*ldb + k) / 8));
-                __m256i xor256 = _mm256_xor_si256(a_bit256, b_bit256);  // xnor = not(xor(a,b))
-                __m256i c_bit256 = _mm256_andnot_si256(xor256, all_1);  // can be optimized - we can do other NOT for wegihts once and do not do this NOT
+                 for (k = 0; k < K; k += bit_step) {   // l.size*l.size*l.c - one filter size [27 - 9216]
+                     __m256i a_bit256 = _mm256_loadu_si256((__m256i *)(A + (i*lda + k) / 8));
+                     __m256i b_bit256 = _mm256_loadu_si256((__m256i *)(B + (j*ldb + k) / 8));
+                     __m256i xor256 = _mm256_xor_si256(a_bit256, b_bit256);  // xnor = not(xor(a,b))
+                     __m256i c_bit256 = _mm256_andnot_si256(xor256, all_1);  // can be optimized - we can do other NOT for wegihts once and do not do this NOT
 
-                count_sum = _mm256_add_epi64(count256(c_bit256), count_sum);    //  Mulas algorithm
+                     count_sum = _mm256_add_epi64(count256(c_bit256), count_sum);    //  Mulas algorithm
 
-                //count += popcnt256(c_bit256);
+                     //count += popcnt256(c_bit256);
 
-                //binary_int64_printf(c_bit64);
-                //printf(", count = %d \n\n", tmp_count);
-            }
+                     //binary_int64_printf(c_bit64);
+                     //printf(", count = %d \n\n", tmp_count);
+                 }
 
-            // count of 1 bits
-            //count = count_sum.m256i_i64[0] +
-            //    count_sum.m256i_i64[1] +
-            //    count_sum.m256i_i64[2] +
-             //   count_sum.m256i_i64[3];
-            count = _mm256_extract_epi64(count_sum, 0)
-                + _mm256_extract_epi64(count_sum, 1)
-                + _mm256_extract_epi64(count_sum, 2)
-                + _mm256_extract_epi64(count_sum, 3);
+                 // count of 1 bits
+                 //count = count_sum.m256i_i64[0] +
+                 //    count_sum.m256i_i64[1] +
+                 //    count_sum.m256i_i64[2] +
+                  //   count_sum.m256i_i64[3];
+                 count = _mm256_extract_epi64(count_sum, 0)
+                     + _mm256_extract_epi64(count_sum, 1)
+                     + _mm256_extract_epi64(count_sum, 2)
+                     + _mm256_extract_epi64(count_sum, 3);
 
-            int f1 = (K % bit_step == 0) ? 0 : (bit_step - (K % bit_step));
-            count = count - f1;    // remove extra bits (from empty space for align only)
+                 int f1 = (K % bit_step == 0) ? 0 : (bit_step - (K % bit_step));
+                 count = count - f1;    // remove extra bits (from empty space for align only)
 
-            C[i*ldc + j] = (2 * count - K) * mean_val;
-        }
+                 C[i*ldc + j] = (2 * count - K) * mean_val;
+             }
     }
 }
 
+// 5x times faster than gemm()-float32
+// further optimizations: do mean-mult only for the last layer
+void gemm_nn_custom_bin_mean_transposed(int M, int N, int K, float ALPHA_UNUSED,
+    unsigned char *A, int lda,
+    unsigned char *B, int ldb,
+    float *C, int ldc, float *mean_arr)
+{
+    gemm_bin_args args = { A, B, C, N, K, lda, ldb, ldc, mean_arr };
+    parallel_for(M, 1, gemm_nn_custom_bin_mean_rows, &args);
+}
+
 
 static inline float im2col_get_pixel(float *im, int height, int width, int channels,
     int row, int col, int channel, int pad)
@@ -1029,7 +1095,6 @@ void im2col_cpu_custom_transpose(float* data_im,
     // optimized version
     if (height_col == height && width_col == width && stride == 1 && pad == 1)
     {
-        #pragma omp parallel for
         for (c = 0; c < channels_col; ++c) {
             int h, w;
             int w_offset = c % ksize;
@@ -1111,7 +1176,6 @@ void im2col_cpu_custom_transpose(float* data_im,
 
     }
     else {
-        #pragma omp parallel for
         for (c = 0; c < channels_col; ++c) {
             int h, w;
             int w_offset = c % ksize;
@@ -1132,91 +1196,107 @@ void im2col_cpu_custom_transpose(float* data_im,
 }
 
 
-//From Berkeley Vision's Caffe!
-//https://github.com/BVLC/caffe/blob/master/LICENSE
-void im2col_cpu_custom(float* data_im,
-    int channels, int height, int width,
-    int ksize, int stride, int pad, float* data_col)
+typedef struct im2col_args {
+    float *data_im;
+    int channels, height, width, ksize, stride, pad;
+    float *data_col;
+    int bit_align;
+} im2col_args;
+
+static void im2col_cpu_custom_channels(void *arg, int begin, int end)
 {
+    const im2col_args *a = (const im2col_args *)arg;
+    float *data_im = a->data_im, *data_col = a->data_col;
+    const int channels = a->channels, height = a->height, width = a->width, ksize = a->ksize, pad = a->pad;
+    const int height_col = (height + 2 * pad - ksize) / a->stride + 1;
+    const int width_col = (width + 2 * pad - ksize) / a->stride + 1;
     int c;
-    const int height_col = (height + 2 * pad - ksize) / stride + 1;
-    const int width_col = (width + 2 * pad - ksize) / stride + 1;
-    const int channels_col = channels * ksize * ksize;
-
-    // optimized version
-    if (height_col == height && width_col == width && stride == 1 && pad == 1 && is_fma_avx2())
-    {
-        #pragma omp parallel for
-        for (c = 0; c < channels_col; ++c) {
-            int h, w;
-            int w_offset = c % ksize;
-            int h_offset = (c / ksize) % ksize;
-            int c_im = c / ksize / ksize;
-            for (h = pad; h < height_col-pad; ++h) {
-                for (w = pad; w < width_col-pad-8; w += 8) {
-                    int im_row = h_offset + h - pad;
-                    int im_col = w_offset + w - pad;
-                    int col_index = (c * height_col + h) * width_col + w;
-
-                    //data_col[col_index] = data_im[im_col + width*(im_row + height*c_im)];
-                    __m256 src256 = _mm256_loadu_ps((float *)(&data_im[im_col + width*(im_row + height*c_im)]));
-                    _mm256_storeu_ps(&data_col[col_index], src256);
-                }
+    for (c = begin; c < end; ++c) {
+        int h, w;
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        for (h = pad; h < height_col-pad; ++h) {
+            for (w = pad; w < width_col-pad-8; w += 8) {
+                int im_row = h_offset + h - pad;
+                int im_col = w_offset + w - pad;
+                int col_index = (c * height_col + h) * width_col + w;
+
+                //data_col[col_index] = data_im[im_col + width*(im_row + height*c_im)];
+                __m256 src256 = _mm256_loadu_ps((float *)(&data_im[im_col + width*(im_row + height*c_im)]));
+                _mm256_storeu_ps(&data_col[col_index], src256);
+            }
 
-                for (; w < width_col - pad; ++w) {
-                    int im_row = h_offset + h - pad;
-                    int im_col = w_offset + w - pad;
-                    int col_index = (c * height_col + h) * width_col + w;
+            for (; w < width_col - pad; ++w) {
+                int im_row = h_offset + h - pad;
+                int im_col = w_offset + w - pad;
+                int col_index = (c * height_col + h) * width_col + w;
 
-                    data_col[col_index] = data_im[im_col + width*(im_row + height*c_im)];
-                }
+                data_col[col_index] = data_im[im_col + width*(im_row + height*c_im)];
             }
+        }
 
-            {
-                w = 0;
-                for (h = 0; h < height_col; ++h) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    int col_index = (c * height_col + h) * width_col + w;
-                    data_col[col_index] = im2col_get_pixel(data_im, height, width, channels,
-                        im_row, im_col, c_im, pad);
-                }
+        {
+            w = 0;
+            for (h = 0; h < height_col; ++h) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                int col_index = (c * height_col + h) * width_col + w;
+                data_col[col_index] = im2col_get_pixel(data_im, height, width, channels,
+                    im_row, im_col, c_im, pad);
             }
+        }
 
-            {
-                w = width_col-1;
-                for (h = 0; h < height_col; ++h) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    int col_index = (c * height_col + h) * width_col + w;
-                    data_col[col_index] = im2col_get_pixel(data_im, height, width, channels,
-                        im_row, im_col, c_im, pad);
-                }
+        {
+            w = width_col-1;
+            for (h = 0; h < height_col; ++h) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                int col_index = (c * height_col + h) * width_col + w;
+                data_col[col_index] = im2col_get_pixel(data_im, height, width, channels,
+                    im_row, im_col, c_im, pad);
             }
+        }
 
-            {
-                h = 0;
-                for (w = 0; w < width_col; ++w) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    int col_index = (c * height_col + h) * width_col + w;
-                    data_col[col_index] = im2col_get_pixel(data_im, height, width, channels,
-                            im_row, im_col, c_im, pad);
-                }
+        {
+            h = 0;
+            for (w = 0; w < width_col; ++w) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                int col_index = (c * height_col + h) * width_col + w;
+                data_col[col_index] = im2col_get_pixel(data_im, height, width, channels,
+                        im_row, im_col, c_im, pad);
             }
+        }
 
-            {
-                h = height_col-1;
-                for (w = 0; w < width_col; ++w) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    int col_index = (c * height_col + h) * width_col + w;
-                    data_col[col_index] = im2col_get_pixel(data_im, height, width, channels,
-                        im_row, im_col, c_im, pad);
-                }
+        {
+            h = height_col-1;
+            for (w = 0; w < width_col; ++w) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                int col_index = (c * height_col + h) * width_col + w;
+                data_col[col_index] = im2col_get_pixel(data_im, height, width, channels,
+                    im_row, im_col, c_im, pad);
             }
         }
+    }
+}
+
+//From Berkeley Vision's Caffe!
+//https://github.com/BVLC/caffe/blob/master/LICENSE
+void im2col_cpu_custom(float* data_im,
+    int channels, int height, int width,
+    int ksize, int stride, int pad, float* data_col)
+{
+    const int height_col = (height + 2 * pad - ksize) / stride + 1;
+    const int width_col = (width + 2 * pad - ksize) / stride + 1;
+    const int channels_col = channels * ksize * ksize;
 
+    // optimized version
+    if (height_col == height && width_col == width && stride == 1 && pad == 1 && is_fma_avx2())
+    {
+        im2col_args args = { data_im, channels, height, width, ksize, stride, pad, data_col, 0 };
+        parallel_for(channels_col, 1, im2col_cpu_custom_channels, &args);
     }
     else {
         //printf("\n Error: is no non-optimized version \n");
@@ -1240,7 +1320,6 @@ void im2col_cpu_custom_align(float* data_im,
     {
         int new_ldb = bit_align;
 
-        #pragma omp parallel for
         for (c = 0; c < channels_col; ++c) {
             int h, w;
             int w_offset = c % ksize;
@@ -1322,120 +1401,126 @@ void im2col_cpu_custom_align(float* data_im,
 }
 
 
-//From Berkeley Vision's Caffe!
-//https://github.com/BVLC/caffe/blob/master/LICENSE
-void im2col_cpu_custom_bin(float* data_im,
-    int channels, int height, int width,
-    int ksize, int stride, int pad, float* data_col, int bit_align)
+static void im2col_cpu_custom_bin_channels(void *arg, int begin, int end)
 {
+    const im2col_args *a = (const im2col_args *)arg;
+    float *data_im = a->data_im, *data_col = a->data_col;
+    const int channels = a->channels, height = a->height, width = a->width, ksize = a->ksize, pad = a->pad;
+    const int height_col = (height + 2 * pad - ksize) / a->stride + 1;
+    const int width_col = (width + 2 * pad - ksize) / a->stride + 1;
+    const int new_ldb = a->bit_align;
+    __m256 float_zero256 = _mm256_set1_ps(0.00);
     int c;
-    const int height_col = (height + 2 * pad - ksize) / stride + 1;
-    const int width_col = (width + 2 * pad - ksize) / stride + 1;
-    const int channels_col = channels * ksize * ksize;
+    for (c = begin; c < end; ++c) {
+        int h, w;
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        for (h = pad; h < height_col - pad; ++h) {
+            for (w = pad; w < width_col - pad - 8; w += 8) {
+                int im_row = h_offset + h - pad;
+                int im_col = w_offset + w - pad;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
+
+                //__m256i src256 = _mm256_loadu_si256((__m256i *)(&data_im[im_col + width*(im_row + height*c_im)]));
+                //__m256i result256 = _mm256_and_si256(src256, all256_sing1); // check sign in 8 x 32-bit floats
+                //uint16_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(result256)); // (val >= 0) ? 0 : 1
+                //mask = ~mask;   // inverse mask,  (val >= 0) ? 1 : 0
+
+                __m256 src256 = _mm256_loadu_ps((float *)(&data_im[im_col + width*(im_row + height*c_im)]));
+                __m256 result256 = _mm256_cmp_ps(src256, float_zero256, _CMP_GT_OS);
+                uint16_t mask = _mm256_movemask_ps(result256); // (val > 0) ? 0 : 1
+
+                uint16_t *dst_ptr = &((unsigned char*)data_col)[col_index / 8];
+                *dst_ptr |= (mask << (col_index % 8));
+            }
 
-    // optimized version
-    if (height_col == height && width_col == width && stride == 1 && pad == 1 && is_fma_avx2())
-    {
-        __m256i all256_sing1 = _mm256_set_epi32(0x80000000, 0x80000000, 0x80000000, 0x80000000, 0x80000000, 0x80000000, 0x80000000, 0x80000000);
-        __m256 float_zero256 = _mm256_set1_ps(0.00);
+            for (; w < width_col - pad; ++w) {
+                int im_row = h_offset + h - pad;
+                int im_col = w_offset + w - pad;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
 
-        int new_ldb = bit_align;
+                //data_col[col_index] = data_im[im_col + width*(im_row + height*c_im)];
+                float val = data_im[im_col + width*(im_row + height*c_im)];
+                if(val > 0) set_bit(data_col, col_index);
+            }
+        }
 
-        #pragma omp parallel for
-        for (c = 0; c < channels_col; ++c) {
-            int h, w;
-            int w_offset = c % ksize;
-            int h_offset = (c / ksize) % ksize;
-            int c_im = c / ksize / ksize;
-            for (h = pad; h < height_col - pad; ++h) {
-                for (w = pad; w < width_col - pad - 8; w += 8) {
-                    int im_row = h_offset + h - pad;
-                    int im_col = w_offset + w - pad;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
-
-                    //__m256i src256 = _mm256_loadu_si256((__m256i *)(&data_im[im_col + width*(im_row + height*c_im)]));
-                    //__m256i result256 = _mm256_and_si256(src256, all256_sing1); // check sign in 8 x 32-bit floats
-                    //uint16_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(result256)); // (val >= 0) ? 0 : 1
-                    //mask = ~mask;   // inverse mask,  (val >= 0) ? 1 : 0
-
-                    __m256 src256 = _mm256_loadu_ps((float *)(&data_im[im_col + width*(im_row + height*c_im)]));
-                    __m256 result256 = _mm256_cmp_ps(src256, float_zero256, _CMP_GT_OS);
-                    uint16_t mask = _mm256_movemask_ps(result256); // (val > 0) ? 0 : 1
-
-                    uint16_t *dst_ptr = &((unsigned char*)data_col)[col_index / 8];
-                    *dst_ptr |= (mask << (col_index % 8));
-                }
-
-                for (; w < width_col - pad; ++w) {
-                    int im_row = h_offset + h - pad;
-                    int im_col = w_offset + w - pad;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
-
-                    //data_col[col_index] = data_im[im_col + width*(im_row + height*c_im)];
-                    float val = data_im[im_col + width*(im_row + height*c_im)];
-                    if(val > 0) set_bit(data_col, col_index);
-                }
-            }
-
-            {
-                w = 0;
-                for (h = 0; h < height_col; ++h) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
-
-                    //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    if (val > 0) set_bit(data_col, col_index);
-                }
+        {
+            w = 0;
+            for (h = 0; h < height_col; ++h) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
+
+                //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                if (val > 0) set_bit(data_col, col_index);
             }
+        }
 
-            {
-                w = width_col - 1;
-                for (h = 0; h < height_col; ++h) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
-
-                    //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    if (val > 0) set_bit(data_col, col_index);
-                }
+        {
+            w = width_col - 1;
+            for (h = 0; h < height_col; ++h) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
+
+                //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                if (val > 0) set_bit(data_col, col_index);
             }
+        }
 
-            {
-                h = 0;
-                for (w = 0; w < width_col; ++w) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
-
-                    //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    if (val > 0) set_bit(data_col, col_index);
-                }
+        {
+            h = 0;
+            for (w = 0; w < width_col; ++w) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
+
+                //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                if (val > 0) set_bit(data_col, col_index);
             }
+        }
 
-            {
-                h = height_col - 1;
-                for (w = 0; w < width_col; ++w) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
-
-                    //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    if (val > 0) set_bit(data_col, col_index);
-                }
+        {
+            h = height_col - 1;
+            for (w = 0; w < width_col; ++w) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
+
+                //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                if (val > 0) set_bit(data_col, col_index);
             }
         }
+    }
+}
+
+//From Berkeley Vision's Caffe!
+//https://github.com/BVLC/caffe/blob/master/LICENSE
+void im2col_cpu_custom_bin(float* data_im,
+    int channels, int height, int width,
+    int ksize, int stride, int pad, float* data_col, int bit_align)
+{
+    const int height_col = (height + 2 * pad - ksize) / stride + 1;
+    const int width_col = (width + 2 * pad - ksize) / stride + 1;
+    const int channels_col = channels * ksize * ksize;
 
+    // optimized version
+    if (height_col == height && width_col == width && stride == 1 && pad == 1 && is_fma_avx2())
+    {
+        im2col_args args = { data_im, channels, height, width, ksize, stride, pad, data_col, bit_align };
+        parallel_for(channels_col, 1, im2col_cpu_custom_bin_channels, &args);
     }
     else {
         printf("\n Error: is no non-optimized version \n");
@@ -1522,7 +1607,6 @@ void transpose_block_SSE4x4(float *A, float *B, const int n, const int m,
     const int lda, const int ldb, const int block_size)
 {
     int i;
-    #pragma omp parallel for
     for (i = 0; i < n; i += block_size) {
         int j, i2, j2;
         //int max_i2 = (i + block_size < n) ? (i + block_size) : n;
@@ -1558,100 +1642,114 @@ void transpose_block_SSE4x4(float *A, float *B, const int n, const int m,
 }
 
 
-void forward_maxpool_layer_avx(float *src, float *dst, int *indexes, int size, int w, int h, int out_w, int out_h, int c,
-    int pad, int stride, int batch)
-{
+typedef struct maxpool_args {
+    float *src, *dst;
+    int *indexes;
+    int size, w, h, out_w, out_h, c, pad, stride, b;
+} maxpool_args;
 
-    const int w_offset = -pad / 2;
-    const int h_offset = -pad / 2;
-    int b, k;
-
-    for (b = 0; b < batch; ++b) {
-        #pragma omp parallel for
-        for (k = 0; k < c; ++k) {
-            int i, j, m, n;
-            for (i = 0; i < out_h; ++i) {
-                //for (j = 0; j < out_w; ++j) {
-                j = 0;
-
-                if(stride == 1 && is_avx() == 1) {
-                    for (j = 0; j < out_w - 8 - (size - 1); j += 8) {
-                        int out_index = j + out_w*(i + out_h*(k + c*b));
-                        __m256 max256 = _mm256_set1_ps(-FLT_MAX);
-                        for (n = 0; n < size; ++n) {
-                            for (m = 0; m < size; ++m) {
-                                int cur_h = h_offset + i*stride + n;
-                                int cur_w = w_offset + j*stride + m;
-                                int index = cur_w + w*(cur_h + h*(k + b*c));
-                                int valid = (cur_h >= 0 && cur_h < h &&
-                                    cur_w >= 0 && cur_w < w);
-                                if (!valid) continue;
-
-                                __m256 src256 = _mm256_loadu_ps(&src[index]);
-                                max256 = _mm256_max_ps(src256, max256);
-                            }
-                        }
-                        _mm256_storeu_ps(&dst[out_index], max256);
+static void forward_maxpool_layer_channels(void *arg, int begin, int end)
+{
+    const maxpool_args *a = (const maxpool_args *)arg;
+    float *src = a->src, *dst = a->dst;
+    int *indexes = a->indexes;
+    const int size = a->size, w = a->w, h = a->h, out_w = a->out_w, out_h = a->out_h, c = a->c, stride = a->stride, b = a->b;
+    const int w_offset = -a->pad / 2;
+    const int h_offset = -a->pad / 2;
+    int k;
+    for (k = begin; k < end; ++k) {
+        int i, j, m, n;
+        for (i = 0; i < out_h; ++i) {
+            //for (j = 0; j < out_w; ++j) {
+            j = 0;
+
+            if(stride == 1 && is_avx() == 1) {
+                for (j = 0; j < out_w - 8 - (size - 1); j += 8) {
+                    int out_index = j + out_w*(i + out_h*(k + c*b));
+                    __m256 max256 = _mm256_set1_ps(-FLT_MAX);
+                    for (n = 0; n < size; ++n) {
+                        for (m = 0; m < size; ++m) {
+                            int cur_h = h_offset + i*stride + n;
+                            int cur_w = w_offset + j*stride + m;
+                            int index = cur_w + w*(cur_h + h*(k + b*c));
+                            int valid = (cur_h >= 0 && cur_h < h &&
+                                cur_w >= 0 && cur_w < w);
+                            if (!valid) continue;
 
-                    }
-                }
-                else if (size == 2 && stride == 2 && is_avx() == 1) {
-                    for (j = 0; j < out_w - 4; j += 4) {
-                        int out_index = j + out_w*(i + out_h*(k + c*b));
-                        float max = -FLT_MAX;
-                        int max_i = -1;
-                        __m128 max128 = _mm_set1_ps(-FLT_MAX);
-
-                        for (n = 0; n < size; ++n) {
-                            //for (m = 0; m < size; ++m)
-                            m = 0;
-                            {
-                                int cur_h = h_offset + i*stride + n;
-                                int cur_w = w_offset + j*stride + m;
-                                int index = cur_w + w*(cur_h + h*(k + b*c));
-                                int valid = (cur_h >= 0 && cur_h < h &&
-                                    cur_w >= 0 && cur_w < w);
-                                if (!valid) continue;
-
-                                __m256 src256 = _mm256_loadu_ps(&src[index]);
-                                __m256 src256_2 = _mm256_permute_ps(src256, (1 << 0) | (3 << 4));
-                                __m256 max256 = _mm256_max_ps(src256, src256_2);
-
-                                __m128 src128_0 = _mm256_extractf128_ps(max256, 0);
-                                __m128 src128_1 = _mm256_extractf128_ps(max256, 1);
-                                __m128 src128 = _mm_shuffle_ps(src128_0, src128_1, (2 << 2) | (2 << 6));
-
-                                max128 = _mm_max_ps(src128, max128);
-                            }
+                            __m256 src256 = _mm256_loadu_ps(&src[index]);
+                            max256 = _mm256_max_ps(src256, max256);
                         }
-                        _mm_storeu_ps(&dst[out_index], max128);
                     }
-                }
+                    _mm256_storeu_ps(&dst[out_index], max256);
 
-                for (; j < out_w; ++j) {
+                }
+            }
+            else if (size == 2 && stride == 2 && is_avx() == 1) {
+                for (j = 0; j < out_w - 4; j += 4) {
                     int out_index = j + out_w*(i + out_h*(k + c*b));
                     float max = -FLT_MAX;
                     int max_i = -1;
+                    __m128 max128 = _mm_set1_ps(-FLT_MAX);
+
                     for (n = 0; n < size; ++n) {
-                        for (m = 0; m < size; ++m) {
+                        //for (m = 0; m < size; ++m)
+                        m = 0;
+                        {
                             int cur_h = h_offset + i*stride + n;
                             int cur_w = w_offset + j*stride + m;
                             int index = cur_w + w*(cur_h + h*(k + b*c));
                             int valid = (cur_h >= 0 && cur_h < h &&
                                 cur_w >= 0 && cur_w < w);
-                            float val = (valid != 0) ? src[index] : -FLT_MAX;
-                            max_i = (val > max) ? index : max_i;
-                            max = (val > max) ? val : max;
+                            if (!valid) continue;
+
+                            __m256 src256 = _mm256_loadu_ps(&src[index]);
+                            __m256 src256_2 = _mm256_permute_ps(src256, (1 << 0) | (3 << 4));
+                            __m256 max256 = _mm256_max_ps(src256, src256_2);
+
+                            __m128 src128_0 = _mm256_extractf128_ps(max256, 0);
+                            __m128 src128_1 = _mm256_extractf128_ps(max256, 1);
+                            __m128 src128 = _mm_shuffle_ps(src128_0, src128_1, (2 << 2) | (2 << 6));
+
+                            max128 = _mm_max_ps(src128, max128);
                         }
                     }
-                    dst[out_index] = max;
-                    indexes[out_index] = max_i;
+                    _mm_storeu_ps(&dst[out_index], max128);
+                }
+            }
+
+            for (; j < out_w; ++j) {
+                int out_index = j + out_w*(i + out_h*(k + c*b));
+                float max = -FLT_MAX;
+                int max_i = -1;
+                for (n = 0; n < size; ++n) {
+                    for (m = 0; m < size; ++m) {
+                        int cur_h = h_offset + i*stride + n;
+                        int cur_w = w_offset + j*stride + m;
+                        int index = cur_w + w*(cur_h + h*(k + b*c));
+                        int valid = (cur_h >= 0 && cur_h < h &&
+                            cur_w >= 0 && cur_w < w);
+                        float val = (valid != 0) ? src[index] : -FLT_MAX;
+                        max_i = (val > max) ? index : max_i;
+                        max = (val > max) ? val : max;
+                    }
                 }
+                dst[out_index] = max;
+                if (indexes) indexes[out_index] = max_i;
             }
         }
     }
 }
 
+void forward_maxpool_layer_avx(float *src, float *dst, int *indexes, int size, int w, int h, int out_w, int out_h, int c,
+    int pad, int stride, int batch)
+{
+    int b;
+    for (b = 0; b < batch; ++b) {
+        maxpool_args args = { src, dst, indexes, size, w, h, out_w, out_h, c, pad, stride, b };
+        parallel_for(c, 1, forward_maxpool_layer_channels, &args);
+    }
+}
+
 #else
 
 void gemm_nn(int M, int N, int K, float ALPHA,
@@ -1680,7 +1778,6 @@ void convolution_2d(int w, int h, int ksize, int n, int c, int pad, int stride,
 
     int fil;
     // filter index
-    #pragma omp parallel for      // "omp parallel for" - automatic parallelization of loop by using OpenMP
     for (fil = 0; fil < n; ++fil) {
         int chan, y, x, f_y, f_x;
         // channel index
@@ -1738,39 +1835,55 @@ static inline int popcnt_64(uint64_t val64) {
     return tmp_count;
 }
 
-void gemm_nn_custom_bin_mean_transposed(int M, int N, int K, float ALPHA_UNUSED,
-    unsigned char *A, int lda,
-    unsigned char *B, int ldb,
-    float *C, int ldc, float *mean_arr)
+typedef struct gemm_bin_args {
+    unsigned char *A, *B;
+    float *C;
+    int N, K, lda, ldb, ldc;
+    float *mean_arr;
+} gemm_bin_args;
+
+static void gemm_nn_custom_bin_mean_rows(void *arg, int begin, int end)
 {
+    const gemm_bin_args *a = (const gemm_bin_args *)arg;
+    unsigned char *A = a->A, *B = a->B;
+    float *C = a->C, *mean_arr = a->mean_arr;
+    const int N = a->N, K = a->K, lda = a->lda, ldb = a->ldb, ldc = a->ldc;
     int i;
+    for (i = begin; i < end; ++i) {
+        // l.n - filters [16 - 55 - 1024]
+             int j, k;
+             float mean_val = mean_arr[i];
 
-    #pragma omp parallel for
-    for (i = 0; i < M; ++i) {   // l.n - filters [16 - 55 - 1024]
-        int j, k;
-        float mean_val = mean_arr[i];
-
-        for (j = 0; j < N; ++j) { // out_h*out_w - one channel output size [169 - 173056]
-            int count = 0;
+             for (j = 0; j < N; ++j) { // out_h*out_w - one channel output size [169 - 173056]
+                 int count = 0;
 
-            for (k = 0; k < K; k += 64) {   // l.size*l.size*l.c - one filter size [27 - 9216]
-                uint64_t a_bit64 = *((uint64_t *)(A + (i*lda + k) / 8));
-                uint64_t b_bit64 = *((uint64_t *)(B + (j*ldb + k) / 8));
-                uint64_t c_bit64 = xnor_int64(a_bit64, b_bit64);
+                 for (k = 0; k < K; k += 64) {   // l.size*l.size*l.c - one filter size [27 - 9216]
+                     uint64_t a_bit64 = *((uint64_t *)(A + (i*lda + k) / 8));
+                     uint64_t b_bit64 = *((uint64_t *)(B + (j*ldb + k) / 8));
+                     uint64_t c_bit64 = xnor_int64(a_bit64, b_bit64);
 
-                int tmp_count = popcnt_64(c_bit64);
+                     int tmp_count = popcnt_64(c_bit64);
 
-                if (K - k < 64)  tmp_count = tmp_count - (64 - (K - k));    // remove extra bits
-                count += tmp_count;
-                //binary_int64_printf(c_bit64);
-                //printf(", count = %d \n\n", tmp_count);
-            }
+                     if (K - k < 64)  tmp_count = tmp_count - (64 - (K - k));    // remove extra bits
+                     count += tmp_count;
+                     //binary_int64_printf(c_bit64);
+                     //printf(", count = %d \n\n", tmp_count);
+                 }
 
-            C[i*ldc + j] = (2 * count - K) * mean_val;
-        }
+                 C[i*ldc + j] = (2 * count - K) * mean_val;
+             }
     }
 }
 
+void gemm_nn_custom_bin_mean_transposed(int M, int N, int K, float ALPHA_UNUSED,
+    unsigned char *A, int lda,
+    unsigned char *B, int ldb,
+    float *C, int ldc, float *mean_arr)
+{
+    gemm_bin_args args = { A, B, C, N, K, lda, ldb, ldc, mean_arr };
+    parallel_for(M, 1, gemm_nn_custom_bin_mean_rows, &args);
+}
+
 void im2col_cpu_custom_transpose(float* data_im,
     int channels, int height, int width,
     int ksize, int stride, int pad, float* data_col, int ldb_align)
@@ -1795,7 +1908,6 @@ void im2col_cpu_custom(float* data_im,
     // optimized version
     if (height_col == height && width_col == width && stride == 1 && pad == 1)
     {
-        #pragma omp parallel for
         for (c = 0; c < channels_col; ++c) {
             int h, w;
             int w_offset = c % ksize;
@@ -1872,108 +1984,123 @@ void im2col_cpu_custom(float* data_im,
 }
 
 
-//From Berkeley Vision's Caffe!
-//https://github.com/BVLC/caffe/blob/master/LICENSE
-void im2col_cpu_custom_bin(float* data_im,
-    int channels, int height, int width,
-    int ksize, int stride, int pad, float* data_col, int bit_align)
+typedef struct im2col_args {
+    float *data_im;
+    int channels, height, width, ksize, stride, pad;
+    float *data_col;
+    int bit_align;
+} im2col_args;
+
+static void im2col_cpu_custom_bin_channels(void *arg, int begin, int end)
 {
+    const im2col_args *a = (const im2col_args *)arg;
+    float *data_im = a->data_im, *data_col = a->data_col;
+    const int channels = a->channels, height = a->height, width = a->width, ksize = a->ksize, pad = a->pad;
+    const int height_col = (height + 2 * pad - ksize) / a->stride + 1;
+    const int width_col = (width + 2 * pad - ksize) / a->stride + 1;
+    const int new_ldb = a->bit_align;
     int c;
-    const int height_col = (height + 2 * pad - ksize) / stride + 1;
-    const int width_col = (width + 2 * pad - ksize) / stride + 1;
-    const int channels_col = channels * ksize * ksize;
-
-    // optimized version
-    if (height_col == height && width_col == width && stride == 1 && pad == 1)
-    {
-        int new_ldb = bit_align;
-
-        #pragma omp parallel for
-        for (c = 0; c < channels_col; ++c) {
-            int h, w;
-            int w_offset = c % ksize;
-            int h_offset = (c / ksize) % ksize;
-            int c_im = c / ksize / ksize;
-            for (h = pad; h < height_col - pad; ++h) {
-                for (w = pad; w < width_col - pad - 8; w += 1) {
-                    int im_row = h_offset + h - pad;
-                    int im_col = w_offset + w - pad;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
-
-                    float val = data_im[im_col + width*(im_row + height*c_im)];
-                    if (val > 0) set_bit(data_col, col_index);
-                }
-
-                for (; w < width_col - pad; ++w) {
-                    int im_row = h_offset + h - pad;
-                    int im_col = w_offset + w - pad;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
-
-                    //data_col[col_index] = data_im[im_col + width*(im_row + height*c_im)];
-                    float val = data_im[im_col + width*(im_row + height*c_im)];
-                    if (val > 0) set_bit(data_col, col_index);
-                }
+    for (c = begin; c < end; ++c) {
+        int h, w;
+        int w_offset = c % ksize;
+        int h_offset = (c / ksize) % ksize;
+        int c_im = c / ksize / ksize;
+        for (h = pad; h < height_col - pad; ++h) {
+            for (w = pad; w < width_col - pad - 8; w += 1) {
+                int im_row = h_offset + h - pad;
+                int im_col = w_offset + w - pad;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
+
+                float val = data_im[im_col + width*(im_row + height*c_im)];
+                if (val > 0) set_bit(data_col, col_index);
             }
 
-            {
-                w = 0;
-                for (h = 0; h < height_col; ++h) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
+            for (; w < width_col - pad; ++w) {
+                int im_row = h_offset + h - pad;
+                int im_col = w_offset + w - pad;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
 
-                    //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    if (val > 0) set_bit(data_col, col_index);
-                }
+                //data_col[col_index] = data_im[im_col + width*(im_row + height*c_im)];
+                float val = data_im[im_col + width*(im_row + height*c_im)];
+                if (val > 0) set_bit(data_col, col_index);
             }
+        }
 
-            {
-                w = width_col - 1;
-                for (h = 0; h < height_col; ++h) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
-
-                    //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    if (val > 0) set_bit(data_col, col_index);
-                }
+        {
+            w = 0;
+            for (h = 0; h < height_col; ++h) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
+
+                //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                if (val > 0) set_bit(data_col, col_index);
             }
+        }
 
-            {
-                h = 0;
-                for (w = 0; w < width_col; ++w) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
-
-                    //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    if (val > 0) set_bit(data_col, col_index);
-                }
+        {
+            w = width_col - 1;
+            for (h = 0; h < height_col; ++h) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
+
+                //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                if (val > 0) set_bit(data_col, col_index);
             }
+        }
 
-            {
-                h = height_col - 1;
-                for (w = 0; w < width_col; ++w) {
-                    int im_row = h_offset + h;
-                    int im_col = w_offset + w;
-                    //int col_index = (c * height_col + h) * width_col + w;
-                    int col_index = c * new_ldb + h * width_col + w;
+        {
+            h = 0;
+            for (w = 0; w < width_col; ++w) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
+
+                //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                if (val > 0) set_bit(data_col, col_index);
+            }
+        }
 
-                    //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
-                    if (val > 0) set_bit(data_col, col_index);
-                }
+        {
+            h = height_col - 1;
+            for (w = 0; w < width_col; ++w) {
+                int im_row = h_offset + h;
+                int im_col = w_offset + w;
+                //int col_index = (c * height_col + h) * width_col + w;
+                int col_index = c * new_ldb + h * width_col + w;
+
+                //data_col[col_index] = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                float val = im2col_get_pixel(data_im, height, width, channels, im_row, im_col, c_im, pad);
+                if (val > 0) set_bit(data_col, col_index);
             }
         }
+    }
+}
+
+//From Berkeley Vision's Caffe!
+//https://github.com/BVLC/caffe/blob/master/LICENSE
+void im2col_cpu_custom_bin(float* data_im,
+    int channels, int height, int width,
+    int ksize, int stride, int pad, float* data_col, int bit_align)
+{
+    const int height_col = (height + 2 * pad - ksize) / stride + 1;
+    const int width_col = (width + 2 * pad - ksize) / stride + 1;
+    const int channels_col = channels * ksize * ksize;
 
+    // optimized version
+    if (height_col == height && width_col == width && stride == 1 && pad == 1)
+    {
+        im2col_args args = { data_im, channels, height, width, ksize, stride, pad, data_col, bit_align };
+        parallel_for(channels_col, 1, im2col_cpu_custom_bin_channels, &args);
     }
     else {
         printf("\n Error: is no non-optimized version \n");
@@ -2049,7 +2176,6 @@ void transpose_block_SSE4x4(float *A, float *B, const int n, const int m,
     const int lda, const int ldb, const int block_size)
 {
     int i;
-    #pragma omp parallel for
     for (i = 0; i < n; i += block_size) {
         int j, i2, j2;
         for (j = 0; j < m; j += block_size) {
@@ -2064,43 +2190,682 @@ void transpose_block_SSE4x4(float *A, float *B, const int n, const int m,
         }
 }
 
+typedef struct maxpool_args {
+    float *src, *dst;
+    int *indexes;
+    int size, w, h, out_w, out_h, c, pad, stride, b;
+} maxpool_args;
+
+static void forward_maxpool_layer_channels(void *arg, int begin, int end)
+{
+    const maxpool_args *a = (const maxpool_args *)arg;
+    float *src = a->src, *dst = a->dst;
+    int *indexes = a->indexes;
+    const int size = a->size, w = a->w, h = a->h, out_w = a->out_w, out_h = a->out_h, c = a->c, stride = a->stride, b = a->b;
+    const int w_offset = -a->pad / 2;
+    const int h_offset = -a->pad / 2;
+    int k;
+    for (k = begin; k < end; ++k) {
+        int i, j, m, n;
+        for (i = 0; i < out_h; ++i) {
+            for (j = 0; j < out_w; ++j) {
+                int out_index = j + out_w*(i + out_h*(k + c*b));
+                float max = -FLT_MAX;
+                int max_i = -1;
+                for (n = 0; n < size; ++n) {
+                    for (m = 0; m < size; ++m) {
+                        int cur_h = h_offset + i*stride + n;
+                        int cur_w = w_offset + j*stride + m;
+                        int index = cur_w + w*(cur_h + h*(k + b*c));
+                        int valid = (cur_h >= 0 && cur_h < h &&
+                            cur_w >= 0 && cur_w < w);
+                        float val = (valid != 0) ? src[index] : -FLT_MAX;
+                        max_i = (val > max) ? index : max_i;
+                        max = (val > max) ? val : max;
+                    }
+                }
+                dst[out_index] = max;
+                if (indexes) indexes[out_index] = max_i;
+            }
+        }
+    }
+}
+
 void forward_maxpool_layer_avx(float *src, float *dst, int *indexes, int size, int w, int h, int out_w, int out_h, int c,
     int pad, int stride, int batch)
 {
-    int b, k;
-    const int w_offset = -pad / 2;
-    const int h_offset = -pad / 2;
-
+    int b;
     for (b = 0; b < batch; ++b) {
-        #pragma omp parallel for
-        for (k = 0; k < c; ++k) {
-            int i, j, m, n;
-            for (i = 0; i < out_h; ++i) {
-                for (j = 0; j < out_w; ++j) {
-                    int out_index = j + out_w*(i + out_h*(k + c*b));
-                    float max = -FLT_MAX;
-                    int max_i = -1;
-                    for (n = 0; n < size; ++n) {
-                        for (m = 0; m < size; ++m) {
-                            int cur_h = h_offset + i*stride + n;
-                            int cur_w = w_offset + j*stride + m;
-                            int index = cur_w + w*(cur_h + h*(k + b*c));
-                            int valid = (cur_h >= 0 && cur_h < h &&
-                                cur_w >= 0 && cur_w < w);
-                            float val = (valid != 0) ? src[index] : -FLT_MAX;
-                            max_i = (val > max) ? index : max_i;
-                            max = (val > max) ? val : max;
-                        }
+        maxpool_args args = { src, dst, indexes, size, w, h, out_w, out_h, c, pad, stride, b };
+        parallel_for(c, 1, forward_maxpool_layer_channels, &args);
+    }
+}
+
+#endif    // AVX
+
+#if defined(__x86_64__) || defined(_WIN64)
+
+// Cache-blocked SGEMM for the NN case, laid out the GotoBLAS/BLIS way:
+// A is packed into MR-row micro-panels once per KC slice (ALPHA folded in),
+// B into NR-column micro-panels once per KC x NC block, and a register-tiled
+// micro-kernel accumulates one MR x NR tile of C entirely in registers.
+// MC x KC of packed A stays in L2 and one KC x NR panel of B stays in L1.
+#define SGEMM_PACKED
+#define SGEMM_MR 6
+#define SGEMM_MC 144
+#define SGEMM_KC 256
+#define SGEMM_NC 4096
+#define SGEMM_MAX_NR 32
+
+#if defined(__GNUC__)
+#define SGEMM_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define SGEMM_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define SGEMM_TARGET_AVX2
+#define SGEMM_TARGET_AVX512
+#endif
+
+#if (defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))) || (defined(_MSC_VER) && _MSC_VER >= 1911)
+#define SGEMM_AVX512
+#endif
+
+// what a micro-kernel does with its MR x NR tile: C = A*B unless SGEMM_ACCUMULATE,
+// then + bias[row] with SGEMM_BIAS and leaky ReLU with SGEMM_LEAKY, all in registers
+#define SGEMM_ACCUMULATE 1
+#define SGEMM_BIAS 2
+#define SGEMM_LEAKY 4
+
+typedef void (*sgemm_kernel_t)(int kc, const float *a, const float *b, float *c, int ldc, int flags, const float *bias);
+
+SGEMM_TARGET_AVX2
+static inline void sgemm_store_avx2(float *c, __m256 acc, int flags, const float *bias)
+{
+    if (flags & SGEMM_ACCUMULATE) acc = _mm256_add_ps(_mm256_loadu_ps(c), acc);
+    if (flags & SGEMM_BIAS) acc = _mm256_add_ps(acc, _mm256_set1_ps(*bias));
+    // the sign bit of acc selects acc * .1
+    if (flags & SGEMM_LEAKY) acc = _mm256_blendv_ps(acc, _mm256_mul_ps(acc, _mm256_set1_ps(.1f)), acc);
+    _mm256_storeu_ps(c, acc);
+}
+
+// C[6 x 16] (+)= A[6 x kc] * B[kc x 16]: 12 ymm accumulators, 2 for B, 1 for A
+SGEMM_TARGET_AVX2
+static void sgemm_kernel_6x16_avx2(int kc, const float *a, const float *b, float *c, int ldc, int flags, const float *bias)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    int p;
+    for (p = 0; p < kc; ++p) {
+        const __m256 b0 = _mm256_load_ps(b);
+        const __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 a0;
+        a0 = _mm256_broadcast_ss(a + 0);
+        c00 = _mm256_fmadd_ps(a0, b0, c00);
+        c01 = _mm256_fmadd_ps(a0, b1, c01);
+        a0 = _mm256_broadcast_ss(a + 1);
+        c10 = _mm256_fmadd_ps(a0, b0, c10);
+        c11 = _mm256_fmadd_ps(a0, b1, c11);
+        a0 = _mm256_broadcast_ss(a + 2);
+        c20 = _mm256_fmadd_ps(a0, b0, c20);
+        c21 = _mm256_fmadd_ps(a0, b1, c21);
+        a0 = _mm256_broadcast_ss(a + 3);
+        c30 = _mm256_fmadd_ps(a0, b0, c30);
+        c31 = _mm256_fmadd_ps(a0, b1, c31);
+        a0 = _mm256_broadcast_ss(a + 4);
+        c40 = _mm256_fmadd_ps(a0, b0, c40);
+        c41 = _mm256_fmadd_ps(a0, b1, c41);
+        a0 = _mm256_broadcast_ss(a + 5);
+        c50 = _mm256_fmadd_ps(a0, b0, c50);
+        c51 = _mm256_fmadd_ps(a0, b1, c51);
+        a += SGEMM_MR;
+        b += 16;
+    }
+    sgemm_store_avx2(c + 0 * ldc, c00, flags, bias + 0);
+    sgemm_store_avx2(c + 0 * ldc + 8, c01, flags, bias + 0);
+    sgemm_store_avx2(c + 1 * ldc, c10, flags, bias + 1);
+    sgemm_store_avx2(c + 1 * ldc + 8, c11, flags, bias + 1);
+    sgemm_store_avx2(c + 2 * ldc, c20, flags, bias + 2);
+    sgemm_store_avx2(c + 2 * ldc + 8, c21, flags, bias + 2);
+    sgemm_store_avx2(c + 3 * ldc, c30, flags, bias + 3);
+    sgemm_store_avx2(c + 3 * ldc + 8, c31, flags, bias + 3);
+    sgemm_store_avx2(c + 4 * ldc, c40, flags, bias + 4);
+    sgemm_store_avx2(c + 4 * ldc + 8, c41, flags, bias + 4);
+    sgemm_store_avx2(c + 5 * ldc, c50, flags, bias + 5);
+    sgemm_store_avx2(c + 5 * ldc + 8, c51, flags, bias + 5);
+}
+
+#ifdef SGEMM_AVX512
+SGEMM_TARGET_AVX512
+static inline void sgemm_store_avx512(float *c, __m512 acc, int flags, const float *bias)
+{
+    if (flags & SGEMM_ACCUMULATE) acc = _mm512_add_ps(_mm512_loadu_ps(c), acc);
+    if (flags & SGEMM_BIAS) acc = _mm512_add_ps(acc, _mm512_set1_ps(*bias));
+    if (flags & SGEMM_LEAKY) {
+        const __mmask16 negative = _mm512_cmp_ps_mask(acc, _mm512_setzero_ps(), _CMP_LT_OQ);
+        acc = _mm512_mask_mul_ps(acc, negative, acc, _mm512_set1_ps(.1f));
+    }
+    _mm512_storeu_ps(c, acc);
+}
+
+// C[6 x 32] (+)= A[6 x kc] * B[kc x 32]: 12 zmm accumulators
+SGEMM_TARGET_AVX512
+static void sgemm_kernel_6x32_avx512(int kc, const float *a, const float *b, float *c, int ldc, int flags, const float *bias)
+{
+    __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps();
+    __m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+    __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps();
+    __m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+    __m512 c40 = _mm512_setzero_ps(), c41 = _mm512_setzero_ps();
+    __m512 c50 = _mm512_setzero_ps(), c51 = _mm512_setzero_ps();
+    int p;
+    for (p = 0; p < kc; ++p) {
+        const __m512 b0 = _mm512_load_ps(b);
+        const __m512 b1 = _mm512_load_ps(b + 16);
+        __m512 a0;
+        a0 = _mm512_set1_ps(a[0]);
+        c00 = _mm512_fmadd_ps(a0, b0, c00);
+        c01 = _mm512_fmadd_ps(a0, b1, c01);
+        a0 = _mm512_set1_ps(a[1]);
+        c10 = _mm512_fmadd_ps(a0, b0, c10);
+        c11 = _mm512_fmadd_ps(a0, b1, c11);
+        a0 = _mm512_set1_ps(a[2]);
+        c20 = _mm512_fmadd_ps(a0, b0, c20);
+        c21 = _mm512_fmadd_ps(a0, b1, c21);
+        a0 = _mm512_set1_ps(a[3]);
+        c30 = _mm512_fmadd_ps(a0, b0, c30);
+        c31 = _mm512_fmadd_ps(a0, b1, c31);
+        a0 = _mm512_set1_ps(a[4]);
+        c40 = _mm512_fmadd_ps(a0, b0, c40);
+        c41 = _mm512_fmadd_ps(a0, b1, c41);
+        a0 = _mm512_set1_ps(a[5]);
+        c50 = _mm512_fmadd_ps(a0, b0, c50);
+        c51 = _mm512_fmadd_ps(a0, b1, c51);
+        a += SGEMM_MR;
+        b += 32;
+    }
+    sgemm_store_avx512(c + 0 * ldc, c00, flags, bias + 0);
+    sgemm_store_avx512(c + 0 * ldc + 16, c01, flags, bias + 0);
+    sgemm_store_avx512(c + 1 * ldc, c10, flags, bias + 1);
+    sgemm_store_avx512(c + 1 * ldc + 16, c11, flags, bias + 1);
+    sgemm_store_avx512(c + 2 * ldc, c20, flags, bias + 2);
+    sgemm_store_avx512(c + 2 * ldc + 16, c21, flags, bias + 2);
+    sgemm_store_avx512(c + 3 * ldc, c30, flags, bias + 3);
+    sgemm_store_avx512(c + 3 * ldc + 16, c31, flags, bias + 3);
+    sgemm_store_avx512(c + 4 * ldc, c40, flags, bias + 4);
+    sgemm_store_avx512(c + 4 * ldc + 16, c41, flags, bias + 4);
+    sgemm_store_avx512(c + 5 * ldc, c50, flags, bias + 5);
+    sgemm_store_avx512(c + 5 * ldc + 16, c51, flags, bias + 5);
+}
+#endif    // SGEMM_AVX512
+
+static sgemm_kernel_t sgemm_kernel;
+static int sgemm_kernel_nr;
+static pthread_once_t sgemm_kernel_once = PTHREAD_ONCE_INIT;
+
+// the widest micro-kernel the CPU and the OS support, none if neither
+static void sgemm_init_kernel(void)
+{
+    if (is_fma_avx2()) {
+        sgemm_kernel = sgemm_kernel_6x16_avx2;
+        sgemm_kernel_nr = 16;
+    }
+#ifdef SGEMM_AVX512
+    if (HW_AVX512F) {
+        sgemm_kernel = sgemm_kernel_6x32_avx512;
+        sgemm_kernel_nr = 32;
+    }
+#endif
+}
+
+// picked once, the first calls can come from several threads
+static sgemm_kernel_t sgemm_select_kernel(int *nr)
+{
+    pthread_once(&sgemm_kernel_once, sgemm_init_kernel);
+    *nr = sgemm_kernel_nr;
+    return sgemm_kernel;
+}
+
+typedef struct sgemm_pack_args {
+    int size, kc, nr;           // rows of A or columns of B, and panel width
+    float ALPHA;
+    const float *src;
+    int ld;
+    float *dst;
+} sgemm_pack_args;
+
+static void sgemm_pack_a_panels(void *arg, int begin, int end)
+{
+    const sgemm_pack_args *a = (const sgemm_pack_args *)arg;
+    const int M = a->size, kc = a->kc;
+    int t;
+    for (t = begin; t < end; ++t) {
+        const int ir = t*SGEMM_MR;
+        float *dst = a->dst + (size_t)ir*kc;
+        const int mr = (M - ir < SGEMM_MR) ? (M - ir) : SGEMM_MR;
+        int i, p;
+        for (i = 0; i < mr; ++i) {
+            const float *src = a->src + (size_t)(ir + i)*a->ld;
+            for (p = 0; p < kc; ++p) dst[p*SGEMM_MR + i] = a->ALPHA*src[p];
+        }
+        for (; i < SGEMM_MR; ++i) {
+            for (p = 0; p < kc; ++p) dst[p*SGEMM_MR + i] = 0;
+        }
+    }
+}
+
+// packed A: for every MR-row panel, kc columns of MR consecutive values
+static void sgemm_pack_a(int M, int kc, float ALPHA, const float *A, int lda, float *pa)
+{
+    const int panels = (M + SGEMM_MR - 1) / SGEMM_MR;
+    sgemm_pack_args args = { M, kc, SGEMM_MR, ALPHA, A, lda, pa };
+    parallel_for(panels, parallel_grain(panels, SGEMM_MR*kc*sizeof(float)), sgemm_pack_a_panels, &args);
+}
+
+static void sgemm_pack_b_panels(void *arg, int begin, int end)
+{
+    const sgemm_pack_args *a = (const sgemm_pack_args *)arg;
+    const int nc = a->size, kc = a->kc, nr = a->nr;
+    int t;
+    for (t = begin; t < end; ++t) {
+        const int jr = t*nr;
+        float *dst = a->dst + (size_t)jr*kc;
+        const int n = (nc - jr < nr) ? (nc - jr) : nr;
+        int p, j;
+        for (p = 0; p < kc; ++p) {
+            const float *src = a->src + (size_t)p*a->ld + jr;
+            for (j = 0; j < n; ++j) dst[j] = src[j];
+            for (; j < nr; ++j) dst[j] = 0;
+            dst += nr;
+        }
+    }
+}
+
+// packed B: for every NR-column panel, kc rows of NR consecutive values
+static void sgemm_pack_b(int kc, int nc, int nr, const float *B, int ldb, float *pb)
+{
+    const int panels = (nc + nr - 1) / nr;
+    sgemm_pack_args args = { nc, kc, nr, 1, B, ldb, pb };
+    parallel_for(panels, parallel_grain(panels, nr*kc*sizeof(float)), sgemm_pack_b_panels, &args);
+}
+
+// What the last K slice applies to C: with an epilogue C = activation(A*B + bias),
+// without one C += ALPHA*A*B
+typedef struct sgemm_epilogue {
+    const float *bias;          // M values, or NULL
+    ACTIVATION a;
+} sgemm_epilogue;
+
+// finishes a tile the micro-kernel could not apply the epilogue to in registers
+static void sgemm_tile_epilogue(float *c, int ldc, int mr, int n, int row, const sgemm_epilogue *ep, int flags)
+{
+    int i, j;
+    if (ep->bias && !(flags & SGEMM_BIAS)) {
+        for (i = 0; i < mr; ++i) {
+            for (j = 0; j < n; ++j) c[i*ldc + j] += ep->bias[row + i];
+        }
+    }
+    if (ep->a == LEAKY && !(flags & SGEMM_LEAKY)) {
+        for (i = 0; i < mr; ++i) {
+            for (j = 0; j < n; ++j) c[i*ldc + j] = (c[i*ldc + j] < 0) ? .1f*c[i*ldc + j] : c[i*ldc + j];
+        }
+    }
+    else if (ep->a != LINEAR && ep->a != LEAKY) {
+        for (i = 0; i < mr; ++i) {
+            for (j = 0; j < n; ++j) c[i*ldc + j] = activate(c[i*ldc + j], ep->a);
+        }
+    }
+}
+
+// one KC x NC block of B against all of packed A
+typedef struct sgemm_tasks {
+    sgemm_kernel_t kernel;
+    const float *pa, *pb;
+    float *C;                   // at the first column of the block
+    int ldc, M, nc, nr, kc, n_panels, flags;
+    const sgemm_epilogue *ep;   // NULL unless the block finishes C
+} sgemm_tasks;
+
+// one task = one MC block of A against one NR panel of B,
+// consecutive tasks share the same A block
+static void sgemm_run_tasks(void *arg, int begin, int end)
+{
+    const sgemm_tasks *a = (const sgemm_tasks *)arg;
+    const int M = a->M, nc = a->nc, nr = a->nr, kc = a->kc, ldc = a->ldc, flags = a->flags;
+    int t;
+    for (t = begin; t < end; ++t) {
+        const int ic = (t / a->n_panels) * SGEMM_MC;
+        const int jr = (t % a->n_panels) * nr;
+        const int mc = (M - ic < SGEMM_MC) ? (M - ic) : SGEMM_MC;
+        const int n = (nc - jr < nr) ? (nc - jr) : nr;
+        const float *b_panel = a->pb + (size_t)jr*kc;
+        int ir;
+        for (ir = ic; ir < ic + mc; ir += SGEMM_MR) {
+            const int mr = (ic + mc - ir < SGEMM_MR) ? (ic + mc - ir) : SGEMM_MR;
+            float *c_tile = a->C + (size_t)ir*ldc + jr;
+            if (mr == SGEMM_MR && n == nr) {
+                a->kernel(kc, a->pa + (size_t)ir*kc, b_panel, c_tile, ldc, flags, (flags & SGEMM_BIAS) ? a->ep->bias + ir : NULL);
+            }
+            else {
+                float tile[SGEMM_MR*SGEMM_MAX_NR];
+                int i, j;
+                a->kernel(kc, a->pa + (size_t)ir*kc, b_panel, tile, nr, 0, NULL);
+                for (i = 0; i < mr; ++i) {
+                    for (j = 0; j < n; ++j) {
+                        if (flags & SGEMM_ACCUMULATE) c_tile[i*ldc + j] += tile[i*nr + j];
+                        else c_tile[i*ldc + j] = tile[i*nr + j];
                     }
-                    dst[out_index] = max;
-                    indexes[out_index] = max_i;
                 }
+                if (a->ep) sgemm_tile_epilogue(c_tile, ldc, mr, n, ir, a->ep, 0);
+                continue;
             }
+            if (a->ep) sgemm_tile_epilogue(c_tile, ldc, mr, n, ir, a->ep, flags);
         }
     }
 }
 
-#endif    // AVX
+// returns 0 when the CPU has no suitable micro-kernel.
+// A non-NULL packed_a (see gemm_pack_weights) is used instead of packing A, ALPHA is then ignored
+static int gemm_nn_packed(int M, int N, int K, float ALPHA,
+    float *A, int lda,
+    const float *packed_a,
+    float *B, int ldb,
+    float *C, int ldc,
+    const sgemm_epilogue *ep)
+{
+    int nr;
+    sgemm_kernel_t kernel = sgemm_select_kernel(&nr);
+    if (!kernel) return 0;
+
+    const size_t m_padded = (size_t)(M + SGEMM_MR - 1) / SGEMM_MR * SGEMM_MR;
+    const int kc_max = (K < SGEMM_KC) ? K : SGEMM_KC;
+    const int nc_max = (N < SGEMM_NC) ? N : SGEMM_NC;
+    // round the A part up to 16 floats so that packed B stays 64-byte aligned
+    const size_t a_size = packed_a ? 0 : ((m_padded * kc_max) + 15) & ~(size_t)15;
+    const size_t b_size = (size_t)(nc_max + nr - 1) / nr * nr * kc_max;
+    void *buffer = malloc((a_size + b_size) * sizeof(float) + 64);
+    if (!buffer) error("gemm_nn_packed: malloc failed");
+    float *pa = (float *)(((size_t)buffer + 63) & ~(size_t)63);
+    float *pb = pa + a_size;
+
+    int pc, jc;
+    for (pc = 0; pc < K; pc += SGEMM_KC) {
+        const int kc = (K - pc < SGEMM_KC) ? (K - pc) : SGEMM_KC;
+        // the epilogue overwrites C with the first slice and finishes it with the last one
+        int flags = (ep && pc == 0) ? 0 : SGEMM_ACCUMULATE;
+        if (ep && pc + kc == K) {
+            if (ep->bias) flags |= SGEMM_BIAS;
+            if (ep->a == LEAKY) flags |= SGEMM_LEAKY;
+        }
+        if (packed_a) pa = (float *)packed_a + m_padded*pc;
+        else sgemm_pack_a(M, kc, ALPHA, A + pc, lda, pa);
+
+        for (jc = 0; jc < N; jc += SGEMM_NC) {
+            const int nc = (N - jc < SGEMM_NC) ? (N - jc) : SGEMM_NC;
+            sgemm_pack_b(kc, nc, nr, B + (size_t)pc*ldb + jc, ldb, pb);
+
+            const int m_blocks = (M + SGEMM_MC - 1) / SGEMM_MC;
+            sgemm_tasks tasks = { kernel, pa, pb, C + jc, ldc, M, nc, nr, kc, (nc + nr - 1) / nr, flags,
+                (ep && pc + kc == K) ? ep : NULL };
+            parallel_for(m_blocks*tasks.n_panels, 1, sgemm_run_tasks, &tasks);
+        }
+    }
+    free(buffer);
+    return 1;
+}
+
+#endif    // x86_64
+
+#ifdef SGEMM_PACKED
+
+int gemm_packed_weights_layout(int *mr, int *kc)
+{
+    *mr = SGEMM_MR;
+    *kc = SGEMM_KC;
+    return 1;
+}
+
+size_t gemm_packed_weights_size(int M, int K)
+{
+    return (size_t)(M + SGEMM_MR - 1) / SGEMM_MR * SGEMM_MR * K;
+}
+
+// every KC slice of A packed as gemm_nn_packed() would do it, one after the other
+void gemm_pack_weights(int M, int K, float *A, int lda, float *packed)
+{
+    const size_t m_padded = (size_t)(M + SGEMM_MR - 1) / SGEMM_MR * SGEMM_MR;
+    int pc;
+    for (pc = 0; pc < K; pc += SGEMM_KC) {
+        const int kc = (K - pc < SGEMM_KC) ? (K - pc) : SGEMM_KC;
+        sgemm_pack_a(M, kc, 1, A + pc, lda, packed + m_padded*pc);
+    }
+}
+
+int gemm_nn_prepacked(int M, int N, int K, const float *packed_a, float *B, int ldb, float *C, int ldc)
+{
+    return gemm_nn_packed(M, N, K, 1, NULL, 0, packed_a, B, ldb, C, ldc, NULL);
+}
+
+int gemm_nn_fused_available()
+{
+    int nr;
+    return sgemm_select_kernel(&nr) != NULL;
+}
+
+int gemm_nn_fused(int M, int N, int K, float *A, int lda, const float *packed_a, float *B, int ldb,
+    float *C, int ldc, const float *bias, ACTIVATION a)
+{
+    sgemm_epilogue ep;
+    ep.bias = bias;
+    ep.a = a;
+    return gemm_nn_packed(M, N, K, 1, A, lda, packed_a, B, ldb, C, ldc, &ep);
+}
+
+#else
+
+int gemm_packed_weights_layout(int *mr, int *kc)
+{
+    *mr = *kc = 0;
+    return 0;
+}
+
+size_t gemm_packed_weights_size(int M, int K) { return 0; }
+void gemm_pack_weights(int M, int K, float *A, int lda, float *packed) {}
+int gemm_nn_prepacked(int M, int N, int K, const float *packed_a, float *B, int ldb, float *C, int ldc) { return 0; }
+int gemm_nn_fused_available() { return 0; }
+int gemm_nn_fused(int M, int N, int K, float *A, int lda, const float *packed_a, float *B, int ldb,
+    float *C, int ldc, const float *bias, ACTIVATION a) { return 0; }
+
+#endif    // SGEMM_PACKED
+
+// INT8 GEMM: C = epilogue(A_s8 * B_u8) for quantized convolutions.
+// A is M (padded to GEMM_INT8_MR) rows of lda = 4*K4 signed weights,
+// B is packed in 16-column panels of K4 groups, each group holding 4
+// consecutive K values of every column: B[panel][k4][column][4]
+#define GEMM_INT8_MR 4
+#define GEMM_INT8_NR 16
+#define GEMM_INT8_MB 64
+
+typedef void (*gemm_int8_kernel_t)(int k4, const signed char *a, int lda, const unsigned char *b, int *tile);
+
+static void gemm_int8_kernel_c(int k4, const signed char *a, int lda, const unsigned char *b, int *tile)
+{
+    int i, j, p;
+    for (i = 0; i < GEMM_INT8_MR*GEMM_INT8_NR; ++i) tile[i] = 0;
+    for (p = 0; p < k4; ++p) {
+        for (i = 0; i < GEMM_INT8_MR; ++i) {
+            const signed char *w = a + i*lda + p * 4;
+            for (j = 0; j < GEMM_INT8_NR; ++j) {
+                const unsigned char *x = b + j * 4;
+                tile[i*GEMM_INT8_NR + j] += w[0] * x[0] + w[1] * x[1] + w[2] * x[2] + w[3] * x[3];
+            }
+        }
+        b += 4 * GEMM_INT8_NR;
+    }
+}
+
+#ifdef SGEMM_PACKED
+
+// pmaddubsw sums pairs into int16 with saturation: weights must stay within
+// +-63 so that 2 * 255 * 63 fits, pmaddwd then sums the pairs into int32
+SGEMM_TARGET_AVX2
+static void gemm_int8_kernel_avx2(int k4, const signed char *a, int lda, const unsigned char *b, int *tile)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+    __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+    __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+    __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+    int p;
+    for (p = 0; p < k4; ++p) {
+        const __m256i b0 = _mm256_load_si256((const __m256i *)b);
+        const __m256i b1 = _mm256_load_si256((const __m256i *)(b + 32));
+        __m256i w;
+        w = _mm256_set1_epi32(*(const int *)(a + p * 4));
+        c00 = _mm256_add_epi32(c00, _mm256_madd_epi16(_mm256_maddubs_epi16(b0, w), ones));
+        c01 = _mm256_add_epi32(c01, _mm256_madd_epi16(_mm256_maddubs_epi16(b1, w), ones));
+        w = _mm256_set1_epi32(*(const int *)(a + lda + p * 4));
+        c10 = _mm256_add_epi32(c10, _mm256_madd_epi16(_mm256_maddubs_epi16(b0, w), ones));
+        c11 = _mm256_add_epi32(c11, _mm256_madd_epi16(_mm256_maddubs_epi16(b1, w), ones));
+        w = _mm256_set1_epi32(*(const int *)(a + 2 * lda + p * 4));
+        c20 = _mm256_add_epi32(c20, _mm256_madd_epi16(_mm256_maddubs_epi16(b0, w), ones));
+        c21 = _mm256_add_epi32(c21, _mm256_madd_epi16(_mm256_maddubs_epi16(b1, w), ones));
+        w = _mm256_set1_epi32(*(const int *)(a + 3 * lda + p * 4));
+        c30 = _mm256_add_epi32(c30, _mm256_madd_epi16(_mm256_maddubs_epi16(b0, w), ones));
+        c31 = _mm256_add_epi32(c31, _mm256_madd_epi16(_mm256_maddubs_epi16(b1, w), ones));
+        b += 4 * GEMM_INT8_NR;
+    }
+    _mm256_storeu_si256((__m256i *)(tile + 0), c00);
+    _mm256_storeu_si256((__m256i *)(tile + 8), c01);
+    _mm256_storeu_si256((__m256i *)(tile + 16), c10);
+    _mm256_storeu_si256((__m256i *)(tile + 24), c11);
+    _mm256_storeu_si256((__m256i *)(tile + 32), c20);
+    _mm256_storeu_si256((__m256i *)(tile + 40), c21);
+    _mm256_storeu_si256((__m256i *)(tile + 48), c30);
+    _mm256_storeu_si256((__m256i *)(tile + 56), c31);
+}
+
+#if (defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 8) || (defined(__clang__) && __clang_major__ >= 6) || (defined(_MSC_VER) && _MSC_VER >= 1920)
+#define GEMM_INT8_VNNI
+#if defined(__GNUC__)
+#define GEMM_TARGET_AVX512_VNNI __attribute__((target("avx512f,avx512vnni")))
+#else
+#define GEMM_TARGET_AVX512_VNNI
+#endif
+
+// vpdpbusd: one 64-byte load of B is a whole 16-column group, no saturation
+GEMM_TARGET_AVX512_VNNI
+static void gemm_int8_kernel_avx512_vnni(int k4, const signed char *a, int lda, const unsigned char *b, int *tile)
+{
+    __m512i c0 = _mm512_setzero_si512(), c1 = _mm512_setzero_si512();
+    __m512i c2 = _mm512_setzero_si512(), c3 = _mm512_setzero_si512();
+    int p;
+    for (p = 0; p < k4; ++p) {
+        const __m512i b0 = _mm512_load_si512((const void *)b);
+        c0 = _mm512_dpbusd_epi32(c0, b0, _mm512_set1_epi32(*(const int *)(a + p * 4)));
+        c1 = _mm512_dpbusd_epi32(c1, b0, _mm512_set1_epi32(*(const int *)(a + lda + p * 4)));
+        c2 = _mm512_dpbusd_epi32(c2, b0, _mm512_set1_epi32(*(const int *)(a + 2 * lda + p * 4)));
+        c3 = _mm512_dpbusd_epi32(c3, b0, _mm512_set1_epi32(*(const int *)(a + 3 * lda + p * 4)));
+        b += 4 * GEMM_INT8_NR;
+    }
+    _mm512_storeu_si512((void *)(tile + 0), c0);
+    _mm512_storeu_si512((void *)(tile + 16), c1);
+    _mm512_storeu_si512((void *)(tile + 32), c2);
+    _mm512_storeu_si512((void *)(tile + 48), c3);
+}
+#endif    // GEMM_INT8_VNNI
+
+#endif    // SGEMM_PACKED
+
+static gemm_int8_kernel_t gemm_int8_kernel;
+static pthread_once_t gemm_int8_kernel_once = PTHREAD_ONCE_INIT;
+
+static void gemm_int8_init_kernel(void)
+{
+    gemm_int8_kernel = gemm_int8_kernel_c;
+#ifdef SGEMM_PACKED
+    if (is_fma_avx2()) gemm_int8_kernel = gemm_int8_kernel_avx2;
+#ifdef GEMM_INT8_VNNI
+    if (is_avx512_vnni()) gemm_int8_kernel = gemm_int8_kernel_avx512_vnni;
+#endif
+#endif
+}
+
+static gemm_int8_kernel_t gemm_int8_select_kernel()
+{
+    pthread_once(&gemm_int8_kernel_once, gemm_int8_init_kernel);
+    return gemm_int8_kernel;
+}
+
+typedef struct gemm_int8_tasks {
+    gemm_int8_kernel_t kernel;
+    int M, N, K4, n_panels;
+    const signed char *A;
+    const unsigned char *B;
+    const int *offsets;
+    const float *scales, *biases;
+    ACTIVATION a;
+    float *C;
+    int ldc;
+} gemm_int8_tasks;
+
+static void gemm_int8_run_tasks(void *arg, int begin, int end)
+{
+    const gemm_int8_tasks *task = (const gemm_int8_tasks *)arg;
+    const gemm_int8_kernel_t kernel = task->kernel;
+    const int M = task->M, N = task->N, K4 = task->K4, n_panels = task->n_panels, ldc = task->ldc;
+    const signed char *A = task->A;
+    const unsigned char *B = task->B;
+    const int *offsets = task->offsets;
+    const float *scales = task->scales, *biases = task->biases;
+    const ACTIVATION a = task->a;
+    float *C = task->C;
+    const int lda = K4 * 4;
+    int t;
+    for (t = begin; t < end; ++t) {
+        const int ib = (t / n_panels) * GEMM_INT8_MB;
+        const int jr = (t % n_panels) * GEMM_INT8_NR;
+        const int i_end = (ib + GEMM_INT8_MB < M) ? (ib + GEMM_INT8_MB) : M;
+        const int n = (N - jr < GEMM_INT8_NR) ? (N - jr) : GEMM_INT8_NR;
+        const unsigned char *b_panel = B + (size_t)jr*lda;
+        int ir;
+        for (ir = ib; ir < i_end; ir += GEMM_INT8_MR) {
+            int tile[GEMM_INT8_MR*GEMM_INT8_NR];
+            const int mr = (i_end - ir < GEMM_INT8_MR) ? (i_end - ir) : GEMM_INT8_MR;
+            int i, j;
+            kernel(K4, A + (size_t)ir*lda, lda, b_panel, tile);
+            // requantize: remove the input zero point, scale, add bias, activate
+            for (i = 0; i < mr; ++i) {
+                const int offset = offsets[ir + i];
+                const float scale = scales[ir + i];
+                const float bias = biases[ir + i];
+                float *c = C + (size_t)(ir + i)*ldc + jr;
+                if (a == LEAKY) {
+                    for (j = 0; j < n; ++j) {
+                        const float v = (tile[i*GEMM_INT8_NR + j] - offset)*scale + bias;
+                        c[j] = (v > 0) ? v : .1f*v;
+                    }
+                }
+                else {
+                    for (j = 0; j < n; ++j) c[j] = (tile[i*GEMM_INT8_NR + j] - offset)*scale + bias;
+                }
+            }
+        }
+    }
+}
+
+void gemm_int8_u8s8(int M, int N, int K4,
+    const signed char *A, const unsigned char *B,
+    const int *offsets, const float *scales, const float *biases, ACTIVATION a,
+    float *C, int ldc)
+{
+    const int m_blocks = (M + GEMM_INT8_MB - 1) / GEMM_INT8_MB;
+    gemm_int8_tasks tasks = { gemm_int8_select_kernel(), M, N, K4, (N + GEMM_INT8_NR - 1) / GEMM_INT8_NR,
+        A, B, offsets, scales, biases, a, C, ldc };
+    parallel_for(m_blocks*tasks.n_panels, 1, gemm_int8_run_tasks, &tasks);
+}
 
 void gemm_nt(int M, int N, int K, float ALPHA,
         float *A, int lda,
@@ -2153,6 +2918,33 @@ void gemm_tt(int M, int N, int K, float ALPHA,
 }
 
 
+typedef struct gemm_args {
+    int TA, TB, N, K;
+    float ALPHA;
+    float *A;
+    int lda;
+    float *B;
+    int ldb;
+    float *C;
+    int ldc;
+} gemm_args;
+
+static void gemm_cpu_rows(void *arg, int begin, int end)
+{
+    const gemm_args *a = (const gemm_args *)arg;
+    int t;
+    for (t = begin; t < end; ++t) {
+        if (!a->TA && !a->TB)
+            gemm_nn(1, a->N, a->K, a->ALPHA, a->A + t*a->lda, a->lda, a->B, a->ldb, a->C + t*a->ldc, a->ldc);
+        else if (a->TA && !a->TB)
+            gemm_tn(1, a->N, a->K, a->ALPHA, a->A + t, a->lda, a->B, a->ldb, a->C + t*a->ldc, a->ldc);
+        else if (!a->TA && a->TB)
+            gemm_nt(1, a->N, a->K, a->ALPHA, a->A + t*a->lda, a->lda, a->B, a->ldb, a->C + t*a->ldc, a->ldc);
+        else
+            gemm_tt(1, a->N, a->K, a->ALPHA, a->A + t, a->lda, a->B, a->ldb, a->C + t*a->ldc, a->ldc);
+    }
+}
+
 void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float *A, int lda,
         float *B, int ldb,
@@ -2169,18 +2961,12 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         }
     }
 
-    int t;
-    #pragma omp parallel for
-    for (t = 0; t < M; ++t) {
-        if (!TA && !TB)
-            gemm_nn(1, N, K, ALPHA, A + t*lda, lda, B, ldb, C + t*ldc, ldc);
-        else if (TA && !TB)
-            gemm_tn(1, N, K, ALPHA, A + t, lda, B, ldb, C + t*ldc, ldc);
-        else if (!TA && TB)
-            gemm_nt(1, N, K, ALPHA, A + t*lda, lda, B, ldb, C + t*ldc, ldc);
-        else
-            gemm_tt(1, N, K, ALPHA, A + t, lda, B, ldb, C + t*ldc, ldc);
-    }
+#ifdef SGEMM_PACKED
+    if (!TA && !TB && gemm_nn_packed(M, N, K, ALPHA, A, lda, NULL, B, ldb, C, ldc, NULL)) return;
+#endif
+
+    gemm_args args = { TA, TB, N, K, ALPHA, A, lda, B, ldb, C, ldc };
+    parallel_for(M, parallel_grain(M, K*N/8 + 1), gemm_cpu_rows, &args);
 }
 
 #ifdef GPU
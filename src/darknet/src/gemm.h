@@ -76,6 +76,34 @@ void gemm_cpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float BETA,
         float *C, int ldc);
 
+// C[M x N] = (A*B - offsets[i]) * scales[i] + biases[i], followed by LEAKY when requested (any other
+// activation is left to the caller); A is int8 with rows padded to a multiple of 4 and K4*4 columns,
+// B is uint8 packed by 16 columns and 4 rows
+void gemm_int8_u8s8(int M, int N, int K4,
+    const signed char *A, const unsigned char *B,
+    const int *offsets, const float *scales, const float *biases, ACTIVATION a,
+    float *C, int ldc);
+
+// Weights packed once into the layout of the blocked SGEMM, for C += A*B without repacking A:
+// the layout (micro-panel rows and K slice) is returned by gemm_packed_weights_layout(), which
+// returns 0 when this build has no blocked SGEMM; gemm_nn_prepacked() returns 0 when the CPU lacks
+// its kernels, then the plain weights have to be used
+int gemm_packed_weights_layout(int *mr, int *kc);
+size_t gemm_packed_weights_size(int M, int K);
+void gemm_pack_weights(int M, int K, float *A, int lda, float *packed);
+int gemm_nn_prepacked(int M, int N, int K, const float *packed_a, float *B, int ldb, float *C, int ldc);
+
+// C = a(A*B + bias[row]) with bias and activation applied to each output tile while it is
+// still in registers or L1 (C is overwritten, bias may be NULL). A is used when packed_a is NULL.
+// Returns 0 when the CPU lacks the blocked SGEMM kernels, gemm_nn_fused_available() tells up front
+int gemm_nn_fused_available();
+int gemm_nn_fused(int M, int N, int K, float *A, int lda, const float *packed_a, float *B, int ldb,
+    float *C, int ldc, const float *bias, ACTIVATION a);
+
+int is_avx();
+int is_fma_avx2();
+int is_avx512_vnni();
+
 #ifdef GPU
 void gemm_ongpu(int TA, int TB, int M, int N, int K, float ALPHA,
         float *A_gpu, int lda,
@@ -38,36 +38,36 @@ layer make_gru_layer(int batch, int inputs, int outputs, int steps, int batch_no
 
     l.input_z_layer = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.input_z_layer) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize);
+    *(l.input_z_layer) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, 1);
     l.input_z_layer->batch = batch;
 
     l.state_z_layer = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.state_z_layer) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize);
+    *(l.state_z_layer) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, 1);
     l.state_z_layer->batch = batch;
 
 
 
     l.input_r_layer = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.input_r_layer) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize);
+    *(l.input_r_layer) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, 1);
     l.input_r_layer->batch = batch;
 
     l.state_r_layer = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.state_r_layer) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize);
+    *(l.state_r_layer) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, 1);
     l.state_r_layer->batch = batch;
 
 
 
     l.input_h_layer = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.input_h_layer) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize);
+    *(l.input_h_layer) = make_connected_layer(batch*steps, inputs, outputs, LINEAR, batch_normalize, 1);
     l.input_h_layer->batch = batch;
 
     l.state_h_layer = malloc(sizeof(layer));
     fprintf(stderr, "\t\t");
-    *(l.state_h_layer) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize);
+    *(l.state_h_layer) = make_connected_layer(batch*steps, outputs, outputs, LINEAR, batch_normalize, 1);
     l.state_h_layer->batch = batch;
 
     l.batch_normalize = batch_normalize;
@@ -5,6 +5,10 @@
 #include <stdio.h>
 #include <math.h>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -1814,6 +1818,136 @@ image resize_image(image im, int w, int h)
     return resized;
 }
 
+packed_resizer make_packed_resizer(int w, int h, int c)
+{
+    packed_resizer r = {0};
+    r.w = w;
+    r.h = h;
+    r.c = c;
+    r.ofs0 = calloc(w, sizeof(int));
+    r.ofs1 = calloc(w, sizeof(int));
+    r.dx = calloc(w, sizeof(float));
+    r.rows = calloc(2*w*c, sizeof(float));
+    return r;
+}
+
+void free_packed_resizer(packed_resizer r)
+{
+    free(r.ofs0);
+    free(r.ofs1);
+    free(r.dx);
+    free(r.rows);
+}
+
+// column tables depend only on the source width and pixel layout, rebuild them when those change
+static void packed_resizer_columns(packed_resizer *r, int src_w, int pixel_inc)
+{
+    int x;
+    if (r->src_w == src_w && r->pixel_inc == pixel_inc) return;
+    float w_scale = (r->w > 1) ? (float)(src_w - 1) / (r->w - 1) : 0;
+    for (x = 0; x < r->w; ++x) {
+        float sx = x*w_scale;
+        int ix = (int)sx;
+        float dx = sx - ix;
+        if (x == r->w - 1 || ix >= src_w - 1) {
+            ix = src_w - 1;
+            dx = 0;
+        }
+        r->ofs0[x] = ix*pixel_inc;
+        r->ofs1[x] = ((ix + 1 < src_w) ? ix + 1 : ix)*pixel_inc;
+        r->dx[x] = dx;
+    }
+    r->src_w = src_w;
+    r->pixel_inc = pixel_inc;
+}
+
+// horizontal pass of one interleaved uint8 row into c planar float rows, values kept in [0, 255]
+static void packed_resizer_row(packed_resizer *r, const unsigned char *src, const int *offsets, float *dst)
+{
+    int x, k;
+    for (k = 0; k < r->c; ++k) {
+        const unsigned char *s = src + offsets[k];
+        float *d = dst + k*r->w;
+        for (x = 0; x < r->w; ++x) {
+            float a = s[r->ofs0[x]];
+            float b = s[r->ofs1[x]];
+            d[x] = a + r->dx[x]*(b - a);
+        }
+    }
+}
+
+// vertical pass: dst = (r0*(1-dy) + r1*dy) / 255
+static void packed_resizer_blend(const float *r0, const float *r1, float dy, int n, float *dst)
+{
+    int i = 0;
+    float w0 = (1 - dy) / 255.f;
+    float w1 = dy / 255.f;
+#if defined(__AVX__)
+    __m256 w0_256 = _mm256_set1_ps(w0);
+    __m256 w1_256 = _mm256_set1_ps(w1);
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(r0 + i), w0_256);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(r1 + i), w1_256);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(a, b));
+    }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128 w0_128 = _mm_set1_ps(w0);
+    __m128 w1_128 = _mm_set1_ps(w1);
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(r0 + i), w0_128);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(r1 + i), w1_128);
+        _mm_storeu_ps(dst + i, _mm_add_ps(a, b));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = r0[i]*w0 + r1[i]*w1;
+    }
+}
+
+void resize_packed_into(packed_resizer *r, const unsigned char *src, int src_w, int src_h, int row_bytes, int pixel_inc, const int *offsets, float *dst)
+{
+    int y, k;
+    int plane = r->w*r->h;
+    float *rows[2] = { r->rows, r->rows + r->w*r->c };
+    int cached[2] = { -1, -1 };
+    float h_scale = (r->h > 1) ? (float)(src_h - 1) / (r->h - 1) : 0;
+
+    packed_resizer_columns(r, src_w, pixel_inc);
+    for (y = 0; y < r->h; ++y) {
+        float sy = y*h_scale;
+        int iy = (int)sy;
+        float dy = sy - iy;
+        if (y == r->h - 1 || iy >= src_h - 1) {
+            iy = src_h - 1;
+            dy = 0;
+        }
+        int iy1 = (iy + 1 < src_h) ? iy + 1 : iy;
+        // rows only ever move forward, so the previous lower row usually becomes the new upper one
+        if (cached[0] != iy) {
+            if (cached[1] == iy) {
+                float *swap = rows[0];
+                rows[0] = rows[1];
+                rows[1] = swap;
+                cached[0] = iy;
+                cached[1] = -1;
+            } else {
+                packed_resizer_row(r, src + (size_t)iy*row_bytes, offsets, rows[0]);
+                cached[0] = iy;
+            }
+        }
+        if (dy != 0 && cached[1] != iy1) {
+            packed_resizer_row(r, src + (size_t)iy1*row_bytes, offsets, rows[1]);
+            cached[1] = iy1;
+        }
+        for (k = 0; k < r->c; ++k) {
+            const float *r0 = rows[0] + k*r->w;
+            const float *r1 = (dy != 0) ? rows[1] + k*r->w : r0;
+            packed_resizer_blend(r0, r1, dy, r->w, dst + k*plane + y*r->w);
+        }
+    }
+}
+
 
 void test_resize(char *filename)
 {
@@ -15,6 +15,17 @@ typedef struct {
     float *data;
 } image;
 
+// Resizes interleaved 8-bit pixels (RGB, RGBA, BGRA, ... with any row stride) straight into
+// a planar, normalized float buffer of w*h*c. All scratch memory is allocated once up-front.
+typedef struct packed_resizer {
+    int w, h, c;        // destination size
+    int src_w;          // source width the column tables were built for
+    int pixel_inc;      // source pixel size the column tables were built for
+    int *ofs0, *ofs1;   // byte offsets of the left and right source pixel for every destination column
+    float *dx;          // weight of the right source pixel for every destination column
+    float *rows;        // two horizontally resized source rows
+} packed_resizer;
+
 float get_color(int c, int x, int max);
 void flip_image(image a);
 void draw_box(image a, int x1, int y1, int x2, int y2, float r, float g, float b);
@@ -31,6 +42,9 @@ image random_crop_image(image im, int w, int h);
 image random_augment_image(image im, float angle, float aspect, int low, int high, int size);
 void random_distort_image(image im, float hue, float saturation, float exposure);
 YOLODLL_API image resize_image(image im, int w, int h);
+YOLODLL_API packed_resizer make_packed_resizer(int w, int h, int c);
+YOLODLL_API void free_packed_resizer(packed_resizer r);
+YOLODLL_API void resize_packed_into(packed_resizer *r, const unsigned char *src, int src_w, int src_h, int row_bytes, int pixel_inc, const int *offsets, float *dst);
 void fill_image(image m, float s);
 void letterbox_image_into(image im, int w, int h, image boxed);
 YOLODLL_API image letterbox_image(image im, int w, int h);
@@ -27,16 +27,21 @@ void free_layer(layer l)
 	if (l.concat)             free(l.concat);
 	if (l.concat_delta)       free(l.concat_delta);
 	if (l.binary_weights)     free(l.binary_weights);
-	if (l.biases)             free(l.biases);
+	if (l.biases && !l.weights_mapped) free(l.biases);
 	if (l.bias_updates)       free(l.bias_updates);
 	if (l.scales)             free(l.scales);
 	if (l.scale_updates)      free(l.scale_updates);
-	if (l.weights)            free(l.weights);
+	if (l.weights && !l.weights_mapped) free(l.weights);
+	if (l.weights_packed && !l.weights_mapped) free(l.weights_packed);
 	if (l.weight_updates)     free(l.weight_updates);
     if (l.align_bit_weights)  free(l.align_bit_weights);
     if (l.mean_arr)           free(l.mean_arr);
+    if (l.winograd_weights)   free(l.winograd_weights);
+    if (l.weights_int8)       free(l.weights_int8);
+    if (l.weights_int8_scales) free(l.weights_int8_scales);
+    if (l.weights_int8_offsets) free(l.weights_int8_offsets);
 	if (l.delta)              free(l.delta);
-	if (l.output)             free(l.output);
+	if (l.output && !l.output_planned) free(l.output);
 	if (l.squared)            free(l.squared);
 	if (l.norms)              free(l.norms);
 	if (l.spatial_mean)       free(l.spatial_mean);
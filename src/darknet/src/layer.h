@@ -195,6 +195,20 @@ struct layer{
     int new_lda;
     int bit_align;
 
+    int winograd;                // output tile size m of F(m x m, 3 x 3), 0 = im2col+gemm
+    float *winograd_weights;
+
+    int int8;                    // quantized inference, set by quantize_network_int8()
+    float int8_input_scale;      // real value of one step of the quantized input
+    signed char *weights_int8;   // filters (padded to 4) x size*size*c (padded to 4)
+    float *weights_int8_scales;  // per filter: weight scale * input scale
+    int *weights_int8_offsets;   // per filter: input zero point * sum of the quantized weights
+
+    float *weights_packed;       // weights in the blocked SGEMM layout (gemm_pack_weights), 0 = packed per call
+    int weights_mapped;          // weights, biases and weights_packed point into a mapped .dnpack file
+    int output_planned;          // output points into the planned activation arena, see memplan.h
+    int logits;                  // [yolo] inference: the output keeps the raw logits, the decoders activate what they read (keep_network_logits)
+
     float *col_image;
     int   * input_layers;
     int   * input_sizes;
@@ -19,7 +19,7 @@ image get_maxpool_delta(maxpool_layer l)
     return float_to_image(w,h,c,l.delta);
 }
 
-maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding)
+maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int stride, int padding, int train)
 {
     maxpool_layer l = {0};
     l.type = MAXPOOL;
@@ -36,9 +36,12 @@ maxpool_layer make_maxpool_layer(int batch, int h, int w, int c, int size, int s
     l.size = size;
     l.stride = stride;
     int output_size = l.out_h * l.out_w * l.out_c * batch;
-    l.indexes = calloc(output_size, sizeof(int));
+    // argmax indexes are only needed to backpropagate
+    if (train) {
+        l.indexes = calloc(output_size, sizeof(int));
+        l.delta = calloc(output_size, sizeof(float));
+    }
     l.output =  calloc(output_size, sizeof(float));
-    l.delta =   calloc(output_size, sizeof(float));
     l.forward = forward_maxpool_layer;
     l.backward = backward_maxpool_layer;
     #ifdef GPU
@@ -84,9 +87,11 @@ void resize_maxpool_layer(maxpool_layer *l, int w, int h)
     l->outputs = l->out_w * l->out_h * l->c;
     int output_size = l->outputs * l->batch;
 
-    l->indexes = realloc(l->indexes, output_size * sizeof(int));
+    if (l->delta) {
+        l->indexes = realloc(l->indexes, output_size * sizeof(int));
+        l->delta = realloc(l->delta, output_size * sizeof(float));
+    }
     l->output = realloc(l->output, output_size * sizeof(float));
-    l->delta = realloc(l->delta, output_size * sizeof(float));
 
     #ifdef GPU
     cuda_free((float *)l->indexes_gpu);
@@ -133,7 +138,7 @@ void forward_maxpool_layer(const maxpool_layer l, network_state state)
                         }
                     }
                     l.output[out_index] = max;
-                    l.indexes[out_index] = max_i;
+                    if (l.indexes) l.indexes[out_index] = max_i;
                 }
             }
         }
@@ -0,0 +1,315 @@
+#include "memplan.h"
+#include "schedule.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define MEMPLAN_ALIGN 64
+
+typedef struct memplan_tensor {
+    int layer;
+    int first, last;            // the output is alive from step first to step last, steps being layers or waves
+    size_t size;                // bytes, a multiple of MEMPLAN_ALIGN
+    size_t offset;
+} memplan_tensor;
+
+// layers whose output is a buffer of their own that nothing else points into
+static int memplan_owns_output(layer l)
+{
+    switch (l.type) {
+    case CONVOLUTIONAL:
+    case CONNECTED:
+    case MAXPOOL:
+    case AVGPOOL:
+    case ROUTE:
+    case UPSAMPLE:
+    case SHORTCUT:
+    case YOLO:
+    case REGION:
+    case REORG:
+    case REORG_OLD:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static char *arena_base(void *activations)
+{
+    return (char *)(((size_t)activations + MEMPLAN_ALIGN - 1) & ~(size_t)(MEMPLAN_ALIGN - 1));
+}
+
+static int compare_tensor_size(const void *a, const void *b)
+{
+    const memplan_tensor *ta = a, *tb = b;
+    if (ta->size != tb->size) return (ta->size < tb->size) ? 1 : -1;
+    return ta->layer - tb->layer;
+}
+
+// lowest offset at which t overlaps no placed tensor that is alive at the same time
+static size_t place_tensor(memplan_tensor *placed, int count, memplan_tensor t)
+{
+    size_t offset = 0;
+    int i, moved = 1;
+    while (moved) {
+        moved = 0;
+        for (i = 0; i < count; ++i) {
+            memplan_tensor p = placed[i];
+            if (p.first > t.last || t.first > p.last) continue;
+            if (offset < p.offset + p.size && p.offset < offset + t.size) {
+                offset = p.offset + p.size;
+                moved = 1;
+            }
+        }
+    }
+    return offset;
+}
+
+int plan_network_memory(network *net)
+{
+    const int n = net->n;
+    int i, j, count = 0, views = 0, output_index;
+    size_t unplanned = 0, total = 0;
+    int *root, *step, *first, *last, *group;
+    size_t *group_offset;
+    memplan_tensor *tensors;
+    char *arena;
+
+#ifdef GPU
+    if (gpu_index >= 0) return 0;
+#endif
+    if (n <= 0) return 0;
+    for (i = 0; i < n; ++i) {
+        layer l = net->layers[i];
+        // training reads the outputs again on the way back
+        if (memplan_owns_output(l) && l.delta) return 0;
+        if (l.type == RNN || l.type == GRU || l.type == CRNN) return 0;
+    }
+    if (net->activations) release_network_memory_plan(net);
+
+    for (output_index = n - 1; output_index > 0; --output_index) {
+        if (net->layers[output_index].type != COST) break;
+    }
+
+    // layers sharing the output of an earlier one (dropout) extend its lifetime, and so
+    // does a [yolo] layer keeping the logits, which reads them where its input wrote them
+    root = calloc(n, sizeof(int));
+    step = calloc(n, sizeof(int));
+    first = calloc(n, sizeof(int));
+    last = calloc(n, sizeof(int));
+    for (i = 0; i < n; ++i) {
+        step[i] = net->wave ? net->wave[i] : i;     // the layers of a wave run at once (see schedule.h)
+        root[i] = i;
+        first[i] = step[i];
+        last[i] = step[i];
+        for (j = 0; j < i; ++j) {
+            if (net->layers[i].output && net->layers[i].output == net->layers[j].output) {
+                root[i] = root[j];
+                break;
+            }
+        }
+        if (i > 0 && net->layers[i].type == YOLO && net->layers[i].logits &&
+            net->layers[i].outputs == net->layers[i - 1].outputs) root[i] = root[i - 1];
+    }
+    for (i = 0; i < n; ++i) {
+        layer l = net->layers[i];
+        if (i + 1 < n && step[i + 1] > last[root[i]]) last[root[i]] = step[i + 1];
+        if (l.type == ROUTE) {
+            for (j = 0; j < l.n; ++j) {
+                const int r = root[l.input_layers[j]];
+                if (step[i] > last[r]) last[r] = step[i];
+            }
+        }
+        if (l.type == SHORTCUT && step[i] > last[root[l.index]]) last[root[l.index]] = step[i];
+        if (l.type == YOLO || l.type == REGION || l.type == DETECTION || i == output_index) last[root[i]] = INT_MAX;
+    }
+
+    // inputs of a batch 1 route are placed as slices of its output: the producers
+    // write the concatenation themselves and the route copies nothing. The route
+    // and its inputs become one tensor alive from the first producer on.
+    group = calloc(n, sizeof(int));
+    group_offset = calloc(n, sizeof(size_t));
+    for (i = 0; i < n; ++i) group[i] = -1;
+    for (i = 0; i < n; ++i) {
+        layer l = net->layers[i];
+        size_t offset = 0;
+        if (l.type != ROUTE || l.batch != 1 || !memplan_owns_output(l)) continue;
+        for (j = 0; j < l.n; ++j) {
+            const int k = l.input_layers[j];
+            layer in = net->layers[k];
+            // an input already holding slices of its own stays a buffer of its own
+            if (memplan_owns_output(in) && root[k] == k && group[k] < 0 && first[k] == step[k] &&
+                in.outputs == l.input_sizes[j]) {
+                group[k] = i;
+                group_offset[k] = offset;
+                if (step[k] < first[i]) first[i] = step[k];
+                if (last[k] > last[i]) last[i] = last[k];
+                unplanned += (size_t)in.outputs*sizeof(float);
+                ++views;
+            }
+            offset += l.input_sizes[j];
+        }
+    }
+
+    tensors = calloc(n, sizeof(memplan_tensor));
+    for (i = 0; i < n; ++i) {
+        layer l = net->layers[i];
+        if (!memplan_owns_output(l) || root[i] != i || group[i] >= 0) continue;
+        tensors[count].layer = i;
+        tensors[count].first = first[i];
+        tensors[count].last = last[i];
+        tensors[count].size = ((size_t)l.outputs*l.batch*sizeof(float) + MEMPLAN_ALIGN - 1) & ~(size_t)(MEMPLAN_ALIGN - 1);
+        unplanned += tensors[count].size;
+        ++count;
+    }
+    qsort(tensors, count, sizeof(memplan_tensor), compare_tensor_size);
+    for (i = 0; i < count; ++i) {
+        tensors[i].offset = place_tensor(tensors, i, tensors[i]);
+        if (tensors[i].offset + tensors[i].size > total) total = tensors[i].offset + tensors[i].size;
+    }
+
+    net->activations = calloc(1, total + MEMPLAN_ALIGN);
+    if (!net->activations) error("plan_network_memory: calloc failed");
+    net->activations_size = total;
+    arena = arena_base(net->activations);
+    for (i = 0; i < count; ++i) {
+        layer *l = &net->layers[tensors[i].layer];
+        free(l->output);
+        l->output = (float *)(arena + tensors[i].offset);
+        l->output_planned = 1;
+    }
+    for (i = 0; i < n; ++i) {
+        if (group[i] < 0) continue;
+        free(net->layers[i].output);
+        net->layers[i].output = net->layers[group[i]].output + group_offset[i];
+        net->layers[i].output_planned = 1;
+    }
+    for (i = 0; i < n; ++i) {
+        layer *l = &net->layers[i];
+        if (root[i] == i) continue;
+        // the buffer of its own a [yolo] layer leaves for its input's
+        if (l->type == YOLO) {
+            free(l->output);
+            l->output_planned = 1;
+        }
+        l->output = net->layers[root[i]].output;
+    }
+    net->output = get_network_output(*net);
+
+    fprintf(stderr, " activations: %.1f MB in %d buffers planned into %.1f MB, %d route inputs in place \n",
+        unplanned / (1024.0 * 1024.0), count, total / (1024.0 * 1024.0), views);
+    free(group_offset);
+    free(group);
+    free(tensors);
+    free(last);
+    free(first);
+    free(step);
+    free(root);
+    return 1;
+}
+
+void release_network_memory_plan(network *net)
+{
+    int i, j;
+    int *alias;
+    if (!net->activations) return;
+    // aliases of a planned output follow it into its new buffer
+    alias = calloc(net->n, sizeof(int));
+    for (i = 0; i < net->n; ++i) {
+        alias[i] = -1;
+        if (net->layers[i].output_planned) continue;
+        for (j = 0; j < i; ++j) {
+            if (net->layers[j].output_planned && net->layers[i].output == net->layers[j].output) {
+                alias[i] = j;
+                break;
+            }
+        }
+    }
+    for (i = 0; i < net->n; ++i) {
+        layer *l = &net->layers[i];
+        if (l->output_planned) {
+            l->output = calloc((size_t)l->outputs*l->batch, sizeof(float));
+            l->output_planned = 0;
+        }
+        else if (alias[i] >= 0) {
+            l->output = net->layers[alias[i]].output;
+        }
+    }
+    free(alias);
+    free(net->activations);
+    net->activations = 0;
+    net->activations_size = 0;
+    net->output = get_network_output(*net);
+}
+
+int make_network_context(network *net, network *ctx)
+{
+    network c = *net;
+    const char *base;
+    char *arena;
+    size_t workspace_size = 0;
+    int i;
+
+#ifdef GPU
+    if (gpu_index >= 0) return 0;
+#endif
+    if (!net->activations) return 0;
+    base = arena_base(net->activations);
+    for (i = 0; i < net->n; ++i) {
+        const char *output = (const char *)net->layers[i].output;
+        if (output < base || output >= base + net->activations_size) return 0;
+    }
+
+    // the plan is the same, only the arena moves
+    c.layers = calloc(net->n, sizeof(layer));
+    c.activations = calloc(1, net->activations_size + MEMPLAN_ALIGN);
+    if (!c.layers || !c.activations) error("make_network_context: calloc failed");
+    memcpy(c.layers, net->layers, net->n*sizeof(layer));
+    arena = arena_base(c.activations);
+    for (i = 0; i < c.n; ++i) {
+        layer *l = &c.layers[i];
+        l->output = (float *)(arena + ((const char *)l->output - base));
+        if (l->workspace_size > workspace_size) workspace_size = l->workspace_size;
+        // resizing the context rewrites the sizes of the route inputs
+        if (l->type == ROUTE) {
+            l->input_sizes = calloc(l->n, sizeof(int));
+            memcpy(l->input_sizes, net->layers[i].input_sizes, l->n*sizeof(int));
+        }
+        // xnor layers binarize their input and weights into buffers of their own
+        if (l->type == CONVOLUTIONAL && l->xnor) {
+            const size_t weights = (size_t)l->c*l->n*l->size*l->size;
+            l->binary_input = calloc((size_t)l->inputs*l->batch, sizeof(float));
+            l->binary_weights = calloc(weights, sizeof(float));
+            memcpy(l->binary_weights, net->layers[i].binary_weights, weights*sizeof(float));
+        }
+    }
+    c.workspace = make_network_workspace(&c, workspace_size);
+    c.output = get_network_output(c);
+    c.profile = 0;
+    c.weights_map = 0;
+    c.weights_map_size = 0;
+    *ctx = c;
+    return 1;
+}
+
+void free_network_context(network *ctx)
+{
+    int i;
+    for (i = 0; i < ctx->n; ++i) {
+        layer l = ctx->layers[i];
+        if (l.type == ROUTE) free(l.input_sizes);
+        if (l.type == CONVOLUTIONAL && l.xnor) {
+            free(l.binary_input);
+            free(l.binary_weights);
+        }
+    }
+    free(ctx->layers);
+    free(ctx->activations);
+    free(ctx->workspace);
+    ctx->layers = 0;
+    ctx->activations = 0;
+    ctx->workspace = 0;
+    ctx->n = 0;
+}
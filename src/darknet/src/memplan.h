@@ -0,0 +1,36 @@
+#ifndef MEMPLAN_H
+#define MEMPLAN_H
+
+#include "network.h"
+
+// Activation memory planning for forward-only networks on the CPU. Instead of
+// every layer owning its output for the life of the network, the outputs share
+// one arena: a tensor is alive from the layer that writes it to the last layer
+// that reads it (the next layer, routes through input_layers, shortcuts through
+// index), and tensors whose lifetimes do not overlap reuse the same bytes. In a
+// scheduled network (schedule.h) lifetimes are counted in waves.
+// Outputs read after forward_network() returns (yolo, region and detection
+// layers, and the network output) stay alive for good.
+// With batch 1 the inputs of a route are placed inside its output, so that
+// concatenation is done by the producers and the route copies nothing.
+// A [yolo] layer keeping the raw logits (layer.logits) reads them in place.
+
+// moves the layer outputs of an inference-only network (see parse_network_cfg_inference)
+// into a planned arena; returns 0, leaving net untouched, for networks that train
+// or contain layers whose outputs are not plain per-layer buffers. Callers opt in:
+// the other outputs are overwritten during a pass, so code reading intermediate
+// layers after forward_network() keeps its own buffers by not planning
+int plan_network_memory(network *net);
+
+// gives every planned layer its own output buffer again and frees the arena
+void release_network_memory_plan(network *net);
+
+// an execution context of a planned network: a copy of its layers sharing all the
+// weights, with an arena and a workspace of its own, so that several threads can
+// run forward passes of one network at once. The context is resized on its own
+// (resize_network_batch) and must not outlive net; returns 0 for networks whose
+// outputs are not all in the arena or that run on the GPU
+int make_network_context(network *net, network *ctx);
+void free_network_context(network *ctx);
+
+#endif
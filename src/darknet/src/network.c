@@ -30,6 +30,10 @@
 #include "yolo_layer.h"
 #include "upsample_layer.h"
 #include "parser.h"
+#include "winograd.h"
+#include "dnpack.h"
+#include "memplan.h"
+#include "schedule.h"
 
 network *load_network_custom(char *cfg, char *weights, int clear, int batch)
 {
@@ -166,6 +170,12 @@ char *get_layer_string(LAYER_TYPE a)
             return "normalization";
         case BATCHNORM:
             return "batchnorm";
+        case YOLO:
+            return "yolo";
+        case UPSAMPLE:
+            return "upsample";
+        case REORG_OLD:
+            return "reorg_old";
         default:
             break;
     }
@@ -194,15 +204,30 @@ void forward_network(network net, network_state state)
 {
     state.workspace = net.workspace;
     int i;
+    int const profile = network_profile_active(net.profile);
+    double const frame_start = profile ? profile_time_now() : 0;
+    float *const input = state.input;
+    // independent layers run at once, except when every layer is timed on its own
+    if (net.schedule && !profile) {
+        forward_network_waves(net, state);
+        return;
+    }
     for(i = 0; i < net.n; ++i){
-        state.index = i;
-        layer l = net.layers[i];
+        int const j = net.schedule ? net.schedule[i] : i;
+        state.index = j;
+        state.input = j ? net.layers[j - 1].output : input;
+        layer l = net.layers[j];
         if(l.delta){
             scal_cpu(l.outputs * l.batch, 0, l.delta, 1);
         }
-        l.forward(l, state);
-        state.input = l.output;
+        if (profile) {
+            double const start = profile_time_now();
+            l.forward(l, state);
+            profile_layer(net.profile, l, j, start, profile_time_now());
+        }
+        else l.forward(l, state);
     }
+    if (profile) profile_frame(net.profile, frame_start, profile_time_now());
 }
 
 void update_network(network net)
@@ -381,6 +406,18 @@ void set_batch_network(network *net, int b)
     }
 }
 
+void resize_network_batch(network *net, int b)
+{
+    set_batch_network(net, b);
+    resize_network(net, net->w, net->h);
+#ifdef GPU
+    if (gpu_index >= 0) {
+        if (net->input_state_gpu) cuda_free(net->input_state_gpu);
+        net->input_state_gpu = cuda_make_array(0, get_network_input_size(*net) * net->batch);
+    }
+#endif
+}
+
 int resize_network(network *net, int w, int h)
 {
 #ifdef GPU
@@ -396,6 +433,9 @@ int resize_network(network *net, int w, int h)
     }
 #endif
     int i;
+    // the layers resize their own outputs, the plan is made again for the new sizes
+    const int planned = net->activations != 0;
+    release_network_memory_plan(net);
     //if(w == net->w && h == net->h) return 0;
     net->w = w;
     net->h = h;
@@ -448,12 +488,13 @@ int resize_network(network *net, int w, int h)
         printf(" CUDA allocate done! \n");
     }else {
         free(net->workspace);
-        net->workspace = calloc(1, workspace_size);
+        net->workspace = make_network_workspace(net, workspace_size);
     }
 #else
     free(net->workspace);
-    net->workspace = calloc(1, workspace_size);
+    net->workspace = make_network_workspace(net, workspace_size);
 #endif
+    if (planned) plan_network_memory(net);
     //fprintf(stderr, " Done!\n");
     return 0;
 }
@@ -581,6 +622,31 @@ detection *make_network_boxes(network *net, float thresh, int *num)
     return dets;
 }
 
+int num_detections_batch(network *net, float thresh, int batch)
+{
+    int i;
+    int s = 0;
+    for (i = 0; i < net->n; ++i) {
+        layer l = net->layers[i];
+        if (l.type == YOLO) {
+            s += yolo_num_detections_batch(l, thresh, batch);
+        }
+    }
+    return s;
+}
+
+detection *make_network_boxes_batch(network *net, float thresh, int *num, int batch)
+{
+    layer l = net->layers[net->n - 1];
+    int i;
+    int nboxes = num_detections_batch(net, thresh, batch);
+    if (num) *num = nboxes;
+    detection *dets = calloc(nboxes, sizeof(detection));
+    for (i = 0; i < nboxes; ++i) {
+        dets[i].prob = calloc(l.classes, sizeof(float));
+    }
+    return dets;
+}
 
 void custom_get_region_detections(layer l, int w, int h, int net_w, int net_h, float thresh, int *map, float hier, int relative, detection *dets, int letter)
 {
@@ -612,7 +678,7 @@ void fill_network_boxes(network *net, int w, int h, float thresh, float hier, in
     for (j = 0; j < net->n; ++j) {
         layer l = net->layers[j];
         if (l.type == YOLO) {
-            int count = get_yolo_detections(l, w, h, net->w, net->h, thresh, map, relative, dets, letter);
+            int count = get_yolo_detections(&net->layers[j], w, h, net->w, net->h, thresh, map, relative, dets, letter);
             dets += count;
             if (prev_classes < 0) prev_classes = l.classes;
             else if (prev_classes != l.classes) {
@@ -639,6 +705,61 @@ detection *get_network_boxes(network *net, int w, int h, float thresh, float hie
     return dets;
 }
 
+// Only [yolo] output layers keep a separate result per batch entry
+void fill_network_boxes_batch(network *net, int w, int h, float thresh, float hier, int *map, int relative, detection *dets, int letter, int batch)
+{
+    int j;
+    for (j = 0; j < net->n; ++j) {
+        layer l = net->layers[j];
+        if (l.type == YOLO) {
+            int count = get_yolo_detections_batch(l, w, h, net->w, net->h, thresh, map, relative, dets, letter, batch);
+            dets += count;
+        }
+    }
+}
+
+detection *get_network_boxes_batch(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num, int letter, int batch)
+{
+    detection *dets = make_network_boxes_batch(net, thresh, num, batch);
+    fill_network_boxes_batch(net, w, h, thresh, hier, map, relative, dets, letter, batch);
+    return dets;
+}
+
+void keep_network_logits(network *net)
+{
+#ifndef GPU
+    int i;
+    for (i = 0; i < net->n; ++i) {
+        if (net->layers[i].type == YOLO) net->layers[i].logits = 1;
+    }
+#endif
+}
+
+int max_network_candidates(network *net, int top_k)
+{
+    int i;
+    int s = 0;
+    for (i = 0; i < net->n; ++i) {
+        layer l = net->layers[i];
+        if (l.type == YOLO) s += yolo_max_candidates(l, top_k);
+        if (l.type == DETECTION || l.type == REGION) return -1;
+    }
+    return s;
+}
+
+int get_network_candidates(network *net, int w, int h, float thresh, int relative, int letter, int batch, int top_k, box_candidate *cands)
+{
+    int i;
+    int count = 0, box_id = 0;
+    for (i = 0; i < net->n; ++i) {
+        layer l = net->layers[i];
+        if (l.type == YOLO) {
+            count += get_yolo_candidates(l, w, h, net->w, net->h, thresh, relative, letter, batch, top_k, cands + count, &box_id);
+        }
+    }
+    return count;
+}
+
 void free_detections(detection *dets, int n)
 {
     int i;
@@ -789,6 +910,10 @@ void free_network(network net)
     free(net.scales);
     free(net.steps);
     free(net.seen);
+    free_network_profile(net.profile);
+    unmap_dnpack(&net);
+    free(net.activations);
+    free_network_schedule(&net);
 
 #ifdef GPU
     if (gpu_index >= 0) cuda_free(net.workspace);
@@ -841,6 +966,7 @@ void fuse_conv_batchnorm(network net)
                     push_convolutional_layer(*l);
                 }
 #endif
+                free_convolutional_batchnorm(l);
             }
         }
         else {
@@ -875,4 +1001,27 @@ void calculate_binary_weights(network net)
     }
     //printf("\n calculate_binary_weights Done! \n");
 
-}
\ No newline at end of file
+}
+
+// selects Winograd convolution for eligible layers, precomputes their
+// transformed weights and shrinks the workspace; call after fuse_conv_batchnorm()
+void calculate_winograd_weights(network *net)
+{
+#ifdef GPU
+    if (gpu_index >= 0) return;
+#endif
+    size_t workspace_size = 0;
+    int j;
+    for (j = 0; j < net->n; ++j) {
+        layer *l = &net->layers[j];
+
+        if (l->type == CONVOLUTIONAL) {
+            l->winograd = winograd_tile_size(*l);
+            if (l->winograd) winograd_transform_weights(l);
+            l->workspace_size = get_workspace_size(*l);
+        }
+        if (l->workspace_size > workspace_size) workspace_size = l->workspace_size;
+    }
+    free(net->workspace);
+    net->workspace = make_network_workspace(net, workspace_size);
+}
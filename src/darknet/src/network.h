@@ -12,6 +12,7 @@ extern "C" {
 #include "image.h"
 #include "data.h"
 #include "tree.h"
+#include "profiler.h"
 
 typedef enum {
     CONSTANT, STEP, EXP, POLY, STEPS, SIG, RANDOM
@@ -62,6 +63,17 @@ typedef struct network{
 
     int gpu_index;
     tree *hierarchy;
+    network_profile *profile;   // per-layer timing of forward passes, 0 - disabled
+    void *weights_map;          // mapped .dnpack file the layer weights point into, see dnpack.h
+    size_t weights_map_size;
+    void *activations;          // arena the layer outputs are planned into, see memplan.h
+    size_t activations_size;
+    int *schedule;              // the layers in the order they run, in waves of independent layers (see schedule.h)
+    int *waves;                 // wave w runs schedule[waves[w]] up to schedule[waves[w + 1]]
+    int num_waves;
+    int *wave;                  // the wave every layer runs in
+    int lanes;                  // layers of the widest wave, each with a workspace of its own
+    size_t workspace_size;      // bytes of the workspace of one lane
 
     #ifdef GPU
     float *input_state_gpu;
@@ -134,12 +146,24 @@ void print_network(network net);
 void visualize_network(network net);
 int resize_network(network *net, int w, int h);
 void set_batch_network(network *net, int b);
+void resize_network_batch(network *net, int b);
 int get_network_input_size(network net);
 float get_network_cost(network net);
 YOLODLL_API layer* get_network_layer(network* net, int i);
 YOLODLL_API detection *get_network_boxes(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num, int letter);
 YOLODLL_API detection *make_network_boxes(network *net, float thresh, int *num);
+YOLODLL_API detection *get_network_boxes_batch(network *net, int w, int h, float thresh, float hier, int *map, int relative, int *num, int letter, int batch);
+YOLODLL_API detection *make_network_boxes_batch(network *net, float thresh, int *num, int batch);
 YOLODLL_API void free_detections(detection *dets, int n);
+// [yolo] layers of an inference network keep the raw logits in their output and leave the
+// sigmoid to the decoders, which activate only the cells they read (CPU only); callers of
+// network_predict() and of the layer outputs get probabilities unless they opt in
+YOLODLL_API void keep_network_logits(network *net);
+// the boxes of the [yolo] layers decoded in one pass into cands, with up to top_k of their
+// classes above thresh each; cands holds max_network_candidates(), which is -1 for networks
+// with region or detection layers
+YOLODLL_API int max_network_candidates(network *net, int top_k);
+YOLODLL_API int get_network_candidates(network *net, int w, int h, float thresh, int relative, int letter, int batch, int top_k, box_candidate *cands);
 YOLODLL_API void reset_rnn(network *net);
 YOLODLL_API network *load_network_custom(char *cfg, char *weights, int clear, int batch);
 YOLODLL_API network *load_network(char *cfg, char *weights, int clear);
@@ -154,6 +178,7 @@ int get_network_nuisance(network net);
 int get_network_background(network net);
 YOLODLL_API void fuse_conv_batchnorm(network net);
 YOLODLL_API void calculate_binary_weights(network net);
+YOLODLL_API void calculate_winograd_weights(network *net);
 
 #ifdef __cplusplus
 }
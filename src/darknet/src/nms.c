@@ -0,0 +1,323 @@
+#include "nms.h"
+#include "gemm.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_WIN64)
+#define NMS_AVX
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define NMS_TARGET_AVX __attribute__((target("avx")))
+#else
+#define NMS_TARGET_AVX
+#endif
+#endif
+
+// candidates of one class from which suppression looks up neighbours in a grid
+// instead of testing every later candidate
+#define NMS_GRID_MIN 2048
+// cells per side: with fewer the scalar lookups test no fewer pairs than suppress_avx() does 8 at a time
+#define NMS_GRID_MIN_CELLS 16
+#define NMS_GRID_MAX_CELLS 64
+
+typedef struct nms_candidate {
+    float prob;
+    int index;
+    int class_id;
+} nms_candidate;
+
+// the candidates of one class in descending probability, corners and areas computed
+// with the same operations as box_iou() so that the results match it exactly
+typedef struct nms_boxes {
+    float *x1, *y1, *x2, *y2, *area;
+    char *keep;
+} nms_boxes;
+
+static int compare_candidate_prob(const void *pa, const void *pb)
+{
+    const nms_candidate *a = pa, *b = pb;
+    if (a->prob != b->prob) return (a->prob < b->prob) ? 1 : -1;
+    return a->index - b->index;
+}
+
+static float nms_iou(const nms_boxes *b, int i, int j)
+{
+    float w = (b->x2[i] < b->x2[j] ? b->x2[i] : b->x2[j]) - (b->x1[i] > b->x1[j] ? b->x1[i] : b->x1[j]);
+    float h = (b->y2[i] < b->y2[j] ? b->y2[i] : b->y2[j]) - (b->y1[i] > b->y1[j] ? b->y1[i] : b->y1[j]);
+    float intersection = (w < 0 || h < 0) ? 0 : w*h;
+    return intersection / (b->area[i] + b->area[j] - intersection);
+}
+
+// suppresses the candidates after i that overlap it, from index j on
+static void suppress_scalar(nms_boxes *b, int i, int j, int n, float thresh)
+{
+    for (; j < n; ++j) {
+        if (nms_iou(b, i, j) > thresh) b->keep[j] = 0;
+    }
+}
+
+#ifdef NMS_AVX
+// 8 candidates at a time, returns the first one left for suppress_scalar()
+NMS_TARGET_AVX static int suppress_avx(nms_boxes *b, int i, int n, float thresh)
+{
+    const __m256 x1 = _mm256_set1_ps(b->x1[i]), y1 = _mm256_set1_ps(b->y1[i]);
+    const __m256 x2 = _mm256_set1_ps(b->x2[i]), y2 = _mm256_set1_ps(b->y2[i]);
+    const __m256 area = _mm256_set1_ps(b->area[i]);
+    const __m256 t = _mm256_set1_ps(thresh), zero = _mm256_setzero_ps();
+    int j;
+    for (j = i + 1; j + 8 <= n; j += 8) {
+        __m256 w = _mm256_sub_ps(_mm256_min_ps(x2, _mm256_loadu_ps(b->x2 + j)), _mm256_max_ps(x1, _mm256_loadu_ps(b->x1 + j)));
+        __m256 h = _mm256_sub_ps(_mm256_min_ps(y2, _mm256_loadu_ps(b->y2 + j)), _mm256_max_ps(y1, _mm256_loadu_ps(b->y1 + j)));
+        __m256 intersection = _mm256_mul_ps(_mm256_max_ps(w, zero), _mm256_max_ps(h, zero));
+        __m256 u = _mm256_sub_ps(_mm256_add_ps(area, _mm256_loadu_ps(b->area + j)), intersection);
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_div_ps(intersection, u), t, _CMP_GT_OQ));
+        while (mask) {
+            int k = 0;
+            while (!(mask & (1 << k))) ++k;
+            b->keep[j + k] = 0;
+            mask &= mask - 1;
+        }
+    }
+    return j;
+}
+#endif
+
+static void suppress_all(nms_boxes *b, int n, float thresh)
+{
+    int i;
+#ifdef NMS_AVX
+    const int avx = is_avx();
+#endif
+    for (i = 0; i < n; ++i) {
+        int j = i + 1;
+        if (!b->keep[i]) continue;
+#ifdef NMS_AVX
+        if (avx) j = suppress_avx(b, i, n, thresh);
+#endif
+        suppress_scalar(b, i, j, n, thresh);
+    }
+}
+
+// only candidates sharing a grid cell can overlap: every candidate is listed in
+// the cells it covers, in descending probability
+static void suppress_grid(nms_boxes *b, int n, float thresh)
+{
+    float min_x = b->x1[0], min_y = b->y1[0], max_x = b->x2[0], max_y = b->y2[0];
+    float cell_w, cell_h, fit, mean_w = 0, mean_h = 0;
+    int cells, i, x, y;
+    int *range, *start, *fill, *entries;
+
+    for (i = 1; i < n; ++i) {
+        if (b->x1[i] < min_x) min_x = b->x1[i];
+        if (b->y1[i] < min_y) min_y = b->y1[i];
+        if (b->x2[i] > max_x) max_x = b->x2[i];
+        if (b->y2[i] > max_y) max_y = b->y2[i];
+    }
+    // cells about twice the mean box, so that a box is listed in a few of them
+    for (i = 0; i < n; ++i) {
+        mean_w += b->x2[i] - b->x1[i];
+        mean_h += b->y2[i] - b->y1[i];
+    }
+    mean_w /= n;
+    mean_h /= n;
+    fit = fminf((max_x - min_x) / (2 * mean_w), (max_y - min_y) / (2 * mean_h));
+    // boxes as large as the spread gain nothing from a grid
+    if (!(fit >= NMS_GRID_MIN_CELLS)) {
+        suppress_all(b, n, thresh);
+        return;
+    }
+    cells = (fit < NMS_GRID_MAX_CELLS) ? (int)fit : NMS_GRID_MAX_CELLS;
+    cell_w = (max_x - min_x) / cells;
+    cell_h = (max_y - min_y) / cells;
+
+    range = calloc((size_t)n * 4, sizeof(int));
+    start = calloc((size_t)cells*cells + 1, sizeof(int));
+    fill = calloc((size_t)cells*cells, sizeof(int));
+    for (i = 0; i < n; ++i) {
+        int *r = range + i * 4;
+        r[0] = (int)((b->x1[i] - min_x) / cell_w);
+        r[1] = (int)((b->y1[i] - min_y) / cell_h);
+        r[2] = (int)((b->x2[i] - min_x) / cell_w);
+        r[3] = (int)((b->y2[i] - min_y) / cell_h);
+        if (r[0] >= cells) r[0] = cells - 1;
+        if (r[1] >= cells) r[1] = cells - 1;
+        if (r[2] >= cells) r[2] = cells - 1;
+        if (r[3] >= cells) r[3] = cells - 1;
+        for (y = r[1]; y <= r[3]; ++y) {
+            for (x = r[0]; x <= r[2]; ++x) ++start[y*cells + x + 1];
+        }
+    }
+    for (i = 0; i < cells*cells; ++i) start[i + 1] += start[i];
+    entries = calloc(start[cells*cells] + 1, sizeof(int));
+    for (i = 0; i < n; ++i) {
+        const int *r = range + i * 4;
+        for (y = r[1]; y <= r[3]; ++y) {
+            for (x = r[0]; x <= r[2]; ++x) {
+                const int c = y*cells + x;
+                entries[start[c] + fill[c]++] = i;
+            }
+        }
+    }
+
+    for (i = 0; i < n; ++i) {
+        const int *r = range + i * 4;
+        if (!b->keep[i]) continue;
+        for (y = r[1]; y <= r[3]; ++y) {
+            for (x = r[0]; x <= r[2]; ++x) {
+                const int c = y*cells + x;
+                int lo = start[c], hi = start[c + 1], e;
+                // the entries after i
+                while (lo < hi) {
+                    const int mid = (lo + hi) / 2;
+                    if (entries[mid] <= i) lo = mid + 1;
+                    else hi = mid;
+                }
+                for (e = lo; e < start[c + 1]; ++e) {
+                    const int j = entries[e];
+                    if (b->keep[j] && nms_iou(b, i, j) > thresh) b->keep[j] = 0;
+                }
+            }
+        }
+    }
+    free(entries);
+    free(fill);
+    free(start);
+    free(range);
+}
+
+static void reserve_nms_arena(nms_arena *a, int count, int classes)
+{
+    if (count > a->candidates_size) {
+        free(a->candidates);
+        free(a->sorted);
+        a->candidates = calloc(count, sizeof(nms_candidate));
+        a->sorted = calloc(count, sizeof(nms_candidate));
+        a->candidates_size = count;
+    }
+    if (classes + 1 > a->classes_size) {
+        free(a->bucket_start);
+        a->bucket_start = calloc(classes + 1, sizeof(int));
+        a->classes_size = classes + 1;
+    }
+}
+
+// sorts the count candidates of a once, buckets them by class keeping that order and
+// suppresses every bucket on its own. The box of a candidate is the one at byte offset
+// index*stride of boxes. Returns the candidates by class, the suppressed ones with prob 0.
+static nms_candidate *suppress_candidates(nms_arena *a, int count, int classes, const char *boxes, size_t stride, float thresh)
+{
+    nms_candidate *sorted = a->sorted;
+    int *bucket_start = a->bucket_start;
+    int i, k, max_bucket = 0;
+    nms_boxes b;
+
+    memset(bucket_start, 0, (classes + 1)*sizeof(int));
+    for (i = 0; i < count; ++i) ++bucket_start[a->candidates[i].class_id + 1];
+    qsort(a->candidates, count, sizeof(nms_candidate), compare_candidate_prob);
+    for (k = 0; k < classes; ++k) {
+        if (bucket_start[k + 1] > max_bucket) max_bucket = bucket_start[k + 1];
+        bucket_start[k + 1] += bucket_start[k];
+    }
+    for (i = 0; i < count; ++i) {
+        sorted[bucket_start[a->candidates[i].class_id]++] = a->candidates[i];
+    }
+    // the scatter left every start at the end of its bucket
+    for (k = classes; k > 0; --k) bucket_start[k] = bucket_start[k - 1];
+    bucket_start[0] = 0;
+
+    if (max_bucket > a->boxes_size) {
+        free(a->soa);
+        free(a->keep);
+        a->soa = calloc((size_t)max_bucket * 5, sizeof(float));
+        a->keep = calloc(max_bucket, 1);
+        a->boxes_size = max_bucket;
+    }
+    b.x1 = a->soa;
+    b.y1 = a->soa + a->boxes_size;
+    b.x2 = a->soa + a->boxes_size * 2;
+    b.y2 = a->soa + a->boxes_size * 3;
+    b.area = a->soa + a->boxes_size * 4;
+    b.keep = a->keep;
+    for (k = 0; k < classes; ++k) {
+        nms_candidate *c = sorted + bucket_start[k];
+        const int n = bucket_start[k + 1] - bucket_start[k];
+        if (n < 2) continue;
+        for (i = 0; i < n; ++i) {
+            box r = *(const box *)(boxes + (size_t)c[i].index*stride);
+            b.x1[i] = r.x - r.w / 2;
+            b.y1[i] = r.y - r.h / 2;
+            b.x2[i] = r.x + r.w / 2;
+            b.y2[i] = r.y + r.h / 2;
+            b.area[i] = r.w*r.h;
+            b.keep[i] = 1;
+        }
+        if (n >= NMS_GRID_MIN) suppress_grid(&b, n, thresh);
+        else suppress_all(&b, n, thresh);
+        for (i = 0; i < n; ++i) {
+            if (!b.keep[i]) c[i].prob = 0;
+        }
+    }
+    return sorted;
+}
+
+// Same result as sorting all detections by the probability of every class in turn
+// and suppressing later overlapping ones: every nonzero class probability is one
+// candidate for suppress_candidates()
+void do_nms_sort(detection *dets, int total, int classes, float thresh)
+{
+    nms_arena a = { 0 };
+    nms_candidate *sorted;
+    int i, k, count = 0;
+
+    for (i = 0; i < total; ++i) {
+        if (dets[i].objectness == 0) continue;
+        for (k = 0; k < classes; ++k) count += dets[i].prob[k] != 0;
+    }
+    if (count < 2) return;
+
+    reserve_nms_arena(&a, count, classes);
+    count = 0;
+    for (i = 0; i < total; ++i) {
+        if (dets[i].objectness == 0) continue;
+        for (k = 0; k < classes; ++k) {
+            if (dets[i].prob[k] == 0) continue;
+            a.candidates[count].prob = dets[i].prob[k];
+            a.candidates[count].index = i;
+            a.candidates[count].class_id = k;
+            ++count;
+        }
+    }
+    sorted = suppress_candidates(&a, count, classes, (const char *)&dets[0].bbox, sizeof(detection), thresh);
+    for (i = 0; i < count; ++i) {
+        if (sorted[i].prob == 0) dets[sorted[i].index].prob[sorted[i].class_id] = 0;
+    }
+    free_nms_arena(&a);
+}
+
+void do_nms_candidates(box_candidate *cands, int count, int classes, float thresh, nms_arena *arena)
+{
+    nms_candidate *sorted;
+    int i;
+    if (count < 2) return;
+    reserve_nms_arena(arena, count, classes);
+    for (i = 0; i < count; ++i) {
+        arena->candidates[i].prob = cands[i].prob;
+        arena->candidates[i].index = i;
+        arena->candidates[i].class_id = cands[i].class_id;
+    }
+    sorted = suppress_candidates(arena, count, classes, (const char *)&cands[0].bbox, sizeof(box_candidate), thresh);
+    for (i = 0; i < count; ++i) {
+        if (sorted[i].prob == 0) cands[sorted[i].index].prob = 0;
+    }
+}
+
+void free_nms_arena(nms_arena *arena)
+{
+    free(arena->candidates);
+    free(arena->sorted);
+    free(arena->bucket_start);
+    free(arena->soa);
+    free(arena->keep);
+    memset(arena, 0, sizeof(nms_arena));
+}
@@ -0,0 +1,28 @@
+#ifndef NMS_H
+#define NMS_H
+
+#include "box.h"
+
+// Non-maximum suppression over candidates of one class each: they are sorted once
+// by probability, bucketed by class keeping that order, and every bucket is
+// suppressed on its own (see do_nms_sort).
+
+struct nms_candidate;
+
+// scratch of the suppression, grown on demand and kept between calls so that
+// a caller running it every frame allocates nothing once it is large enough
+typedef struct nms_arena {
+    struct nms_candidate *candidates, *sorted;
+    int candidates_size;
+    int *bucket_start;
+    int classes_size;
+    float *soa;
+    char *keep;
+    int boxes_size;
+} nms_arena;
+
+// sets the probability of every suppressed candidate to 0
+YOLODLL_API void do_nms_candidates(box_candidate *cands, int count, int classes, float thresh, nms_arena *arena);
+YOLODLL_API void free_nms_arena(nms_arena *arena);
+
+#endif
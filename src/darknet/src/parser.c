@@ -27,6 +27,7 @@
 #include "reorg_old_layer.h"
 #include "rnn_layer.h"
 #include "route_layer.h"
+#include "schedule.h"
 #include "shortcut_layer.h"
 #include "softmax_layer.h"
 #include "utils.h"
@@ -118,6 +119,7 @@ typedef struct size_params{
     int c;
     int index;
     int time_steps;
+    int train;      // 0 - inference only, layers skip their gradient and optimizer buffers
     network net;
 } size_params;
 
@@ -165,7 +167,7 @@ convolutional_layer parse_convolutional(list *options, size_params params)
     int xnor = option_find_int_quiet(options, "xnor", 0);
     int use_bin_output = option_find_int_quiet(options, "bin_output", 0);
 
-    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,size,stride,padding,activation, batch_normalize, binary, xnor, params.net.adam, use_bin_output);
+    convolutional_layer layer = make_convolutional_layer(batch,h,w,c,n,size,stride,padding,activation, batch_normalize, binary, xnor, params.net.adam, use_bin_output, params.train);
     layer.flipped = option_find_int_quiet(options, "flipped", 0);
     layer.dot = option_find_float_quiet(options, "dot", 0);
 
@@ -226,7 +228,7 @@ connected_layer parse_connected(list *options, size_params params)
     ACTIVATION activation = get_activation(activation_s);
     int batch_normalize = option_find_int_quiet(options, "batch_normalize", 0);
 
-    connected_layer layer = make_connected_layer(params.batch, params.inputs, output, activation, batch_normalize);
+    connected_layer layer = make_connected_layer(params.batch, params.inputs, output, activation, batch_normalize, params.train);
 
     return layer;
 }
@@ -276,7 +278,7 @@ layer parse_yolo(list *options, size_params params)
     char *a = option_find_str(options, "mask", 0);
     int *mask = parse_yolo_mask(a, &num);
     int max_boxes = option_find_int_quiet(options, "max", 90);
-    layer l = make_yolo_layer(params.batch, params.w, params.h, num, total, mask, classes, max_boxes);
+    layer l = make_yolo_layer(params.batch, params.w, params.h, num, total, mask, classes, max_boxes, params.train);
     if (l.outputs != params.inputs) {
         printf("Error: l.outputs == params.inputs \n");
         printf("filters= in the [convolutional]-layer doesn't correspond to classes= or mask= in [yolo]-layer \n");
@@ -319,7 +321,7 @@ layer parse_region(list *options, size_params params)
     int num = option_find_int(options, "num", 1);
     int max_boxes = option_find_int_quiet(options, "max", 90);
 
-    layer l = make_region_layer(params.batch, params.w, params.h, num, classes, coords, max_boxes);
+    layer l = make_region_layer(params.batch, params.w, params.h, num, classes, coords, max_boxes, params.train);
     if (l.outputs != params.inputs) {
         printf("Error: l.outputs == params.inputs \n");
         printf("filters= in the [convolutional]-layer doesn't correspond to classes= or num= in [region]-layer \n");
@@ -439,7 +441,7 @@ layer parse_reorg(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before reorg layer must output image.");
 
-    layer layer = make_reorg_layer(batch,w,h,c,stride,reverse);
+    layer layer = make_reorg_layer(batch,w,h,c,stride,reverse,params.train);
     return layer;
 }
 
@@ -456,7 +458,7 @@ layer parse_reorg_old(list *options, size_params params)
     batch = params.batch;
     if (!(h && w && c)) error("Layer before reorg layer must output image.");
 
-    layer layer = make_reorg_old_layer(batch, w, h, c, stride, reverse);
+    layer layer = make_reorg_old_layer(batch, w, h, c, stride, reverse, params.train);
     return layer;
 }
 
@@ -473,7 +475,7 @@ maxpool_layer parse_maxpool(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before maxpool layer must output image.");
 
-    maxpool_layer layer = make_maxpool_layer(batch,h,w,c,size,stride,padding);
+    maxpool_layer layer = make_maxpool_layer(batch,h,w,c,size,stride,padding,params.train);
     return layer;
 }
 
@@ -486,7 +488,7 @@ avgpool_layer parse_avgpool(list *options, size_params params)
     batch=params.batch;
     if(!(h && w && c)) error("Layer before avgpool layer must output image.");
 
-    avgpool_layer layer = make_avgpool_layer(batch,w,h,c);
+    avgpool_layer layer = make_avgpool_layer(batch,w,h,c,params.train);
     return layer;
 }
 
@@ -525,7 +527,7 @@ layer parse_shortcut(list *options, size_params params, network net)
     int batch = params.batch;
     layer from = net.layers[index];
 
-    layer s = make_shortcut_layer(batch, index, params.w, params.h, params.c, from.out_w, from.out_h, from.out_c);
+    layer s = make_shortcut_layer(batch, index, params.w, params.h, params.c, from.out_w, from.out_h, from.out_c, params.train);
 
     char *activation_s = option_find_str(options, "activation", "linear");
     ACTIVATION activation = get_activation(activation_s);
@@ -555,7 +557,7 @@ layer parse_upsample(list *options, size_params params, network net)
 {
 
     int stride = option_find_int(options, "stride", 2);
-    layer l = make_upsample_layer(params.batch, params.w, params.h, params.c, stride);
+    layer l = make_upsample_layer(params.batch, params.w, params.h, params.c, stride, params.train);
     l.scale = option_find_float_quiet(options, "scale", 1);
     return l;
 }
@@ -582,7 +584,7 @@ route_layer parse_route(list *options, size_params params, network net)
     }
     int batch = params.batch;
 
-    route_layer layer = make_route_layer(batch, n, layers, sizes);
+    route_layer layer = make_route_layer(batch, n, layers, sizes, params.train);
 
     convolutional_layer first = net.layers[layers[0]];
     layer.out_w = first.out_w;
@@ -706,7 +708,7 @@ network parse_network_cfg(char *filename)
     return parse_network_cfg_custom(filename, 0);
 }
 
-network parse_network_cfg_custom(char *filename, int batch)
+static network parse_network_cfg_mode(char *filename, int batch, int train)
 {
     list *sections = read_cfg(filename);
     node *n = sections->front;
@@ -725,6 +727,7 @@ network parse_network_cfg_custom(char *filename, int batch)
     params.c = net.c;
     params.inputs = net.inputs;
     if (batch > 0) net.batch = batch;
+    params.train = train;
     params.batch = net.batch;
     params.time_steps = net.time_steps;
     params.net = net;
@@ -820,6 +823,7 @@ network parse_network_cfg_custom(char *filename, int batch)
     net.outputs = get_network_output_size(net);
     net.output = get_network_output(net);
     printf("Total BFLOPS %5.3f \n", bflops);
+    if (!params.train) build_network_schedule(&net);
     if(workspace_size){
         //printf("%ld\n", workspace_size);
 #ifdef GPU
@@ -828,10 +832,10 @@ network parse_network_cfg_custom(char *filename, int batch)
             int size = get_network_input_size(net) * net.batch;
             net.input_state_gpu = cuda_make_array(0, size);
         }else {
-            net.workspace = calloc(1, workspace_size);
+            net.workspace = make_network_workspace(&net, workspace_size);
         }
 #else
-        net.workspace = calloc(1, workspace_size);
+        net.workspace = make_network_workspace(&net, workspace_size);
 #endif
     }
     LAYER_TYPE lt = net.layers[net.n - 1].type;
@@ -842,6 +846,16 @@ network parse_network_cfg_custom(char *filename, int batch)
     return net;
 }
 
+network parse_network_cfg_custom(char *filename, int batch)
+{
+    return parse_network_cfg_mode(filename, batch, 1);
+}
+
+network parse_network_cfg_inference(char *filename, int batch)
+{
+    return parse_network_cfg_mode(filename, batch, 0);
+}
+
 
 
 list *read_cfg(char *filename)
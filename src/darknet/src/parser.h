@@ -3,7 +3,11 @@
 #include "network.h"
 
 network parse_network_cfg(char *filename);
+// batch > 0 overrides the cfg batch
 network parse_network_cfg_custom(char *filename, int batch);
+// an inference-only network: the layers allocate no deltas, weight updates, batch statistics
+// or adam state, so it can only run forward
+network parse_network_cfg_inference(char *filename, int batch);
 void save_network(network net, char *filename);
 void save_weights(network net, char *filename);
 void save_weights_upto(network net, char *filename, int cutoff);
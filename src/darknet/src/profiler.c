@@ -0,0 +1,199 @@
+#include "profiler.h"
+#include "network.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// trace events kept when aggregating without a frame limit
+#define PROFILE_TRACE_FRAMES 256
+
+double profile_time_now()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / freq.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+network_profile *make_network_profile(int n, int frames)
+{
+    network_profile *p = calloc(1, sizeof(network_profile));
+    p->n = n;
+    p->layers = calloc(n, sizeof(layer_profile));
+    p->max_frames = frames;
+    p->max_events = ((frames > 0) ? frames : PROFILE_TRACE_FRAMES) * (n + 1);
+    p->events = calloc(p->max_events, sizeof(profile_event));
+    reset_network_profile(p);
+    return p;
+}
+
+void enable_network_profile(network *net, int frames)
+{
+    free_network_profile(net->profile);
+    net->profile = make_network_profile(net->n, frames);
+}
+
+void disable_network_profile(network *net)
+{
+    free_network_profile(net->profile);
+    net->profile = 0;
+}
+
+void reset_network_profile(network_profile *p)
+{
+    int i;
+    if (!p) return;
+    for (i = 0; i < p->n; ++i) {
+        layer_profile *lp = &p->layers[i];
+        lp->total_time = 0;
+        lp->min_time = DBL_MAX;
+        lp->max_time = 0;
+    }
+    p->frames = 0;
+    p->total_time = 0;
+    p->num_events = 0;
+    p->origin = profile_time_now();
+}
+
+void free_network_profile(network_profile *p)
+{
+    if (!p) return;
+    free(p->layers);
+    free(p->events);
+    free(p);
+}
+
+int network_profile_active(network_profile *p)
+{
+    return p && (p->max_frames == 0 || p->frames < p->max_frames);
+}
+
+static void record_event(network_profile *p, int index, double start, double end)
+{
+    if (p->num_events >= p->max_events) return;
+    p->events[p->num_events].layer = index;
+    p->events[p->num_events].start = start - p->origin;
+    p->events[p->num_events].duration = end - start;
+    ++p->num_events;
+}
+
+void profile_layer(network_profile *p, layer l, int index, double start, double end)
+{
+    layer_profile *lp = &p->layers[index];
+    double t = end - start;
+    lp->total_time += t;
+    if (t < lp->min_time) lp->min_time = t;
+    if (t > lp->max_time) lp->max_time = t;
+    lp->bflops = l.bflops * l.batch;
+    lp->bytes = estimate_layer_bytes(l);
+    record_event(p, index, start, end);
+}
+
+void profile_frame(network_profile *p, double start, double end)
+{
+    p->total_time += end - start;
+    ++p->frames;
+    record_event(p, -1, start, end);
+}
+
+void merge_network_profile(network_profile *dst, const network_profile *src)
+{
+    int i;
+    if (!network_profile_active(dst) || !src->frames || src->n != dst->n) return;
+    for (i = 0; i < dst->n; ++i) {
+        layer_profile *d = &dst->layers[i];
+        const layer_profile *s = &src->layers[i];
+        if (s->min_time == DBL_MAX) continue;
+        d->total_time += s->total_time;
+        if (s->min_time < d->min_time) d->min_time = s->min_time;
+        if (s->max_time > d->max_time) d->max_time = s->max_time;
+        d->bflops = s->bflops;
+        d->bytes = s->bytes;
+    }
+    dst->frames += src->frames;
+    dst->total_time += src->total_time;
+    for (i = 0; i < src->num_events && dst->num_events < dst->max_events; ++i) {
+        profile_event e = src->events[i];
+        e.start += src->origin - dst->origin;
+        dst->events[dst->num_events++] = e;
+    }
+}
+
+// input and output activations plus the weights, each touched once: a lower bound,
+// im2col copies and cache misses come on top of it
+double estimate_layer_bytes(layer l)
+{
+    double activations = (double)l.batch * (l.inputs + l.outputs) * sizeof(float);
+    double weights = 0;
+    if (l.type == CONVOLUTIONAL) {
+        double n = (double)l.n * l.c * l.size * l.size;
+        weights = (l.int8 ? n : n * sizeof(float)) + l.n * sizeof(float);
+    }
+    else if (l.type == CONNECTED) {
+        weights = ((double)l.inputs * l.outputs + l.outputs) * sizeof(float);
+    }
+    // the second input of a shortcut is read as well
+    if (l.type == SHORTCUT) activations += (double)l.batch * l.outputs * sizeof(float);
+    return activations + weights;
+}
+
+void print_network_profile(network *net)
+{
+    network_profile *p = net->profile;
+    int i;
+    if (!p || !p->frames) return;
+    printf("\n layer  type            avg ms   min ms   max ms     BFLOPs  GFLOP/s     GB/s   time %%\n");
+    for (i = 0; i < p->n; ++i) {
+        layer_profile *lp = &p->layers[i];
+        double avg = lp->total_time / p->frames;
+        printf("%6d  %-13s %8.3f %8.3f %8.3f %10.3f %8.2f %8.2f %7.2f\n", i, get_layer_string(net->layers[i].type),
+            avg * 1000, lp->min_time * 1000, lp->max_time * 1000, lp->bflops,
+            avg > 0 ? lp->bflops / avg : 0, avg > 0 ? lp->bytes / avg / 1e9 : 0,
+            p->total_time > 0 ? 100 * lp->total_time / p->total_time : 0);
+    }
+    printf(" total %.3f ms per frame over %d frames\n", p->total_time * 1000 / p->frames, p->frames);
+}
+
+int dump_network_profile_trace(network *net, const char *filename)
+{
+    network_profile *p = net->profile;
+    FILE *fp;
+    int i;
+    if (!p) return 0;
+    fp = fopen(filename, "w");
+    if (!fp) return 0;
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (i = 0; i < p->num_events; ++i) {
+        profile_event e = p->events[i];
+        fprintf(fp, "%s", i ? ",\n" : "");
+        if (e.layer < 0) {
+            fprintf(fp, "{\"name\":\"forward\",\"cat\":\"network\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+                e.start * 1e6, e.duration * 1e6);
+        }
+        else {
+            layer l = net->layers[e.layer];
+            layer_profile *lp = &p->layers[e.layer];
+            fprintf(fp, "{\"name\":\"%d %s\",\"cat\":\"layer\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,"
+                "\"args\":{\"bflops\":%.6f,\"gflops_per_s\":%.3f,\"bytes\":%.0f,\"out\":\"%dx%dx%d\"}}",
+                e.layer, get_layer_string(l.type), e.start * 1e6, e.duration * 1e6,
+                lp->bflops, e.duration > 0 ? lp->bflops / e.duration : 0, lp->bytes, l.out_w, l.out_h, l.out_c);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    return 1;
+}
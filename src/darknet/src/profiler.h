@@ -0,0 +1,61 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "layer.h"
+#include <stddef.h>
+
+// Per-layer timing of forward passes on the CPU. A frame is one forward_network()
+// call, i.e. net.batch images. Profiling is off (and costs nothing) unless
+// net.profile is set with enable_network_profile().
+
+typedef struct layer_profile {
+    double total_time;      // seconds, summed over the profiled frames
+    double min_time;
+    double max_time;
+    double bflops;          // billions of operations per frame (l.bflops * batch)
+    double bytes;           // estimated bytes read and written per frame
+} layer_profile;
+
+typedef struct profile_event {
+    int layer;              // -1 for the whole frame
+    double start;           // seconds since the profile was enabled
+    double duration;
+} profile_event;
+
+typedef struct network_profile {
+    int n;
+    int max_frames;         // stop collecting after this many frames, 0 - never
+    int frames;
+    double total_time;
+    double origin;
+    layer_profile *layers;
+    // trace of the first max_events events, for dump_network_profile_trace()
+    int max_events;
+    int num_events;
+    profile_event *events;
+} network_profile;
+
+struct network;
+
+double profile_time_now();
+
+// frames - number of forward passes to aggregate, 0 - until disabled (the trace keeps the first 256)
+network_profile *make_network_profile(int n, int frames);
+void enable_network_profile(struct network *net, int frames);
+void disable_network_profile(struct network *net);
+void reset_network_profile(network_profile *p);
+void free_network_profile(network_profile *p);
+
+int network_profile_active(network_profile *p);
+void profile_layer(network_profile *p, layer l, int index, double start, double end);
+void profile_frame(network_profile *p, double start, double end);
+// adds the frames src recorded to dst while dst still collects, e.g. those of
+// execution contexts running the same network
+void merge_network_profile(network_profile *dst, const network_profile *src);
+
+double estimate_layer_bytes(layer l);
+void print_network_profile(struct network *net);
+// writes the recorded events in the Chrome trace event format (chrome://tracing, Perfetto)
+int dump_network_profile_trace(struct network *net, const char *filename);
+
+#endif
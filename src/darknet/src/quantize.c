@@ -0,0 +1,225 @@
+#include "quantize.h"
+#include "convolutional_layer.h"
+#include "activations.h"
+#include "gemm.h"
+#include "image.h"
+#include "utils.h"
+#include "threadpool.h"
+#include "schedule.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// 7-bit weights keep the pmaddubsw pair sums of the AVX2 kernel inside int16
+#define INT8_WEIGHT_MAX 63
+#define INT8_INPUT_MAX 127
+#define INT8_ZERO_POINT 128
+#define INT8_PANEL 16
+
+// the linear layers in front of the detection layers keep full precision
+static int int8_layer_eligible(layer l)
+{
+    return l.type == CONVOLUTIONAL && !l.xnor && !l.binary &&
+        !l.batch_normalize && l.activation != LINEAR;
+}
+
+void quantize_weights_int8(layer *l)
+{
+    const int k = l->size*l->size*l->c;
+    const int lda = (k + 3) / 4 * 4;
+    const int rows = (l->n + 3) / 4 * 4;
+    int f, i;
+
+    free(l->weights_int8);
+    free(l->weights_int8_scales);
+    free(l->weights_int8_offsets);
+    l->weights_int8 = calloc((size_t)rows*lda, sizeof(signed char));
+    l->weights_int8_scales = calloc(l->n, sizeof(float));
+    l->weights_int8_offsets = calloc(l->n, sizeof(int));
+
+    for (f = 0; f < l->n; ++f) {
+        const float *w = l->weights + (size_t)f*k;
+        float max = 0;
+        int sum = 0;
+        for (i = 0; i < k; ++i) if (fabsf(w[i]) > max) max = fabsf(w[i]);
+        const float scale = (max > 0) ? max / INT8_WEIGHT_MAX : 1;
+        for (i = 0; i < k; ++i) {
+            int q = (int)roundf(w[i] / scale);
+            if (q > INT8_WEIGHT_MAX) q = INT8_WEIGHT_MAX;
+            if (q < -INT8_WEIGHT_MAX) q = -INT8_WEIGHT_MAX;
+            l->weights_int8[(size_t)f*lda + i] = (signed char)q;
+            sum += q;
+        }
+        l->weights_int8_scales[f] = scale;
+        l->weights_int8_offsets[f] = sum * INT8_ZERO_POINT;
+    }
+}
+
+size_t get_int8_workspace_size(layer l)
+{
+    const int k4 = (l.size*l.size*l.c + 3) / 4;
+    const int n = (l.out_w*l.out_h + INT8_PANEL - 1) / INT8_PANEL * INT8_PANEL;
+    // packed columns, quantized input and room to align the columns to 64 bytes
+    return (size_t)n*k4 * 4 + (size_t)l.c*l.h*l.w + 64;
+}
+
+typedef struct im2col_int8_args {
+    const unsigned char *im;
+    int channels, height, width, ksize, stride, pad;
+    unsigned char *packed;
+} im2col_int8_args;
+
+static void im2col_cpu_int8_panels(void *arg, int begin, int end)
+{
+    const im2col_int8_args *a = (const im2col_int8_args *)arg;
+    const unsigned char *im = a->im;
+    const int height = a->height, width = a->width, ksize = a->ksize, stride = a->stride, pad = a->pad;
+    const int out_w = (width + 2 * pad - ksize) / stride + 1;
+    const int n = ((height + 2 * pad - ksize) / stride + 1)*out_w;
+    const int k = a->channels*ksize*ksize;
+    const int k4 = (k + 3) / 4;
+    const size_t panel_size = (size_t)k4 * 4 * INT8_PANEL;
+    unsigned char *packed = a->packed;
+    int panel;
+
+    for (panel = begin; panel < end; ++panel) {
+        unsigned char *dst = packed + panel*panel_size;
+        int y0[INT8_PANEL], x0[INT8_PANEL];
+        int j, kk;
+        for (j = 0; j < INT8_PANEL; ++j) {
+            const int p = panel*INT8_PANEL + j;
+            // columns past the end read outside of the image
+            y0[j] = (p < n) ? (p / out_w)*stride - pad : -height - ksize;
+            x0[j] = (p < n) ? (p % out_w)*stride - pad : 0;
+        }
+        for (kk = 0; kk < k4 * 4; ++kk) {
+            unsigned char *d = dst + (kk / 4) * 4 * INT8_PANEL + kk % 4;
+            if (kk < k) {
+                const int c = kk / (ksize*ksize);
+                const int ky = (kk / ksize) % ksize;
+                const int kx = kk % ksize;
+                const unsigned char *src = im + (size_t)c*height*width;
+                for (j = 0; j < INT8_PANEL; ++j) {
+                    const int iy = y0[j] + ky;
+                    const int ix = x0[j] + kx;
+                    d[j * 4] = ((unsigned)iy < (unsigned)height && (unsigned)ix < (unsigned)width) ?
+                        src[iy*width + ix] : INT8_ZERO_POINT;
+                }
+            }
+            else {
+                for (j = 0; j < INT8_PANEL; ++j) d[j * 4] = INT8_ZERO_POINT;
+            }
+        }
+    }
+}
+
+// im2col into the panel layout of gemm_int8_u8s8(): [n / 16][k / 4][16][4],
+// one panel at a time so that its writes stay in cache; the padding is the
+// zero point so that it reads as 0
+static void im2col_cpu_int8_packed(const unsigned char *im,
+    int channels, int height, int width,
+    int ksize, int stride, int pad, unsigned char *packed)
+{
+    const int out_h = (height + 2 * pad - ksize) / stride + 1;
+    const int out_w = (width + 2 * pad - ksize) / stride + 1;
+    const int n_panels = (out_h*out_w + INT8_PANEL - 1) / INT8_PANEL;
+    im2col_int8_args args = { im, channels, height, width, ksize, stride, pad, packed };
+    parallel_for(n_panels, 1, im2col_cpu_int8_panels, &args);
+}
+
+typedef struct quantize_args {
+    const float *input;
+    float inv_scale;
+    unsigned char *quantized;
+} quantize_args;
+
+static void quantize_input(void *arg, int begin, int end)
+{
+    const quantize_args *a = (const quantize_args *)arg;
+    int i;
+    for (i = begin; i < end; ++i) {
+        const float v = a->input[i] * a->inv_scale;
+        int q = (int)(v + ((v >= 0) ? .5f : -.5f));
+        if (q > INT8_INPUT_MAX) q = INT8_INPUT_MAX;
+        if (q < -INT8_INPUT_MAX) q = -INT8_INPUT_MAX;
+        a->quantized[i] = (unsigned char)(q + INT8_ZERO_POINT);
+    }
+}
+
+void forward_convolutional_layer_int8(layer l, network_state state)
+{
+    const int n = l.out_h*l.out_w;
+    const int k4 = (l.size*l.size*l.c + 3) / 4;
+    const int n_pad = (n + INT8_PANEL - 1) / INT8_PANEL * INT8_PANEL;
+    unsigned char *packed = (unsigned char *)(((size_t)state.workspace + 63) & ~(size_t)63);
+    unsigned char *quantized = packed + (size_t)n_pad*k4 * 4;
+    const float inv_scale = 1.f / l.int8_input_scale;
+    int b;
+
+    for (b = 0; b < l.batch; ++b) {
+        quantize_args args = { state.input + (size_t)b*l.inputs, inv_scale, quantized };
+        parallel_for(l.inputs, parallel_grain(l.inputs, sizeof(float)), quantize_input, &args);
+        im2col_cpu_int8_packed(quantized, l.c, l.h, l.w, l.size, l.stride, l.pad, packed);
+        gemm_int8_u8s8(l.n, n, k4, l.weights_int8, packed,
+            l.weights_int8_offsets, l.weights_int8_scales, l.biases, l.activation,
+            l.output + (size_t)b*l.outputs, n);
+    }
+    if (l.activation != LEAKY && l.activation != LINEAR) {
+        activate_array_cpu_custom(l.output, l.outputs*l.batch, l.activation);
+    }
+}
+
+void quantize_network_int8(network *net, char **images, int count)
+{
+#ifdef GPU
+    if (gpu_index >= 0) return;
+#endif
+    float *input_max = calloc(net->n, sizeof(float));
+    int i, j, s, quantized = 0;
+
+    // calibration: the largest absolute input every eligible layer sees
+    for (i = 0; i < count; ++i) {
+        image im = load_image_color(images[i], net->w, net->h);
+        network_state state = { 0 };
+        state.net = *net;
+        state.input = im.data;
+        state.workspace = net->workspace;
+        // in the order of the schedule, which the planned outputs rely on
+        for (s = 0; s < net->n; ++s) {
+            j = net->schedule ? net->schedule[s] : s;
+            layer l = net->layers[j];
+            state.input = j ? net->layers[j - 1].output : im.data;
+            if (int8_layer_eligible(l)) {
+                int k;
+                for (k = 0; k < l.inputs; ++k) {
+                    if (fabsf(state.input[k]) > input_max[j]) input_max[j] = fabsf(state.input[k]);
+                }
+            }
+            state.index = j;
+            l.forward(l, state);
+        }
+        free_image(im);
+    }
+
+    size_t workspace_size = 0;
+    for (j = 0; j < net->n; ++j) {
+        layer *l = &net->layers[j];
+        if (int8_layer_eligible(*l) && input_max[j] > 0) {
+            int f;
+            quantize_weights_int8(l);
+            l->int8_input_scale = input_max[j] / INT8_INPUT_MAX;
+            for (f = 0; f < l->n; ++f) l->weights_int8_scales[f] *= l->int8_input_scale;
+            l->int8 = 1;
+            l->winograd = 0;
+            free(l->winograd_weights);
+            l->winograd_weights = NULL;
+            l->workspace_size = get_workspace_size(*l);
+            ++quantized;
+        }
+        if (l->workspace_size > workspace_size) workspace_size = l->workspace_size;
+    }
+    free(net->workspace);
+    net->workspace = make_network_workspace(net, workspace_size);
+    free(input_max);
+    printf(" INT8: %d layers quantized, calibrated on %d images \n", quantized, count);
+}
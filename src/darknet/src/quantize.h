@@ -0,0 +1,19 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include "network.h"
+#include "layer.h"
+#include <stddef.h>
+
+// INT8 post-training quantization for CPU inference. Weights are quantized
+// per filter, the input of every quantized layer gets one scale calibrated on
+// sample images. The linear detection heads stay fp32.
+
+// call after fuse_conv_batchnorm(), runs the fp32 network over the images
+void quantize_network_int8(network *net, char **images, int count);
+
+void quantize_weights_int8(layer *l);
+size_t get_int8_workspace_size(layer l);
+void forward_convolutional_layer_int8(layer l, network_state state);
+
+#endif
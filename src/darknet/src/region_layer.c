@@ -4,6 +4,7 @@
 #include "box.h"
 #include "cuda.h"
 #include "utils.h"
+#include "threadpool.h"
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
@@ -11,7 +12,7 @@
 
 #define DOABS 1
 
-region_layer make_region_layer(int batch, int w, int h, int n, int classes, int coords, int max_boxes)
+region_layer make_region_layer(int batch, int w, int h, int n, int classes, int coords, int max_boxes, int train)
 {
     region_layer l = {0};
     l.type = REGION;
@@ -24,12 +25,12 @@ region_layer make_region_layer(int batch, int w, int h, int n, int classes, int
     l.coords = coords;
     l.cost = calloc(1, sizeof(float));
     l.biases = calloc(n*2, sizeof(float));
-    l.bias_updates = calloc(n*2, sizeof(float));
+    if (train) l.bias_updates = calloc(n*2, sizeof(float));
     l.outputs = h*w*n*(classes + coords + 1);
     l.inputs = l.outputs;
     l.max_boxes = max_boxes;
     l.truths = max_boxes*(5);
-    l.delta = calloc(batch*l.outputs, sizeof(float));
+    if (train) l.delta = calloc(batch*l.outputs, sizeof(float));
     l.output = calloc(batch*l.outputs, sizeof(float));
     int i;
     for(i = 0; i < n*2; ++i){
@@ -62,7 +63,7 @@ void resize_region_layer(layer *l, int w, int h)
     l->inputs = l->outputs;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if (l->delta) l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     if (old_w < w || old_h < h) {
@@ -366,31 +367,48 @@ void backward_region_layer(const region_layer l, network_state state)
     axpy_cpu(l.batch*l.inputs, 1, l.delta, 1, state.delta, 1);
 }
 
-void get_region_boxes(layer l, int w, int h, float thresh, float **probs, box *boxes, int only_objectness, int *map)
+typedef struct region_boxes_args {
+    const layer *l;
+    int w, h;
+    float thresh;
+    float **probs;
+    box *boxes;
+    int only_objectness;
+    int *map;
+} region_boxes_args;
+
+// boxes and probabilities of the cells [begin, end)
+static void get_region_boxes_cells(void *arg, int begin, int end)
 {
+    const region_boxes_args *a = (const region_boxes_args *)arg;
+    const layer *l = a->l;
+    const int w = a->w, h = a->h, only_objectness = a->only_objectness;
+    const float thresh = a->thresh;
+    float **probs = a->probs;
+    box *boxes = a->boxes;
+    int *map = a->map;
+    float *const predictions = l->output;
     int i;
-    float *const predictions = l.output;
-    #pragma omp parallel for
-    for (i = 0; i < l.w*l.h; ++i){
+    for (i = begin; i < end; ++i){
         int j, n;
-        int row = i / l.w;
-        int col = i % l.w;
-        for(n = 0; n < l.n; ++n){
-            int index = i*l.n + n;
-            int p_index = index * (l.classes + 5) + 4;
+        int row = i / l->w;
+        int col = i % l->w;
+        for(n = 0; n < l->n; ++n){
+            int index = i*l->n + n;
+            int p_index = index * (l->classes + 5) + 4;
             float scale = predictions[p_index];
-            if(l.classfix == -1 && scale < .5) scale = 0;
-            int box_index = index * (l.classes + 5);
-            boxes[index] = get_region_box(predictions, l.biases, n, box_index, col, row, l.w, l.h);
+            if(l->classfix == -1 && scale < .5) scale = 0;
+            int box_index = index * (l->classes + 5);
+            boxes[index] = get_region_box(predictions, l->biases, n, box_index, col, row, l->w, l->h);
             boxes[index].x *= w;
             boxes[index].y *= h;
             boxes[index].w *= w;
             boxes[index].h *= h;
 
-            int class_index = index * (l.classes + 5) + 5;
-            if(l.softmax_tree){
+            int class_index = index * (l->classes + 5) + 5;
+            if(l->softmax_tree){
 
-                hierarchy_predictions(predictions + class_index, l.classes, l.softmax_tree, 0);
+                hierarchy_predictions(predictions + class_index, l->classes, l->softmax_tree, 0);
                 int found = 0;
                 if(map){
                     for(j = 0; j < 200; ++j){
@@ -398,7 +416,7 @@ void get_region_boxes(layer l, int w, int h, float thresh, float **probs, box *b
                         probs[index][j] = (prob > thresh) ? prob : 0;
                     }
                 } else {
-                    for(j = l.classes - 1; j >= 0; --j){
+                    for(j = l->classes - 1; j >= 0; --j){
                         if(!found && predictions[class_index + j] > .5){
                             found = 1;
                         } else {
@@ -409,7 +427,7 @@ void get_region_boxes(layer l, int w, int h, float thresh, float **probs, box *b
                     }
                 }
             } else {
-                for(j = 0; j < l.classes; ++j){
+                for(j = 0; j < l->classes; ++j){
                     float prob = scale*predictions[class_index+j];
                     probs[index][j] = (prob > thresh) ? prob : 0;
                 }
@@ -421,6 +439,12 @@ void get_region_boxes(layer l, int w, int h, float thresh, float **probs, box *b
     }
 }
 
+void get_region_boxes(layer l, int w, int h, float thresh, float **probs, box *boxes, int only_objectness, int *map)
+{
+    region_boxes_args args = { &l, w, h, thresh, probs, boxes, only_objectness, map };
+    parallel_for(l.w*l.h, 1, get_region_boxes_cells, &args);
+}
+
 #ifdef GPU
 
 void forward_region_layer_gpu(const region_layer l, network_state state)
@@ -4,7 +4,7 @@
 #include <stdio.h>
 
 
-layer make_reorg_layer(int batch, int w, int h, int c, int stride, int reverse)
+layer make_reorg_layer(int batch, int w, int h, int c, int stride, int reverse, int train)
 {
     layer l = {0};
     l.type = REORG;
@@ -28,7 +28,7 @@ layer make_reorg_layer(int batch, int w, int h, int c, int stride, int reverse)
     l.inputs = h*w*c;
     int output_size = l.out_h * l.out_w * l.out_c * batch;
     l.output =  calloc(output_size, sizeof(float));
-    l.delta =   calloc(output_size, sizeof(float));
+    if (train) l.delta = calloc(output_size, sizeof(float));
 
     l.forward = forward_reorg_layer;
     l.backward = backward_reorg_layer;
@@ -65,7 +65,7 @@ void resize_reorg_layer(layer *l, int w, int h)
     int output_size = l->outputs * l->batch;
 
     l->output = realloc(l->output, output_size * sizeof(float));
-    l->delta = realloc(l->delta, output_size * sizeof(float));
+    if (l->delta) l->delta = realloc(l->delta, output_size * sizeof(float));
 
 #ifdef GPU
     cuda_free(l->output_gpu);
@@ -6,7 +6,7 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_reorg_old_layer(int batch, int h, int w, int c, int stride, int reverse);
+layer make_reorg_old_layer(int batch, int h, int w, int c, int stride, int reverse, int train);
 void resize_reorg_old_layer(layer *l, int w, int h);
 void forward_reorg_old_layer(const layer l, network_state state);
 void backward_reorg_old_layer(const layer l, network_state state);
@@ -1,9 +1,10 @@
 #include "route_layer.h"
 #include "cuda.h"
 #include "blas.h"
+#include "threadpool.h"
 #include <stdio.h>
 
-route_layer make_route_layer(int batch, int n, int *input_layers, int *input_sizes)
+route_layer make_route_layer(int batch, int n, int *input_layers, int *input_sizes, int train)
 {
     fprintf(stderr,"route ");
     route_layer l = {0};
@@ -21,8 +22,8 @@ route_layer make_route_layer(int batch, int n, int *input_layers, int *input_siz
     fprintf(stderr, "\n");
     l.outputs = outputs;
     l.inputs = outputs;
-    l.delta =  calloc(outputs*batch, sizeof(float));
-    l.output = calloc(outputs*batch, sizeof(float));;
+    if (train) l.delta = calloc(outputs*batch, sizeof(float));
+    l.output = calloc(outputs*batch, sizeof(float));
 
     l.forward = forward_route_layer;
     l.backward = backward_route_layer;
@@ -58,7 +59,7 @@ void resize_route_layer(route_layer *l, network *net)
         }
     }
     l->inputs = l->outputs;
-    l->delta =  realloc(l->delta, l->outputs*l->batch*sizeof(float));
+    if (l->delta) l->delta = realloc(l->delta, l->outputs*l->batch*sizeof(float));
     l->output = realloc(l->output, l->outputs*l->batch*sizeof(float));
 
 #ifdef GPU
@@ -70,17 +71,36 @@ void resize_route_layer(route_layer *l, network *net)
     
 }
 
+typedef struct route_copy_args {
+    float *input, *output;
+    int input_size, outputs;
+} route_copy_args;
+
+// the images [begin, end) of the batch of one input
+static void route_copy_images(void *arg, int begin, int end)
+{
+    const route_copy_args *a = (const route_copy_args *)arg;
+    int j;
+    for(j = begin; j < end; ++j){
+        copy_cpu(a->input_size, a->input + j*a->input_size, 1, a->output + j*a->outputs, 1);
+    }
+}
+
 void forward_route_layer(const route_layer l, network_state state)
 {
-    int i, j;
+    int i;
     int offset = 0;
     for(i = 0; i < l.n; ++i){
         int index = l.input_layers[i];
         float *input = state.net.layers[index].output;
         int input_size = l.input_sizes[i];
-        for(j = 0; j < l.batch; ++j){
-            copy_cpu(input_size, input + j*input_size, 1, l.output + offset + j*l.outputs, 1);
+        // planned inputs write straight into their slice of the output (see memplan.h)
+        if (input == l.output + offset && l.batch == 1) {
+            offset += input_size;
+            continue;
         }
+        route_copy_args args = { input, l.output + offset, input_size, l.outputs };
+        parallel_for(l.batch, parallel_grain(l.batch, input_size*sizeof(float)), route_copy_images, &args);
         offset += input_size;
     }
 }
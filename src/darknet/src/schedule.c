@@ -0,0 +1,128 @@
+#include "schedule.h"
+#include "threadpool.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// layers of a wave running at once, wider waves are cut into several
+#define SCHEDULE_MAX_LANES 4
+#define SCHEDULE_LANE_ALIGN 64
+
+void build_network_schedule(network *net)
+{
+    const int n = net->n;
+    int *depth;
+    int i, j, d, max_depth = 0, position = 0;
+
+    free_network_schedule(net);
+#ifdef GPU
+    if (gpu_index >= 0) return;
+#endif
+    if (n <= 0) return;
+    for (i = 0; i < n; ++i) {
+        // recurrent layers carry their state from one call to the next
+        const LAYER_TYPE type = net->layers[i].type;
+        if (type == RNN || type == GRU || type == CRNN) return;
+    }
+
+    // the depth of a layer is one more than the deepest layer it reads
+    depth = calloc(n, sizeof(int));
+    for (i = 0; i < n; ++i) {
+        layer l = net->layers[i];
+        if (l.type == ROUTE) {
+            for (j = 0; j < l.n; ++j) {
+                d = depth[l.input_layers[j]] + 1;
+                if (d > depth[i]) depth[i] = d;
+            }
+        }
+        else if (i > 0) depth[i] = depth[i - 1] + 1;
+        if (l.type == SHORTCUT && depth[l.index] + 1 > depth[i]) depth[i] = depth[l.index] + 1;
+        if (depth[i] > max_depth) max_depth = depth[i];
+    }
+    net->schedule = calloc(n, sizeof(int));
+    net->wave = calloc(n, sizeof(int));
+    net->waves = calloc(n + 1, sizeof(int));
+    if (!net->schedule || !net->wave || !net->waves) error("build_network_schedule: calloc failed");
+    net->num_waves = 0;
+    net->lanes = 1;
+    for (d = 0; d <= max_depth; ++d) {
+        int in_wave = 0;
+        for (i = 0; i < n; ++i) {
+            if (depth[i] != d) continue;
+            if (in_wave == 0 || in_wave == SCHEDULE_MAX_LANES) {
+                net->waves[net->num_waves++] = position;
+                in_wave = 0;
+            }
+            net->wave[i] = net->num_waves - 1;
+            net->schedule[position++] = i;
+            if (++in_wave > net->lanes) net->lanes = in_wave;
+        }
+    }
+    net->waves[net->num_waves] = position;
+    free(depth);
+
+    // a chain of layers runs in index order
+    if (net->lanes == 1) {
+        free_network_schedule(net);
+        return;
+    }
+    fprintf(stderr, " schedule: %d layers in %d waves, up to %d at once \n", n, net->num_waves, net->lanes);
+}
+
+void free_network_schedule(network *net)
+{
+    free(net->schedule);
+    free(net->waves);
+    free(net->wave);
+    net->schedule = 0;
+    net->waves = 0;
+    net->wave = 0;
+    net->num_waves = 0;
+    net->lanes = 1;
+}
+
+float *make_network_workspace(network *net, size_t workspace_size)
+{
+    const int lanes = (net->lanes > 1) ? net->lanes : 1;
+    net->workspace_size = (workspace_size + SCHEDULE_LANE_ALIGN - 1) & ~(size_t)(SCHEDULE_LANE_ALIGN - 1);
+    return calloc(lanes, net->workspace_size);
+}
+
+typedef struct wave_args {
+    network net;
+    network_state state;
+    float *input;
+    const int *layers;
+} wave_args;
+
+// runs the layers [begin, end) of a wave, each in its own workspace lane
+static void forward_wave_layers(void *arg, int begin, int end)
+{
+    const wave_args *a = (const wave_args *)arg;
+    int t;
+    for (t = begin; t < end; ++t) {
+        network_state state = a->state;
+        const int i = a->layers[t];
+        layer l = a->net.layers[i];
+        state.index = i;
+        state.input = i ? a->net.layers[i - 1].output : a->input;
+        state.workspace = (float *)((char *)a->net.workspace + t*a->net.workspace_size);
+        l.forward(l, state);
+    }
+}
+
+void forward_network_waves(network net, network_state state)
+{
+    wave_args args;
+    int w;
+    args.net = net;
+    args.state = state;
+    args.input = state.input;
+    for (w = 0; w < net.num_waves; ++w) {
+        const int count = net.waves[w + 1] - net.waves[w];
+        args.layers = net.schedule + net.waves[w];
+        if (count == 1) forward_wave_layers(&args, 0, 1);
+        else parallel_for(count, 1, forward_wave_layers, &args);
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "network.h"
+
+// Concurrent execution of independent layers on the CPU. The layers form a
+// dependency graph: a route reads its input_layers, a shortcut the layer at its
+// index and its input, every other layer the output of the layer before it.
+// The schedule orders the layers in waves by their depth in that graph, so that
+// no layer of a wave reads another one of it, and forward_network() runs the
+// layers of a wave side by side on the thread pool (e.g. the 13x13 head of
+// yolov3 next to the upsampling branch), each with a workspace lane of its own.
+// A planned network (memplan.h) keeps its outputs alive by wave instead of by
+// layer index, so it must always run in the order of its schedule.
+
+// orders the layers of an inference-only network (see parse_network_cfg_inference)
+// in waves; other networks, and those without independent layers, keep no
+// schedule and run layer by layer
+void build_network_schedule(network *net);
+void free_network_schedule(network *net);
+
+// a workspace of workspace_size bytes for every lane of net
+float *make_network_workspace(network *net, size_t workspace_size);
+
+// runs the layers of a scheduled network, the waves one after the other
+void forward_network_waves(network net, network_state state);
+
+#endif
@@ -4,7 +4,7 @@
 #include <stdio.h>
 #include <assert.h>
 
-layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int h2, int c2)
+layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int h2, int c2, int train)
 {
     fprintf(stderr,"Shortcut Layer: %d\n", index);
     layer l = {0};
@@ -21,8 +21,8 @@ layer make_shortcut_layer(int batch, int index, int w, int h, int c, int w2, int
 
     l.index = index;
 
-    l.delta =  calloc(l.outputs*batch, sizeof(float));
-    l.output = calloc(l.outputs*batch, sizeof(float));;
+    if (train) l.delta = calloc(l.outputs*batch, sizeof(float));
+    l.output = calloc(l.outputs*batch, sizeof(float));
 
     l.forward = forward_shortcut_layer;
     l.backward = backward_shortcut_layer;
@@ -44,7 +44,7 @@ void resize_shortcut_layer(layer *l, int w, int h)
     l->h = l->out_h = h;
     l->outputs = w*h*l->out_c;
     l->inputs = l->outputs;
-    l->delta = realloc(l->delta, l->outputs*l->batch * sizeof(float));
+    if (l->delta) l->delta = realloc(l->delta, l->outputs*l->batch * sizeof(float));
     l->output = realloc(l->output, l->outputs*l->batch * sizeof(float));
 
 #ifdef GPU
@@ -0,0 +1,262 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include "threadpool.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define POOL_THREAD_LOCAL __declspec(thread)
+#define pool_claim(p) _InterlockedExchangeAdd((volatile long *)(p), 1)
+#else
+#define POOL_THREAD_LOCAL __thread
+#define pool_claim(p) __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+#endif
+
+// memory a tile should at least touch to be worth another thread
+#define POOL_MIN_TILE_BYTES (16*1024)
+// tiles per thread, so that stealing can even out uneven ones
+#define POOL_TILES_PER_THREAD 4
+// loops that can run on the pool at once, further ones run on their caller alone
+#define POOL_MAX_LOOPS 8
+
+// the run of tiles of one thread, on a cache line of its own
+typedef struct pool_partition {
+    int next;
+    int end;
+    char pad[64 - 2*sizeof(int)];
+} pool_partition;
+
+typedef struct pool_loop {
+    parallel_for_fn fn;           // 0 while the slot is free
+    void *arg;
+    int n, grain;
+    pool_partition *partitions;   // one per thread
+    int exhausted;                // every tile is taken, threads no longer join
+    int running;                  // threads still on the loop, the caller counted
+} pool_loop;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t wake, done;
+    pthread_t *threads;
+    pool_partition *partitions;
+    pool_loop loops[POOL_MAX_LOOPS];
+    int size;                     // threads, the caller counted; 0 until started
+    int configured;
+    int configuring;              // loops run on their caller meanwhile
+    int *cpus;
+    int stop;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// partition a pool thread starts from, the caller's is 0
+static POOL_THREAD_LOCAL int pool_self;
+
+static int online_cpus()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+#endif
+}
+
+static void pin_thread(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) fprintf(stderr, " thread pool: can't pin a thread to CPU %d \n", cpu);
+#else
+    (void)cpu;
+#endif
+}
+
+// own tiles first, then the ones left in the other partitions
+static void run_tiles(pool_loop *loop, int self)
+{
+    int i;
+    for (i = 0; i < pool.size; ++i) {
+        pool_partition *p = &loop->partitions[(self + i) % pool.size];
+        for (;;) {
+            const int t = pool_claim(&p->next);
+            int begin, end;
+            if (t >= p->end) break;
+            begin = t*loop->grain;
+            end = (begin + loop->grain < loop->n) ? begin + loop->grain : loop->n;
+            loop->fn(loop->arg, begin, end);
+        }
+    }
+}
+
+// with mutex held
+static pool_loop *joinable_loop()
+{
+    int i;
+    for (i = 0; i < POOL_MAX_LOOPS; ++i) {
+        if (pool.loops[i].fn && !pool.loops[i].exhausted) return &pool.loops[i];
+    }
+    return 0;
+}
+
+// with mutex held
+static int loops_running()
+{
+    int i;
+    for (i = 0; i < POOL_MAX_LOOPS; ++i) {
+        if (pool.loops[i].fn) return 1;
+    }
+    return 0;
+}
+
+static void *pool_thread_main(void *ptr)
+{
+    pool_self = (int)(size_t)ptr;
+    if (pool.cpus) pin_thread(pool.cpus[pool_self]);
+    pthread_mutex_lock(&pool.mutex);
+    for (;;) {
+        pool_loop *loop = joinable_loop();
+        if (pool.stop) break;
+        if (!loop) {
+            pthread_cond_wait(&pool.wake, &pool.mutex);
+            continue;
+        }
+        ++loop->running;
+        pthread_mutex_unlock(&pool.mutex);
+        run_tiles(loop, pool_self);
+        pthread_mutex_lock(&pool.mutex);
+        loop->exhausted = 1;
+        if (--loop->running == 0) pthread_cond_broadcast(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    return 0;
+}
+
+// with mutex held
+static void start_pool()
+{
+    int i;
+    pool.size = (pool.configured > 0) ? pool.configured : online_cpus();
+    pool.partitions = calloc((size_t)pool.size*POOL_MAX_LOOPS, sizeof(pool_partition));
+    pool.threads = calloc(pool.size, sizeof(pthread_t));
+    if (!pool.partitions || !pool.threads) error("thread pool: calloc failed");
+    for (i = 0; i < POOL_MAX_LOOPS; ++i) pool.loops[i].partitions = pool.partitions + (size_t)i*pool.size;
+    pool.stop = 0;
+    for (i = 1; i < pool.size; ++i) {
+        if (pthread_create(&pool.threads[i], 0, pool_thread_main, (void *)(size_t)i)) error("Thread creation failed");
+    }
+}
+
+// with mutex held and no loop running, releases it while joining the threads
+static void stop_pool()
+{
+    int i;
+    if (!pool.size) return;
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.mutex);
+    for (i = 1; i < pool.size; ++i) pthread_join(pool.threads[i], 0);
+    pthread_mutex_lock(&pool.mutex);
+    free(pool.threads);
+    free(pool.partitions);
+    pool.threads = 0;
+    pool.partitions = 0;
+    pool.size = 0;
+}
+
+void parallel_for(int n, int grain, parallel_for_fn fn, void *arg)
+{
+    pool_loop *loop = 0;
+    int tiles, i;
+    if (n <= 0) return;
+    if (grain < 1) grain = 1;
+    tiles = (n + grain - 1) / grain;
+    if (tiles > 1) {
+        pthread_mutex_lock(&pool.mutex);
+        if (!pool.size && !pool.configuring) start_pool();
+        for (i = 0; i < POOL_MAX_LOOPS && pool.size > 1 && !pool.configuring; ++i) {
+            if (!pool.loops[i].fn) {
+                loop = &pool.loops[i];
+                break;
+            }
+        }
+        if (loop) {
+            loop->fn = fn;
+            loop->arg = arg;
+            loop->n = n;
+            loop->grain = grain;
+            for (i = 0; i < pool.size; ++i) {
+                loop->partitions[i].next = (int)((long long)tiles*i/pool.size);
+                loop->partitions[i].end = (int)((long long)tiles*(i + 1)/pool.size);
+            }
+            loop->exhausted = 0;
+            loop->running = 1;
+            pthread_cond_broadcast(&pool.wake);
+        }
+        pthread_mutex_unlock(&pool.mutex);
+    }
+    if (!loop) {
+        fn(arg, 0, n);
+        return;
+    }
+
+    run_tiles(loop, pool_self);
+
+    pthread_mutex_lock(&pool.mutex);
+    loop->exhausted = 1;
+    --loop->running;
+    while (loop->running > 0) pthread_cond_wait(&pool.done, &pool.mutex);
+    loop->fn = 0;
+    pthread_cond_broadcast(&pool.done);
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+void configure_thread_pool(int threads, const int *cpus)
+{
+    int i;
+    pthread_mutex_lock(&pool.mutex);
+    while (pool.configuring) pthread_cond_wait(&pool.done, &pool.mutex);
+    pool.configuring = 1;
+    while (loops_running()) pthread_cond_wait(&pool.done, &pool.mutex);
+    stop_pool();
+    free(pool.cpus);
+    pool.cpus = 0;
+    pool.configured = threads;
+    if (cpus) {
+        if (threads <= 0) threads = online_cpus();
+        pool.cpus = calloc(threads, sizeof(int));
+        if (!pool.cpus) error("thread pool: calloc failed");
+        for (i = 0; i < threads; ++i) pool.cpus[i] = cpus[i];
+        pool.configured = threads;
+    }
+    pool.configuring = 0;
+    pthread_cond_broadcast(&pool.done);
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+int thread_pool_size()
+{
+    return pool.size ? pool.size : (pool.configured > 0) ? pool.configured : online_cpus();
+}
+
+int parallel_grain(int n, int bytes)
+{
+    const int min_grain = (bytes > 0) ? (POOL_MIN_TILE_BYTES + bytes - 1) / bytes : 1;
+    const int threads = thread_pool_size();
+    const int grain = (n + threads*POOL_TILES_PER_THREAD - 1) / (threads*POOL_TILES_PER_THREAD);
+    return (grain > min_grain) ? grain : min_grain;
+}
@@ -0,0 +1,41 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#ifdef YOLODLL_EXPORTS
+#if defined(_MSC_VER)
+#define YOLODLL_API __declspec(dllexport)
+#else
+#define YOLODLL_API __attribute__((visibility("default")))
+#endif
+#else
+#if defined(_MSC_VER)
+#define YOLODLL_API
+#else
+#define YOLODLL_API
+#endif
+#endif
+
+// The one pool of threads every CPU kernel runs its loops on. A parallel_for()
+// cuts [0, n) into tiles of grain items and gives every thread an equal run of
+// tiles; a thread done with its own run steals the tiles left in the others'.
+// The calling thread takes part and idle threads sleep instead of spinning.
+// Several loops can run at once, issued by other threads or from inside a tile
+// (layers run side by side, see schedule.h): an idle thread joins whichever
+// still has tiles left. A loop finding every slot taken runs on its caller alone.
+
+// processes the items [begin, end)
+typedef void (*parallel_for_fn)(void *arg, int begin, int end);
+
+YOLODLL_API void parallel_for(int n, int grain, parallel_for_fn fn, void *arg);
+
+// threads <= 0 uses one per online CPU, the caller counted. cpus, if not null,
+// holds threads CPU indices the pool threads are pinned to (Linux only, the
+// first one is the caller's and is left alone). Waits for the running loops.
+YOLODLL_API void configure_thread_pool(int threads, const int *cpus);
+YOLODLL_API int thread_pool_size();
+
+// an item count for parallel_for() of tiles worth handing to another thread,
+// bytes being the memory one item touches
+int parallel_grain(int n, int bytes);
+
+#endif
@@ -0,0 +1,302 @@
+#include "yolo_v2_class.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+// the box center x, y and the width and height are filtered independently, each by a
+// constant-velocity Kalman filter over (position, velocity) with a 2x2 covariance
+#define TRACK_DIMS 4
+
+// noise as fractions of the track height, so that near and far objects are treated alike
+#define MEASUREMENT_NOISE 0.05f     // position, per detection
+#define ACCELERATION_NOISE 1.0f     // per second^2
+#define INITIAL_VELOCITY 1.0f       // per second
+
+// every field is an array of capacity tracks, the n live ones first
+struct tracker_t {
+    int capacity;
+    float iou_thresh;
+    double max_age;
+    double time;                // the tracks are at this time
+    double held;                // the scene did not change from the last frame detected until this time (hold())
+    unsigned int next_id;
+    int n;
+
+    std::vector<float> pos[TRACK_DIMS], vel[TRACK_DIMS];
+    std::vector<float> p00[TRACK_DIMS], p01[TRACK_DIMS], p11[TRACK_DIMS];
+    std::vector<unsigned int> id, obj_id, hits;
+    std::vector<float> prob;
+    std::vector<double> seen;   // time of the last matching detection
+
+    // assignment scratch, kept to not allocate on every update
+    std::vector<float> cost;
+    std::vector<float> u, v, minv;
+    std::vector<int> p, way, match, det_track;
+    std::vector<char> used;
+};
+
+static void resize_tracker(tracker_t &t, int capacity)
+{
+    for (int d = 0; d < TRACK_DIMS; ++d) {
+        t.pos[d].resize(capacity);
+        t.vel[d].resize(capacity);
+        t.p00[d].resize(capacity);
+        t.p01[d].resize(capacity);
+        t.p11[d].resize(capacity);
+    }
+    t.id.resize(capacity);
+    t.obj_id.resize(capacity);
+    t.hits.resize(capacity);
+    t.prob.resize(capacity);
+    t.seen.resize(capacity);
+}
+
+static void box_of_detection(bbox_t const &b, float *z)
+{
+    z[0] = b.x + b.w / 2.f;
+    z[1] = b.y + b.h / 2.f;
+    z[2] = (float)b.w;
+    z[3] = (float)b.h;
+}
+
+static bbox_t detection_of_track(tracker_t const &t, int i, float dt)
+{
+    float z[TRACK_DIMS];
+    for (int d = 0; d < TRACK_DIMS; ++d) z[d] = t.pos[d][i] + t.vel[d][i] * dt;
+    float const w = std::max(z[2], 0.f), h = std::max(z[3], 0.f);
+    bbox_t b;
+    b.x = (unsigned int)std::max(z[0] - w / 2, 0.f);
+    b.y = (unsigned int)std::max(z[1] - h / 2, 0.f);
+    b.w = (unsigned int)w;
+    b.h = (unsigned int)h;
+    b.prob = t.prob[i];
+    b.obj_id = t.obj_id[i];
+    b.track_id = t.id[i];
+    b.frames_counter = t.hits[i];
+    return b;
+}
+
+static float iou_of_boxes(float const *a, float const *b)
+{
+    float const w = std::min(a[0] + a[2] / 2, b[0] + b[2] / 2) - std::max(a[0] - a[2] / 2, b[0] - b[2] / 2);
+    float const h = std::min(a[1] + a[3] / 2, b[1] + b[3] / 2) - std::max(a[1] - a[3] / 2, b[1] - b[3] / 2);
+    if (w <= 0 || h <= 0) return 0;
+    float const intersection = w*h;
+    return intersection / (a[2] * a[3] + b[2] * b[3] - intersection);
+}
+
+// minimum cost assignment of the rows to distinct columns of the rows x cols (rows <= cols) cost matrix,
+// the potentials method of the Hungarian algorithm in O(rows^2 cols); match[row] is the column
+static void assign(tracker_t &t, int rows, int cols)
+{
+    float const inf = std::numeric_limits<float>::max();
+    t.u.assign(rows + 1, 0);
+    t.v.assign(cols + 1, 0);
+    t.p.assign(cols + 1, 0);
+    t.way.assign(cols + 1, 0);
+    for (int i = 1; i <= rows; ++i) {
+        int j0 = 0;
+        t.p[0] = i;
+        t.minv.assign(cols + 1, inf);
+        t.used.assign(cols + 1, 0);
+        do {
+            t.used[j0] = 1;
+            int const i0 = t.p[j0];
+            float delta = inf;
+            int j1 = 0;
+            for (int j = 1; j <= cols; ++j) {
+                if (t.used[j]) continue;
+                float const cur = t.cost[(i0 - 1)*cols + j - 1] - t.u[i0] - t.v[j];
+                if (cur < t.minv[j]) {
+                    t.minv[j] = cur;
+                    t.way[j] = j0;
+                }
+                if (t.minv[j] < delta) {
+                    delta = t.minv[j];
+                    j1 = j;
+                }
+            }
+            for (int j = 0; j <= cols; ++j) {
+                if (t.used[j]) {
+                    t.u[t.p[j]] += delta;
+                    t.v[j] -= delta;
+                }
+                else t.minv[j] -= delta;
+            }
+            j0 = j1;
+        } while (t.p[j0] != 0);
+        do {
+            int const j1 = t.way[j0];
+            t.p[j0] = t.p[j1];
+            j0 = j1;
+        } while (j0);
+    }
+    t.match.assign(rows, -1);
+    for (int j = 1; j <= cols; ++j) {
+        if (t.p[j]) t.match[t.p[j] - 1] = j - 1;
+    }
+}
+
+static void remove_track(tracker_t &t, int i)
+{
+    int const last = --t.n;
+    for (int d = 0; d < TRACK_DIMS; ++d) {
+        t.pos[d][i] = t.pos[d][last];
+        t.vel[d][i] = t.vel[d][last];
+        t.p00[d][i] = t.p00[d][last];
+        t.p01[d][i] = t.p01[d][last];
+        t.p11[d][i] = t.p11[d][last];
+    }
+    t.id[i] = t.id[last];
+    t.obj_id[i] = t.obj_id[last];
+    t.hits[i] = t.hits[last];
+    t.prob[i] = t.prob[last];
+    t.seen[i] = t.seen[last];
+}
+
+YOLODLL_API Tracker::Tracker(int capacity, float iou_thresh, double max_age)
+{
+    tracks_ptr = std::make_shared<tracker_t>();
+    tracker_t &t = *static_cast<tracker_t *>(tracks_ptr.get());
+    t.capacity = std::max(capacity, 1);
+    t.iou_thresh = iou_thresh;
+    t.max_age = max_age;
+    t.time = 0;
+    t.held = 0;
+    t.next_id = 1;
+    t.n = 0;
+    resize_tracker(t, t.capacity);
+}
+
+YOLODLL_API Tracker::~Tracker()
+{
+}
+
+YOLODLL_API void Tracker::clear()
+{
+    tracker_t &t = *static_cast<tracker_t *>(tracks_ptr.get());
+    t.n = 0;
+}
+
+YOLODLL_API std::vector<bbox_t> Tracker::update(std::vector<bbox_t> const &detections, double time)
+{
+    tracker_t &t = *static_cast<tracker_t *>(tracks_ptr.get());
+    // the detections of a frame sent before a hold() are the scene that held still and move the tracks up to their
+    // own time, later ones only by the time since the scene last held still
+    double const from = (time > t.held) ? std::max(t.time, t.held) : t.time;
+    float const dt = (t.n > 0) ? (float)std::max(time - from, 0.0) : 0.f;
+    t.time = std::max(t.time, time);
+
+    // predict: x = F x, P = F P F' + Q with white noise acceleration
+    for (int d = 0; d < TRACK_DIMS; ++d) {
+        float *pos = t.pos[d].data(), *vel = t.vel[d].data();
+        float *p00 = t.p00[d].data(), *p01 = t.p01[d].data(), *p11 = t.p11[d].data();
+        float const *height = t.pos[3].data();
+        for (int i = 0; i < t.n; ++i) {
+            float const q = ACCELERATION_NOISE*ACCELERATION_NOISE*height[i] * height[i];
+            pos[i] += vel[i] * dt;
+            p00[i] += dt*(2 * p01[i] + dt*p11[i]) + q*dt*dt*dt*dt / 4;
+            p01[i] += dt*p11[i] + q*dt*dt*dt / 2;
+            p11[i] += q*dt*dt;
+        }
+    }
+
+    // the cost of a match is 1 - IoU, tracks and detections of different classes never match
+    int const tracks = t.n, dets = (int)detections.size();
+    bool const transposed = tracks > dets;
+    int const rows = transposed ? dets : tracks, cols = transposed ? tracks : dets;
+    std::vector<int> &det_track = t.det_track;
+    det_track.assign(dets, -1);
+    if (rows > 0) {
+        t.cost.resize((size_t)rows*cols);
+        for (int i = 0; i < tracks; ++i) {
+            float box[TRACK_DIMS];
+            for (int d = 0; d < TRACK_DIMS; ++d) box[d] = t.pos[d][i];
+            for (int j = 0; j < dets; ++j) {
+                float z[TRACK_DIMS];
+                box_of_detection(detections[j], z);
+                float const c = (detections[j].obj_id == t.obj_id[i]) ? 1 - iou_of_boxes(box, z) : 2;
+                t.cost[transposed ? (size_t)j*cols + i : (size_t)i*cols + j] = c;
+            }
+        }
+        assign(t, rows, cols);
+        for (int r = 0; r < rows; ++r) {
+            int const c = t.match[r];
+            if (c < 0) continue;
+            int const i = transposed ? c : r, j = transposed ? r : c;
+            if (1 - t.cost[(size_t)r*cols + c] >= t.iou_thresh) det_track[j] = i;
+        }
+    }
+
+    // correct the matched tracks, start new ones from the other detections
+    for (int j = 0; j < dets; ++j) {
+        float z[TRACK_DIMS];
+        box_of_detection(detections[j], z);
+        int i = det_track[j];
+        if (i >= 0) {
+            float const r = MEASUREMENT_NOISE*MEASUREMENT_NOISE*t.pos[3][i] * t.pos[3][i];
+            for (int d = 0; d < TRACK_DIMS; ++d) {
+                float &p00 = t.p00[d][i], &p01 = t.p01[d][i], &p11 = t.p11[d][i];
+                float const s = p00 + r;
+                float const k0 = p00 / s, k1 = p01 / s;
+                float const y = z[d] - t.pos[d][i];
+                t.pos[d][i] += k0*y;
+                t.vel[d][i] += k1*y;
+                p11 -= k1*p01;
+                p01 -= k0*p01;
+                p00 -= k0*p00;
+            }
+            ++t.hits[i];
+        }
+        else {
+            if (t.n == t.capacity) continue;
+            i = t.n++;
+            float const r = MEASUREMENT_NOISE*MEASUREMENT_NOISE*z[3] * z[3];
+            float const v = INITIAL_VELOCITY*INITIAL_VELOCITY*z[3] * z[3];
+            for (int d = 0; d < TRACK_DIMS; ++d) {
+                t.pos[d][i] = z[d];
+                t.vel[d][i] = 0;
+                t.p00[d][i] = r;
+                t.p01[d][i] = 0;
+                t.p11[d][i] = v;
+            }
+            t.id[i] = t.next_id++;
+            t.obj_id[i] = detections[j].obj_id;
+            t.hits[i] = 1;
+        }
+        t.prob[i] = detections[j].prob;
+        t.seen[i] = time;
+    }
+
+    for (int i = 0; i < t.n;) {
+        if (t.time - t.seen[i] > t.max_age) remove_track(t, i);
+        else ++i;
+    }
+
+    std::vector<bbox_t> result;
+    result.reserve(t.n);
+    for (int i = 0; i < t.n; ++i) result.push_back(detection_of_track(t, i, 0));
+    return result;
+}
+
+YOLODLL_API std::vector<bbox_t> Tracker::predict(double time) const
+{
+    tracker_t const &t = *static_cast<tracker_t const *>(tracks_ptr.get());
+    float const dt = (float)std::max(time - std::max(t.time, t.held), 0.0);
+    std::vector<bbox_t> result;
+    result.reserve(t.n);
+    for (int i = 0; i < t.n; ++i) result.push_back(detection_of_track(t, i, dt));
+    return result;
+}
+
+YOLODLL_API void Tracker::hold(double time)
+{
+    tracker_t &t = *static_cast<tracker_t *>(tracks_ptr.get());
+    if (time <= t.held || time <= t.time) return;
+    // the tracks stay at t.time: a detection still in flight for the frame the scene held still from
+    // is applied at its own time by update()
+    t.held = time;
+    for (int i = 0; i < t.n; ++i) t.seen[i] = time;
+}
@@ -4,7 +4,7 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_upsample_layer(int batch, int w, int h, int c, int stride);
+layer make_upsample_layer(int batch, int w, int h, int c, int stride, int train);
 void forward_upsample_layer(const layer l, network_state state);
 void backward_upsample_layer(const layer l, network_state state);
 void resize_upsample_layer(layer *l, int w, int h);
@@ -0,0 +1,281 @@
+#include "winograd.h"
+#include "activations.h"
+#include "gemm.h"
+#include "utils.h"
+#include "threadpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Lavin & Gray, "Fast Algorithms for Convolutional Neural Networks" (2015).
+// An m x m output tile is computed from an (m+2) x (m+2) input tile d:
+//     Y = AT * [ (G * g * GT) .* (BT * d * B) ] * A
+// Summing the elementwise product over input channels turns into alpha*alpha
+// independent GEMMs: (filters x channels) * (channels x tiles).
+
+// tiles transformed per pass, bounds the workspace independently of the image size
+#define WINOGRAD_TILE_BLOCK 128
+
+static const float G_2[4 * 3] = {
+    1,    0,    0,
+    .5f,  .5f,  .5f,
+    .5f, -.5f,  .5f,
+    0,    0,    1
+};
+
+static const float G_4[6 * 3] = {
+    1.f / 4,   0,         0,
+    -1.f / 6,  -1.f / 6,  -1.f / 6,
+    -1.f / 6,  1.f / 6,   -1.f / 6,
+    1.f / 24,  1.f / 12,  1.f / 6,
+    1.f / 24,  -1.f / 12, 1.f / 6,
+    0,         0,         1
+};
+
+// out[r x r] = mat[r x s] * in[s x s] * mat^T
+static inline void winograd_sandwich(const float *mat, int r, int s, const float *in, float *out)
+{
+    float tmp[6 * 6];
+    int i, j, k;
+    for (i = 0; i < r; ++i) {
+        for (j = 0; j < s; ++j) {
+            float sum = 0;
+            for (k = 0; k < s; ++k) sum += mat[i*s + k] * in[k*s + j];
+            tmp[i*s + j] = sum;
+        }
+    }
+    for (i = 0; i < r; ++i) {
+        for (j = 0; j < r; ++j) {
+            float sum = 0;
+            for (k = 0; k < s; ++k) sum += tmp[i*s + k] * mat[j*s + k];
+            out[i*r + j] = sum;
+        }
+    }
+}
+
+// 1-D transforms, applied to the columns and then to the rows of a tile
+static inline void winograd_input_1d_2(const float *d, int ds, float *v, int vs)
+{
+    const float d0 = d[0], d1 = d[ds], d2 = d[2 * ds], d3 = d[3 * ds];
+    v[0] = d0 - d2;
+    v[vs] = d1 + d2;
+    v[2 * vs] = d2 - d1;
+    v[3 * vs] = d1 - d3;
+}
+
+static inline void winograd_input_1d_4(const float *d, int ds, float *v, int vs)
+{
+    const float d0 = d[0], d1 = d[ds], d2 = d[2 * ds], d3 = d[3 * ds], d4 = d[4 * ds], d5 = d[5 * ds];
+    v[0] = 4 * d0 - 5 * d2 + d4;
+    v[vs] = d3 + d4 - 4 * (d1 + d2);
+    v[2 * vs] = d4 - d3 + 4 * (d1 - d2);
+    v[3 * vs] = d4 - d2 + 2 * (d3 - d1);
+    v[4 * vs] = d4 - d2 + 2 * (d1 - d3);
+    v[5 * vs] = 4 * d1 - 5 * d3 + d5;
+}
+
+static inline void winograd_output_1d_2(const float *m, int ms, float *y, int ys)
+{
+    const float m0 = m[0], m1 = m[ms], m2 = m[2 * ms], m3 = m[3 * ms];
+    y[0] = m0 + m1 + m2;
+    y[ys] = m1 - m2 - m3;
+}
+
+static inline void winograd_output_1d_4(const float *m, int ms, float *y, int ys)
+{
+    const float m0 = m[0], m1 = m[ms], m2 = m[2 * ms], m3 = m[3 * ms], m4 = m[4 * ms], m5 = m[5 * ms];
+    const float a = m1 + m2, b = m1 - m2, c = m3 + m4, d = m3 - m4;
+    y[0] = m0 + a + c;
+    y[ys] = b + 2 * d;
+    y[2 * ys] = a + 4 * c;
+    y[3 * ys] = b + 8 * d + m5;
+}
+
+// v[alpha x alpha] = BT * d * B
+static inline void winograd_input_tile(int m, const float *d, float *v)
+{
+    float tmp[6 * 6];
+    int i;
+    if (m == 4) {
+        for (i = 0; i < 6; ++i) winograd_input_1d_4(d + i, 6, tmp + i, 6);
+        for (i = 0; i < 6; ++i) winograd_input_1d_4(tmp + i * 6, 1, v + i * 6, 1);
+    }
+    else {
+        for (i = 0; i < 4; ++i) winograd_input_1d_2(d + i, 4, tmp + i, 4);
+        for (i = 0; i < 4; ++i) winograd_input_1d_2(tmp + i * 4, 1, v + i * 4, 1);
+    }
+}
+
+// y[m x m] = AT * mm * A
+static inline void winograd_output_tile(int m, const float *mm, float *y)
+{
+    float tmp[4 * 6];
+    int i;
+    if (m == 4) {
+        for (i = 0; i < 6; ++i) winograd_output_1d_4(mm + i, 6, tmp + i, 6);
+        for (i = 0; i < 4; ++i) winograd_output_1d_4(tmp + i * 6, 1, y + i * 4, 1);
+    }
+    else {
+        for (i = 0; i < 4; ++i) winograd_output_1d_2(mm + i, 4, tmp + i, 4);
+        for (i = 0; i < 2; ++i) winograd_output_1d_2(tmp + i * 4, 1, y + i * 2, 1);
+    }
+}
+
+int winograd_tile_size(layer l)
+{
+    if (l.type != CONVOLUTIONAL || l.size != 3 || l.stride != 1) return 0;
+    if (l.xnor || l.binary) return 0;
+    // tiny maps leave the per-tile-element GEMMs too narrow to pay off
+    if (l.out_w*l.out_h < 100) return 0;
+    // small maps waste most of a 4x4 tile on padding, and the 4x larger
+    // transformed weights of their wide layers are not worth it
+    if (l.out_w < 24 || l.out_h < 24) return 2;
+    return 4;
+}
+
+void winograd_transform_weights(layer *l)
+{
+    const int m = l->winograd;
+    const int alpha = m + 2;
+    const float *G = (m == 4) ? G_4 : G_2;
+    const size_t nc = (size_t)l->n*l->c;
+    int f;
+
+    free(l->winograd_weights);
+    l->winograd_weights = calloc(alpha*alpha*nc, sizeof(float));
+
+    // laid out as alpha*alpha row-major (filters x channels) matrices
+    for (f = 0; f < l->n; ++f) {
+        int ch, xi;
+        for (ch = 0; ch < l->c; ++ch) {
+            float u[6 * 6];
+            winograd_sandwich(G, alpha, 3, l->weights + ((size_t)f*l->c + ch) * 9, u);
+            for (xi = 0; xi < alpha*alpha; ++xi) {
+                l->winograd_weights[xi*nc + (size_t)f*l->c + ch] = u[xi];
+            }
+        }
+    }
+}
+
+size_t get_winograd_workspace_size(layer l)
+{
+    const int m = l.winograd;
+    const int alpha = m + 2;
+    const int tiles = ((l.out_w + m - 1) / m) * ((l.out_h + m - 1) / m);
+    const int block = (tiles < WINOGRAD_TILE_BLOCK) ? tiles : WINOGRAD_TILE_BLOCK;
+    // transformed input (channels x tiles) and output (filters x tiles) per tile element
+    return (size_t)alpha*alpha*(l.c + l.n)*block * sizeof(float);
+}
+
+// one block of tiles of forward_winograd_convolution()
+typedef struct winograd_block {
+    const layer *l;
+    const float *input;
+    float *output;
+    float *V, *M;
+    int m, t0, tb, tiles_x, epilogue;
+} winograd_block;
+
+// input transform of channels [begin, end): V = BT * d * B
+static void winograd_input_channels(void *arg, int begin, int end)
+{
+    const winograd_block *a = (const winograd_block *)arg;
+    const layer *l = a->l;
+    const int m = a->m, alpha = m + 2, a2 = alpha*alpha;
+    const int t0 = a->t0, tb = a->tb, tiles_x = a->tiles_x;
+    float *V = a->V;
+    int ch;
+    for (ch = begin; ch < end; ++ch) {
+        const float *src = a->input + (size_t)ch*l->h*l->w;
+        float d[6 * 6], v[6 * 6];
+        int t, i, j, k;
+        for (t = 0; t < tb; ++t) {
+            const int y0 = ((t0 + t) / tiles_x) * m - l->pad;
+            const int x0 = ((t0 + t) % tiles_x) * m - l->pad;
+            if (y0 >= 0 && x0 >= 0 && y0 + alpha <= l->h && x0 + alpha <= l->w) {
+                for (i = 0; i < alpha; ++i) {
+                    for (j = 0; j < alpha; ++j) d[i*alpha + j] = src[(y0 + i)*l->w + x0 + j];
+                }
+            }
+            else {
+                for (i = 0; i < alpha; ++i) {
+                    const int y = y0 + i;
+                    for (j = 0; j < alpha; ++j) {
+                        const int x = x0 + j;
+                        d[i*alpha + j] = (y < 0 || x < 0 || y >= l->h || x >= l->w) ? 0 : src[y*l->w + x];
+                    }
+                }
+            }
+            winograd_input_tile(m, d, v);
+            for (k = 0; k < a2; ++k) V[((size_t)k*l->c + ch)*tb + t] = v[k];
+        }
+    }
+}
+
+// output transform of filters [begin, end): Y = AT * M * A
+static void winograd_output_filters(void *arg, int begin, int end)
+{
+    const winograd_block *a = (const winograd_block *)arg;
+    const layer *l = a->l;
+    const int m = a->m, alpha = m + 2, a2 = alpha*alpha;
+    const int t0 = a->t0, tb = a->tb, tiles_x = a->tiles_x, epilogue = a->epilogue;
+    const float *M = a->M;
+    int f;
+    for (f = begin; f < end; ++f) {
+        float *dst = a->output + (size_t)f*l->out_h*l->out_w;
+        float mm[6 * 6], y[4 * 4];
+        int t, i, j, k;
+        for (t = 0; t < tb; ++t) {
+            const int y0 = ((t0 + t) / tiles_x) * m;
+            const int x0 = ((t0 + t) % tiles_x) * m;
+            for (k = 0; k < a2; ++k) mm[k] = M[((size_t)k*l->n + f)*tb + t];
+            winograd_output_tile(m, mm, y);
+            if (epilogue) {
+                for (k = 0; k < m*m; ++k) {
+                    y[k] += l->biases[f];
+                    if (l->activation == LEAKY) y[k] = (y[k] < 0) ? .1f*y[k] : y[k];
+                    else if (l->activation != LINEAR) y[k] = activate(y[k], l->activation);
+                }
+            }
+            for (i = 0; i < m && y0 + i < l->out_h; ++i) {
+                for (j = 0; j < m && x0 + j < l->out_w; ++j) {
+                    dst[(y0 + i)*l->out_w + x0 + j] = y[i*m + j];
+                }
+            }
+        }
+    }
+}
+
+void forward_winograd_convolution(layer l, float *input, float *workspace, float *output, int epilogue)
+{
+    const int m = l.winograd;
+    const int alpha = m + 2;
+    const int a2 = alpha*alpha;
+    const int tiles_x = (l.out_w + m - 1) / m;
+    const int tiles_y = (l.out_h + m - 1) / m;
+    const int tiles = tiles_x*tiles_y;
+    int t0;
+
+    for (t0 = 0; t0 < tiles; t0 += WINOGRAD_TILE_BLOCK) {
+        const int tb = (tiles - t0 < WINOGRAD_TILE_BLOCK) ? (tiles - t0) : WINOGRAD_TILE_BLOCK;
+        float *V = workspace;                       // [a2][c][tb]
+        float *M = workspace + (size_t)a2*l.c*tb;   // [a2][n][tb]
+        int xi;
+
+        winograd_block block = { &l, input, output, V, M, m, t0, tb, tiles_x, epilogue };
+
+        parallel_for(l.c, 1, winograd_input_channels, &block);
+
+        // elementwise product summed over channels: one GEMM per tile element
+        memset(M, 0, (size_t)a2*l.n*tb * sizeof(float));
+        for (xi = 0; xi < a2; ++xi) {
+            gemm(0, 0, l.n, tb, l.c, 1,
+                l.winograd_weights + (size_t)xi*l.n*l.c, l.c,
+                V + (size_t)xi*l.c*tb, tb,
+                1,
+                M + (size_t)xi*l.n*tb, tb);
+        }
+
+        parallel_for(l.n, 1, winograd_output_filters, &block);
+    }
+}
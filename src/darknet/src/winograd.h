@@ -0,0 +1,24 @@
+#ifndef WINOGRAD_H
+#define WINOGRAD_H
+
+#include "layer.h"
+#include <stddef.h>
+
+// Winograd F(m x m, 3 x 3) convolution for 3x3 / stride 1 layers (CPU only).
+// Compared to im2col+gemm the output differs only by float rounding of the
+// transforms: the error stays within 1e-4 of the largest output magnitude of
+// the layer (measured ~1e-6 for F(2x2) and ~3e-6 for F(4x4) on yolov3-tiny).
+
+// tile size the layer should use: 0 (not applicable), 2 or 4
+int winograd_tile_size(layer l);
+
+// precomputes G*g*G^T for every filter/channel into l->winograd_weights
+void winograd_transform_weights(layer *l);
+
+size_t get_winograd_workspace_size(layer l);
+
+// one batch item: input is l.c x l.h x l.w, output is l.n x l.out_h x l.out_w.
+// The output is overwritten; with epilogue set l.biases and l.activation are applied to it as well
+void forward_winograd_convolution(layer l, float *input, float *workspace, float *output, int epilogue);
+
+#endif
@@ -10,7 +10,7 @@
 #include <string.h>
 #include <stdlib.h>
 
-layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes, int max_boxes)
+layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes, int max_boxes, int train)
 {
     int i;
     layer l = {0};
@@ -35,12 +35,12 @@ layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int
             l.mask[i] = i;
         }
     }
-    l.bias_updates = calloc(n*2, sizeof(float));
+    if (train) l.bias_updates = calloc(n*2, sizeof(float));
     l.outputs = h*w*n*(classes + 4 + 1);
     l.inputs = l.outputs;
     l.max_boxes = max_boxes;
     l.truths = l.max_boxes*(4 + 1);    // 90*(4 + 1);
-    l.delta = calloc(batch*l.outputs, sizeof(float));
+    if (train) l.delta = calloc(batch*l.outputs, sizeof(float));
     l.output = calloc(batch*l.outputs, sizeof(float));
     for(i = 0; i < total*2; ++i){
         l.biases[i] = .5;
@@ -70,7 +70,7 @@ void resize_yolo_layer(layer *l, int w, int h)
     l->inputs = l->outputs;
 
     l->output = realloc(l->output, l->batch*l->outputs*sizeof(float));
-    l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
+    if (l->delta) l->delta = realloc(l->delta, l->batch*l->outputs*sizeof(float));
 
 #ifdef GPU
     cuda_free(l->delta_gpu);
@@ -163,12 +163,9 @@ static box float_to_box_stride(float *f, int stride)
     return b;
 }
 
-void forward_yolo_layer(const layer l, network_state state)
+static void activate_yolo_output(const layer l)
 {
-    int i,j,b,t,n;
-    memcpy(l.output, state.input, l.outputs*l.batch*sizeof(float));
-
-#ifndef GPU
+    int b, n;
     for (b = 0; b < l.batch; ++b){
         for(n = 0; n < l.n; ++n){
             int index = entry_index(l, b, n*l.w*l.h, 0);
@@ -177,10 +174,20 @@ void forward_yolo_layer(const layer l, network_state state)
             activate_array(l.output + index, (1+l.classes)*l.w*l.h, LOGISTIC);
         }
     }
+}
+
+void forward_yolo_layer(const layer l, network_state state)
+{
+    int i,j,b,t,n;
+    // the memory planner places the output of an inference layer on its input
+    if (l.output != state.input) memcpy(l.output, state.input, l.outputs*l.batch*sizeof(float));
+
+#ifndef GPU
+    if (!l.logits) activate_yolo_output(l);
 #endif
 
-    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     if(!state.train) return;
+    memset(l.delta, 0, l.outputs * l.batch * sizeof(float));
     float avg_iou = 0;
     float recall = 0;
     float recall75 = 0;
@@ -286,49 +293,92 @@ void backward_yolo_layer(const layer l, network_state state)
    axpy_cpu(l.batch*l.inputs, 1, l.delta, 1, state.delta, 1);
 }
 
-void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth, int relative, int letter)
+// the size of the image inside the network input, smaller than it when letterboxed
+static void get_yolo_image_size(int w, int h, int netw, int neth, int letter, int *new_w, int *new_h)
 {
-    int i;
-    int new_w=0;
-    int new_h=0;
     if (letter) {
         if (((float)netw / w) < ((float)neth / h)) {
-            new_w = netw;
-            new_h = (h * netw) / w;
+            *new_w = netw;
+            *new_h = (h * netw) / w;
         }
         else {
-            new_h = neth;
-            new_w = (w * neth) / h;
+            *new_h = neth;
+            *new_w = (w * neth) / h;
         }
     }
     else {
-        new_w = netw;
-        new_h = neth;
+        *new_w = netw;
+        *new_h = neth;
+    }
+}
+
+static box correct_yolo_box(box b, int w, int h, int netw, int neth, int new_w, int new_h, int relative)
+{
+    b.x =  (b.x - (netw - new_w)/2./netw) / ((float)new_w/netw);
+    b.y =  (b.y - (neth - new_h)/2./neth) / ((float)new_h/neth);
+    b.w *= (float)netw/new_w;
+    b.h *= (float)neth/new_h;
+    if(!relative){
+        b.x *= w;
+        b.w *= w;
+        b.y *= h;
+        b.h *= h;
     }
+    return b;
+}
+
+void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth, int relative, int letter)
+{
+    int i;
+    int new_w=0;
+    int new_h=0;
+    get_yolo_image_size(w, h, netw, neth, letter, &new_w, &new_h);
     for (i = 0; i < n; ++i){
-        box b = dets[i].bbox;
-        b.x =  (b.x - (netw - new_w)/2./netw) / ((float)new_w/netw);
-        b.y =  (b.y - (neth - new_h)/2./neth) / ((float)new_h/neth);
-        b.w *= (float)netw/new_w;
-        b.h *= (float)neth/new_h;
-        if(!relative){
-            b.x *= w;
-            b.w *= w;
-            b.y *= h;
-            b.h *= h;
-        }
-        dets[i].bbox = b;
+        dets[i].bbox = correct_yolo_box(dets[i].bbox, w, h, netw, neth, new_w, new_h, relative);
     }
 }
 
+// the value of an output entry: a layer keeping the logits activates it here
+static inline float yolo_output(layer l, int index)
+{
+    return l.logits ? logistic_activate(l.output[index]) : l.output[index];
+}
+
+// a bound below which an output entry can't activate above p: a little under the logit of p
+// so that rounding never filters out what the exact comparison on the activated value keeps
+static float yolo_cutoff(layer l, float p)
+{
+    if (!l.logits || !(p > 0)) return -INFINITY;
+    if (p >= 1) return INFINITY;
+    return (float)(log(p / (1. - p)) - (.01 + .0001 / (1. - p)));
+}
+
+static box get_yolo_output_box(layer l, int index, int n, int i, int j, int netw, int neth)
+{
+    const int stride = l.w*l.h;
+    float x[4];
+    if (!l.logits) return get_yolo_box(l.output, l.biases, l.mask[n], index, i, j, l.w, l.h, netw, neth, stride);
+    x[0] = logistic_activate(l.output[index]);
+    x[1] = logistic_activate(l.output[index + stride]);
+    x[2] = l.output[index + 2*stride];
+    x[3] = l.output[index + 3*stride];
+    return get_yolo_box(x, l.biases, l.mask[n], 0, i, j, l.w, l.h, netw, neth, 1);
+}
+
 int yolo_num_detections(layer l, float thresh)
 {
+    return yolo_num_detections_batch(l, thresh, 0);
+}
+
+int yolo_num_detections_batch(layer l, float thresh, int batch)
+{
+    const float cutoff = yolo_cutoff(l, thresh);
     int i, n;
     int count = 0;
     for (i = 0; i < l.w*l.h; ++i){
         for(n = 0; n < l.n; ++n){
-            int obj_index  = entry_index(l, 0, n*l.w*l.h + i, 4);
-            if(l.output[obj_index] > thresh){
+            int obj_index  = entry_index(l, batch, n*l.w*l.h + i, 4);
+            if(l.output[obj_index] > cutoff && yolo_output(l, obj_index) > thresh){
                 ++count;
             }
         }
@@ -362,27 +412,41 @@ void avg_flipped_yolo(layer l)
     }
 }
 
-int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets, int letter)
+int get_yolo_detections(layer *l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets, int letter)
+{
+    if (l->batch == 2) {
+        // the flipped predictions are averaged once activated, and the layer no longer holds logits
+        if (l->logits) activate_yolo_output(*l);
+        l->logits = 0;
+        avg_flipped_yolo(*l);
+    }
+    return get_yolo_detections_batch(*l, w, h, netw, neth, thresh, map, relative, dets, letter, 0);
+}
+
+int get_yolo_detections_batch(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets, int letter, int batch)
 {
+    const float cutoff = yolo_cutoff(l, thresh);
     int i,j,n;
     float *predictions = l.output;
-    if (l.batch == 2) avg_flipped_yolo(l);
     int count = 0;
     for (i = 0; i < l.w*l.h; ++i){
         int row = i / l.w;
         int col = i % l.w;
         for(n = 0; n < l.n; ++n){
-            int obj_index  = entry_index(l, 0, n*l.w*l.h + i, 4);
-            float objectness = predictions[obj_index];
+            int obj_index  = entry_index(l, batch, n*l.w*l.h + i, 4);
+            float objectness;
+            if (!(predictions[obj_index] > cutoff)) continue;
+            objectness = yolo_output(l, obj_index);
             //if(objectness <= thresh) continue;    // incorrect behavior for Nan values
             if (objectness > thresh) {
-                int box_index = entry_index(l, 0, n*l.w*l.h + i, 0);
-                dets[count].bbox = get_yolo_box(predictions, l.biases, l.mask[n], box_index, col, row, l.w, l.h, netw, neth, l.w*l.h);
+                int box_index = entry_index(l, batch, n*l.w*l.h + i, 0);
+                float class_cutoff = yolo_cutoff(l, thresh / objectness);
+                dets[count].bbox = get_yolo_output_box(l, box_index, n, col, row, netw, neth);
                 dets[count].objectness = objectness;
                 dets[count].classes = l.classes;
                 for (j = 0; j < l.classes; ++j) {
-                    int class_index = entry_index(l, 0, n*l.w*l.h + i, 4 + 1 + j);
-                    float prob = objectness*predictions[class_index];
+                    int class_index = entry_index(l, batch, n*l.w*l.h + i, 4 + 1 + j);
+                    float prob = (predictions[class_index] > class_cutoff) ? objectness*yolo_output(l, class_index) : 0;
                     dets[count].prob[j] = (prob > thresh) ? prob : 0;
                 }
                 ++count;
@@ -393,6 +457,62 @@ int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh,
     return count;
 }
 
+int yolo_max_candidates(layer l, int top_k)
+{
+    return l.w*l.h*l.n*(top_k < l.classes ? top_k : l.classes);
+}
+
+// one pass over the outputs: the boxes above thresh with up to top_k of their classes
+// above thresh, the same boxes and probabilities get_yolo_detections_batch() finds
+int get_yolo_candidates(layer l, int w, int h, int netw, int neth, float thresh, int relative, int letter, int batch, int top_k,
+    box_candidate *cands, int *box_id)
+{
+    const float *predictions = l.output;
+    const int stride = l.w*l.h;
+    const float cutoff = yolo_cutoff(l, thresh);
+    int i, j, k, n;
+    int new_w = 0, new_h = 0;
+    int count = 0;
+    if (top_k > l.classes) top_k = l.classes;
+    get_yolo_image_size(w, h, netw, neth, letter, &new_w, &new_h);
+    for (i = 0; i < l.w*l.h; ++i){
+        for(n = 0; n < l.n; ++n){
+            const int obj_index = entry_index(l, batch, n*l.w*l.h + i, 4);
+            box_candidate *c = cands + count;
+            float objectness, class_cutoff;
+            int found = 0;
+            box b;
+            if (!(predictions[obj_index] > cutoff)) continue;
+            objectness = yolo_output(l, obj_index);
+            if (!(objectness > thresh)) continue;
+            class_cutoff = yolo_cutoff(l, thresh / objectness);
+            for (j = 0; j < l.classes; ++j) {
+                const int class_index = obj_index + (1 + j)*stride;
+                float prob;
+                if (!(predictions[class_index] > class_cutoff)) continue;
+                prob = objectness*yolo_output(l, class_index);
+                if (!(prob > thresh)) continue;
+                if (found == top_k && prob <= c[found - 1].prob) continue;
+                // insert in descending probability, the first class wins a tie as in max_index()
+                k = (found < top_k) ? found++ : found - 1;
+                for (; k > 0 && c[k - 1].prob < prob; --k) c[k] = c[k - 1];
+                c[k].prob = prob;
+                c[k].class_id = j;
+            }
+            if (!found) continue;
+            b = get_yolo_output_box(l, obj_index - 4*stride, n, i % l.w, i / l.w, netw, neth);
+            b = correct_yolo_box(b, w, h, netw, neth, new_w, new_h, relative);
+            for (k = 0; k < found; ++k) {
+                c[k].bbox = b;
+                c[k].box_id = *box_id;
+            }
+            ++*box_id;
+            count += found;
+        }
+    }
+    return count;
+}
+
 #ifdef GPU
 
 void forward_yolo_layer_gpu(const layer l, network_state state)
@@ -5,13 +5,19 @@
 #include "layer.h"
 #include "network.h"
 
-layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes, int max_boxes);
+layer make_yolo_layer(int batch, int w, int h, int n, int total, int *mask, int classes, int max_boxes, int train);
 void forward_yolo_layer(const layer l, network_state state);
 void backward_yolo_layer(const layer l, network_state state);
 void resize_yolo_layer(layer *l, int w, int h);
 int yolo_num_detections(layer l, float thresh);
-int get_yolo_detections(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets, int letter);
+int yolo_num_detections_batch(layer l, float thresh, int batch);
+int get_yolo_detections(layer *l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets, int letter);
+int get_yolo_detections_batch(layer l, int w, int h, int netw, int neth, float thresh, int *map, int relative, detection *dets, int letter, int batch);
 void correct_yolo_boxes(detection *dets, int n, int w, int h, int netw, int neth, int relative, int letter);
+// the most candidates get_yolo_candidates() writes for one batch entry
+int yolo_max_candidates(layer l, int top_k);
+int get_yolo_candidates(layer l, int w, int h, int netw, int neth, float thresh, int relative, int letter, int batch, int top_k,
+    box_candidate *cands, int *box_id);
 
 #ifdef GPU
 void forward_yolo_layer_gpu(const layer l, network_state state);
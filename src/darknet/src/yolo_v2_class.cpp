@@ -13,12 +13,27 @@ extern "C" {
 #include "demo.h"
 #include "option_list.h"
 #include "stb_image.h"
+#include "quantize.h"
+#include "dnpack.h"
+#include "threadpool.h"
+#include "memplan.h"
+#include "nms.h"
 }
 //#include <sys/time.h>
 
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <limits>
+#include <cctype>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
 
 #define FRAMES 3
 
@@ -91,16 +106,165 @@ void check_cuda(cudaError_t status) {
 }
 #endif
 
+// what one forward pass writes: the activations and workspace of net and the input it reads.
+// Used by one call at a time, the weights are shared with the model.
+struct detector_context_t {
+    network *net;               // the model network or a context made from it
+    float *input;               // network input of max_batch images, filled in place by the resizer
+    packed_resizer resizer;
+    int max_batch;              // number of images the network and input buffers are allocated for
+    bool model;                 // net is the model network itself
+    std::vector<box_candidate> candidates;  // decoded boxes, sized once from the [yolo] layers
+    nms_arena nms;
+};
+
 struct detector_gpu_t {
-    network net;
+    network net;                // the model: parsed cfg and fused weights
     image images[FRAMES];
     float *avg;
     float *predictions[FRAMES];
     int demo_index;
     unsigned int *track_id;
+    bool reentrant;             // contexts are made from net, which then keeps its batch of 1
+    std::mutex mutex;           // guards the contexts, the profile and the use_mean history
+    network_profile *profile;   // what enable_profiling() collects, contexts merge their passes into it
+    std::condition_variable context_released;
+    std::vector<detector_context_t *> contexts;
+    std::vector<detector_context_t *> idle;
+    std::vector<packed_resizer> resizers;   // idle ones of preprocess(), guarded by mutex
+};
+
+// image files directly inside dir, sorted by name
+static std::vector<std::string> list_images(const std::string &dir)
+{
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &fd);
+    if (h != INVALID_HANDLE_VALUE) {
+        do names.push_back(fd.cFileName); while (FindNextFileA(h, &fd));
+        FindClose(h);
+    }
+#else
+    if (DIR *d = opendir(dir.c_str())) {
+        while (struct dirent *e = readdir(d)) names.push_back(e->d_name);
+        closedir(d);
+    }
+#endif
+    std::vector<std::string> images;
+    for (auto &name : names) {
+        std::string ext = name.substr(name.find_last_of('.') + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (name.find('.') != std::string::npos && (ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "bmp"))
+            images.push_back(dir + "/" + name);
+    }
+    std::sort(images.begin(), images.end());
+    return images;
+}
+
+// grows the network buffers only when a bigger batch than ever before is requested
+static void set_detector_batch(detector_context_t &ctx, int batch)
+{
+    network &net = *ctx.net;
+    if (batch > ctx.max_batch) {
+        resize_network_batch(&net, batch);
+        free(ctx.input);
+        ctx.input = (float *)calloc((size_t)batch*net.w*net.h*net.c, sizeof(float));
+        ctx.max_batch = batch;
+    }
+    else if (net.batch != batch) {
+        set_batch_network(&net, batch);
+    }
+}
+
+// NULL when contexts cannot be made from the model network
+static detector_context_t *make_detector_context(network &net, bool model)
+{
+    detector_context_t *ctx = new detector_context_t();
+    if (model) ctx->net = &net;
+    else {
+        ctx->net = new network();
+        if (!make_network_context(&net, ctx->net)) {
+            delete ctx->net;
+            delete ctx;
+            return NULL;
+        }
+    }
+    ctx->input = (float *)calloc((size_t)net.batch*net.w*net.h*net.c, sizeof(float));
+    ctx->resizer = make_packed_resizer(net.w, net.h, net.c);
+    ctx->max_batch = net.batch;
+    ctx->model = model;
+    return ctx;
+}
+
+static void free_detector_context(detector_context_t *ctx)
+{
+    if (!ctx->model) {
+        free_network_profile(ctx->net->profile);
+        free_network_context(ctx->net);
+        delete ctx->net;
+    }
+    free(ctx->input);
+    free_packed_resizer(ctx->resizer);
+    free_nms_arena(&ctx->nms);
+    delete ctx;
+}
+
+// borrows an idle execution context for the duration of one call. Calls running at the same time
+// get contexts of their own, made on first use and kept for the next calls; the model network is
+// the first one. Without contexts (GPU, networks the memory planner skips) the calls take turns on it.
+class context_lease {
+    detector_gpu_t &detector_gpu;
+public:
+    detector_context_t *ctx;
+
+    context_lease(detector_gpu_t &detector_gpu, int batch) : detector_gpu(detector_gpu), ctx(NULL)
+    {
+        std::unique_lock<std::mutex> lock(detector_gpu.mutex);
+        while (!ctx) {
+            for (size_t i = detector_gpu.idle.size(); i-- > 0;) {
+                detector_context_t *c = detector_gpu.idle[i];
+                // new contexts are copies of the model, so it keeps its batch of 1
+                if (detector_gpu.reentrant && c->model && batch > 1) continue;
+                ctx = c;
+                detector_gpu.idle.erase(detector_gpu.idle.begin() + i);
+                break;
+            }
+            if (ctx) break;
+            if (detector_gpu.reentrant) {
+                ctx = make_detector_context(detector_gpu.net, false);
+                if (ctx) detector_gpu.contexts.push_back(ctx);
+                else detector_gpu.reentrant = false;
+            }
+            else detector_gpu.context_released.wait(lock);
+        }
+        // a context records the pass of this call on its own and merges it into the profile on release
+        network &net = *ctx->net;
+        if (network_profile_active(detector_gpu.profile)) {
+            if (!net.profile) net.profile = make_network_profile(net.n, 1);
+            reset_network_profile(net.profile);
+        }
+        else {
+            free_network_profile(net.profile);
+            net.profile = NULL;
+        }
+        lock.unlock();
+        set_detector_batch(*ctx, batch);
+    }
+
+    ~context_lease()
+    {
+        {
+            std::lock_guard<std::mutex> guard(detector_gpu.mutex);
+            if (ctx->net->profile && detector_gpu.profile) merge_network_profile(detector_gpu.profile, ctx->net->profile);
+            detector_gpu.idle.push_back(ctx);
+        }
+        detector_gpu.context_released.notify_one();
+    }
 };
 
-YOLODLL_API Detector::Detector(std::string cfg_filename, std::string weight_filename, int gpu_id) : cur_gpu_id(gpu_id)
+YOLODLL_API Detector::Detector(std::string cfg_filename, std::string weight_filename, int gpu_id,
+    std::string int8_calibration_dir) : cur_gpu_id(gpu_id)
 {
     wait_stream = 0;
     int old_gpu_index;
@@ -123,13 +287,34 @@ YOLODLL_API Detector::Detector(std::string cfg_filename, std::string weight_file
     char *cfgfile = const_cast<char *>(cfg_filename.data());
     char *weightfile = const_cast<char *>(weight_filename.data());
 
-    net = parse_network_cfg_custom(cfgfile, 1);
-    if (weightfile) {
+    net = parse_network_cfg_inference(cfgfile, 1);
+    // the detector only reads the outputs of the [yolo] layers, through the decoders, and the
+    // others share one arena
+    keep_network_logits(&net);
+    plan_network_memory(&net);
+    if (is_dnpack_file(weightfile)) {
+        if (!load_dnpack(&net, weightfile)) {
+            free_network(net);
+            throw std::runtime_error("Couldn't load " + weight_filename);
+        }
+    }
+    else if (!weight_filename.empty()) {
         load_weights(&net, weightfile);
     }
     set_batch_network(&net, 1);
     net.gpu_index = cur_gpu_id;
     fuse_conv_batchnorm(net);
+    calculate_winograd_weights(&net);
+    if (!int8_calibration_dir.empty()) {
+        std::vector<std::string> images = list_images(int8_calibration_dir);
+        if (images.empty()) {
+            free_network(net);
+            throw std::runtime_error("No calibration images found in " + int8_calibration_dir);
+        }
+        std::vector<char *> paths;
+        for (auto &i : images) paths.push_back(const_cast<char *>(i.c_str()));
+        quantize_network_int8(&net, paths.data(), (int)paths.size());
+    }
 
     layer l = net.layers[net.n - 1];
     int j;
@@ -141,6 +326,11 @@ YOLODLL_API Detector::Detector(std::string cfg_filename, std::string weight_file
     detector_gpu.track_id = (unsigned int *)calloc(l.classes, sizeof(unsigned int));
     for (j = 0; j < l.classes; ++j) detector_gpu.track_id[j] = 1;
 
+    detector_gpu.reentrant = true;
+    detector_context_t *ctx = make_detector_context(net, true);
+    detector_gpu.contexts.push_back(ctx);
+    detector_gpu.idle.push_back(ctx);
+
 #ifdef GPU
     check_cuda( cudaSetDevice(old_gpu_index) );
 #endif
@@ -153,6 +343,9 @@ YOLODLL_API Detector::~Detector()
     layer l = detector_gpu.net.layers[detector_gpu.net.n - 1];
 
     free(detector_gpu.track_id);
+    for (auto ctx : detector_gpu.contexts) free_detector_context(ctx);
+    for (auto &resizer : detector_gpu.resizers) free_packed_resizer(resizer);
+    free_network_profile(detector_gpu.profile);
 
     free(detector_gpu.avg);
     for (int j = 0; j < FRAMES; ++j) free(detector_gpu.predictions[j]);
@@ -190,6 +383,61 @@ YOLODLL_API int Detector::get_num_classes() const {
     return l.classes;
 }
 
+YOLODLL_API bool Detector::save_dnpack(std::string filename) {
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    return ::save_dnpack(&detector_gpu.net, const_cast<char *>(filename.c_str())) != 0;
+}
+
+YOLODLL_API void Detector::enable_profiling(int frames) {
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    std::lock_guard<std::mutex> guard(detector_gpu.mutex);
+    free_network_profile(detector_gpu.profile);
+    detector_gpu.profile = make_network_profile(detector_gpu.net.n, frames);
+}
+
+YOLODLL_API void Detector::disable_profiling() {
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    std::lock_guard<std::mutex> guard(detector_gpu.mutex);
+    free_network_profile(detector_gpu.profile);
+    detector_gpu.profile = NULL;
+}
+
+YOLODLL_API network_profile_t Detector::get_profile() const {
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    network &net = detector_gpu.net;
+    network_profile_t result = { 0, 0 };
+    std::lock_guard<std::mutex> guard(detector_gpu.mutex);
+    network_profile *p = detector_gpu.profile;
+    if (!p || !p->frames) return result;
+
+    result.frames = p->frames;
+    result.avg_ms = p->total_time * 1000 / p->frames;
+    for (int i = 0; i < p->n; ++i) {
+        layer_profile const &lp = p->layers[i];
+        double const avg = lp.total_time / p->frames;
+        layer_profile_t l;
+        l.index = i;
+        l.type = get_layer_string(net.layers[i].type);
+        l.avg_ms = avg * 1000;
+        l.min_ms = lp.min_time * 1000;
+        l.max_ms = lp.max_time * 1000;
+        l.bflops = lp.bflops;
+        l.gflops_per_s = (avg > 0) ? lp.bflops / avg : 0;
+        l.bytes = lp.bytes;
+        l.gbytes_per_s = (avg > 0) ? lp.bytes / avg / 1e9 : 0;
+        result.layers.push_back(l);
+    }
+    return result;
+}
+
+YOLODLL_API bool Detector::save_profile_trace(std::string filename) const {
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    std::lock_guard<std::mutex> guard(detector_gpu.mutex);
+    network net = detector_gpu.net;
+    net.profile = detector_gpu.profile;
+    return dump_network_profile_trace(&net, filename.c_str()) != 0;
+}
+
 YOLODLL_API std::vector<bbox_t> Detector::detect(std::string image_filename, float thresh, bool use_mean)
 {
     std::shared_ptr<image_t> image_ptr(new image_t, [](image_t *img) { if (img->data) free(img->data); delete img; });
@@ -241,21 +489,99 @@ YOLODLL_API void Detector::free_image(image_t m)
     }
 }
 
+static bbox_t get_bbox(box b, int w, int h, int obj_id, float prob)
+{
+    bbox_t bbox;
+    bbox.x = std::max((double)0, (b.x - b.w / 2.)*w);
+    bbox.y = std::max((double)0, (b.y - b.h / 2.)*h);
+    bbox.w = b.w*w;
+    bbox.h = b.h*h;
+    bbox.obj_id = obj_id;
+    bbox.prob = prob;
+    bbox.track_id = 0;
+    return bbox;
+}
+
+// the classes of a box are in descending probability, the first one NMS left is its best
+static void append_candidates(std::vector<bbox_t> &bbox_vec, box_candidate const *cands, int count, int w, int h, float thresh)
+{
+    for (int i = 0; i < count;) {
+        int j = i;
+        bool found = false;
+        for (; j < count && cands[j].box_id == cands[i].box_id; ++j) {
+            if (!found && cands[j].prob > thresh) {
+                bbox_vec.push_back(get_bbox(cands[j].bbox, w, h, cands[j].class_id, cands[j].prob));
+                found = true;
+            }
+        }
+        i = j;
+    }
+}
+
+static std::vector<bbox_t> get_bbox_vec(detector_gpu_t &detector_gpu, detector_context_t &ctx, float *prediction, int w, int h, float thresh, float nms, bool use_mean, int batch = 0)
+{
+    network &net = *ctx.net;
+    layer l = net.layers[net.n - 1];
+
+    if (use_mean) {
+        std::lock_guard<std::mutex> guard(detector_gpu.mutex);
+        memcpy(detector_gpu.predictions[detector_gpu.demo_index], prediction, l.outputs * sizeof(float));
+        mean_arrays(detector_gpu.predictions, FRAMES, l.outputs, detector_gpu.avg);
+        l.output = detector_gpu.avg;
+        detector_gpu.demo_index = (detector_gpu.demo_index + 1) % FRAMES;
+    }
+    //get_region_boxes(l, 1, 1, thresh, detector_gpu.probs, detector_gpu.boxes, 0, 0);
+    //if (nms) do_nms_sort(detector_gpu.boxes, detector_gpu.probs, l.w*l.h*l.n, l.classes, nms);
+
+    int nboxes = 0;
+    int letterbox = 0;
+    float hier_thresh = 0.5;
+    std::vector<bbox_t> bbox_vec;
+
+    // [yolo] outputs are decoded in one pass into the buffers of the context, nothing is allocated per box.
+    // Every class above thresh is kept: the best one is reported, the next ones stand in when NMS suppresses it
+    int const max_candidates = max_network_candidates(&net, l.classes);
+    if (max_candidates >= 0) {
+        if (ctx.candidates.size() < (size_t)max_candidates) ctx.candidates.resize(max_candidates);
+        box_candidate *cands = ctx.candidates.data();
+        int const count = get_network_candidates(&net, w, h, thresh, 1, letterbox, batch, l.classes, cands);
+        if (nms) do_nms_candidates(cands, count, l.classes, nms, &ctx.nms);
+        append_candidates(bbox_vec, cands, count, w, h, thresh);
+        return bbox_vec;
+    }
+
+    detection *dets = (net.batch > 1) ?
+        get_network_boxes_batch(&net, w, h, thresh, hier_thresh, 0, 1, &nboxes, letterbox, batch) :
+        get_network_boxes(&net, w, h, thresh, hier_thresh, 0, 1, &nboxes, letterbox);
+    if (nms) do_nms_sort(dets, nboxes, l.classes, nms);
+
+    for (size_t i = 0; i < nboxes; ++i) {
+        int const obj_id = max_index(dets[i].prob, l.classes);
+        float const prob = dets[i].prob[obj_id];
+        if (prob > thresh) bbox_vec.push_back(get_bbox(dets[i].bbox, w, h, obj_id, prob));
+    }
+
+    free_detections(dets, nboxes);
+    return bbox_vec;
+}
+
 YOLODLL_API std::vector<bbox_t> Detector::detect(image_t img, float thresh, bool use_mean)
 {
     detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
-    network &net = detector_gpu.net;
     int old_gpu_index;
 #ifdef GPU
     cudaGetDevice(&old_gpu_index);
     if(cur_gpu_id != old_gpu_index)
-        cudaSetDevice(net.gpu_index);
-
-    net.wait_stream = wait_stream;    // 1 - wait CUDA-stream, 0 - not to wait
+        cudaSetDevice(detector_gpu.net.gpu_index);
 #endif
     //std::cout << "net.gpu_index = " << net.gpu_index << std::endl;
 
     //float nms = .4;
+    context_lease lease(detector_gpu, 1);
+    network &net = *lease.ctx->net;
+#ifdef GPU
+    net.wait_stream = wait_stream;    // 1 - wait CUDA-stream, 0 - not to wait
+#endif
 
     image im;
     im.c = img.c;
@@ -263,67 +589,399 @@ YOLODLL_API std::vector<bbox_t> Detector::detect(image_t img, float thresh, bool
     im.h = img.h;
     im.w = img.w;
 
-    image sized;
-    
-    if (net.w == im.w && net.h == im.h) {
-        sized = make_image(im.w, im.h, im.c);
-        memcpy(sized.data, im.data, im.w*im.h*im.c * sizeof(float));
-    }
-    else
+    // the network only reads its input, so an image of the right size is used as is
+    image sized = { 0 };
+    float *X = im.data;
+    if (net.w != im.w || net.h != im.h) {
         sized = resize_image(im, net.w, net.h);
+        X = sized.data;
+    }
 
-    layer l = net.layers[net.n - 1];
+    float *prediction = network_predict(net, X);
+    std::vector<bbox_t> bbox_vec = get_bbox_vec(detector_gpu, *lease.ctx, prediction, im.w, im.h, thresh, nms, use_mean);
 
-    float *X = sized.data;
+    if(sized.data)
+        free(sized.data);
 
-    float *prediction = network_predict(net, X);
+#ifdef GPU
+    if (cur_gpu_id != old_gpu_index)
+        cudaSetDevice(old_gpu_index);
+#endif
 
-    if (use_mean) {
-        memcpy(detector_gpu.predictions[detector_gpu.demo_index], prediction, l.outputs * sizeof(float));
-        mean_arrays(detector_gpu.predictions, FRAMES, l.outputs, detector_gpu.avg);
-        l.output = detector_gpu.avg;
-        detector_gpu.demo_index = (detector_gpu.demo_index + 1) % FRAMES;
+    return bbox_vec;
+}
+
+YOLODLL_API std::vector<bbox_t> Detector::detect(pixels_t pixels, float thresh, bool use_mean)
+{
+    if (pixels.data == NULL)
+        throw std::runtime_error("Image is empty");
+
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    if (detector_gpu.net.c != 3)
+        throw std::runtime_error("pixels_t input needs a 3-channel network");
+    int old_gpu_index;
+#ifdef GPU
+    cudaGetDevice(&old_gpu_index);
+    if(cur_gpu_id != old_gpu_index)
+        cudaSetDevice(detector_gpu.net.gpu_index);
+#endif
+
+    context_lease lease(detector_gpu, 1);
+    detector_context_t &ctx = *lease.ctx;
+    network &net = *ctx.net;
+#ifdef GPU
+    net.wait_stream = wait_stream;    // 1 - wait CUDA-stream, 0 - not to wait
+#endif
+
+    int const offsets[3] = { pixels.r, pixels.g, pixels.b };
+    resize_packed_into(&ctx.resizer, pixels.data, pixels.w, pixels.h, pixels.row_bytes, pixels.pixel_inc,
+        offsets, ctx.input);
+
+    float *prediction = network_predict(net, ctx.input);
+    std::vector<bbox_t> bbox_vec = get_bbox_vec(detector_gpu, *lease.ctx, prediction, pixels.w, pixels.h, thresh, nms, use_mean);
+
+#ifdef GPU
+    if (cur_gpu_id != old_gpu_index)
+        cudaSetDevice(old_gpu_index);
+#endif
+
+    return bbox_vec;
+}
+
+YOLODLL_API std::vector<bbox_t> Detector::detect_preprocessed(float const *input, int init_w, int init_h, float thresh, bool use_mean)
+{
+    if (input == NULL)
+        throw std::runtime_error("Image is empty");
+
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    int old_gpu_index;
+#ifdef GPU
+    cudaGetDevice(&old_gpu_index);
+    if(cur_gpu_id != old_gpu_index)
+        cudaSetDevice(detector_gpu.net.gpu_index);
+#endif
+
+    context_lease lease(detector_gpu, 1);
+    network &net = *lease.ctx->net;
+#ifdef GPU
+    net.wait_stream = wait_stream;    // 1 - wait CUDA-stream, 0 - not to wait
+#endif
+
+    // the network only reads its input
+    float *prediction = network_predict(net, const_cast<float *>(input));
+    std::vector<bbox_t> bbox_vec = get_bbox_vec(detector_gpu, *lease.ctx, prediction, init_w, init_h, thresh, nms, use_mean);
+
+#ifdef GPU
+    if (cur_gpu_id != old_gpu_index)
+        cudaSetDevice(old_gpu_index);
+#endif
+
+    return bbox_vec;
+}
+
+YOLODLL_API void Detector::preprocess(pixels_t pixels, float *input) const
+{
+    if (pixels.data == NULL)
+        throw std::runtime_error("Image is empty");
+
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    network &net = detector_gpu.net;
+    if (net.c != 3)
+        throw std::runtime_error("pixels_t input needs a 3-channel network");
+
+    // a resizer of its own keeps this independent of detect() running on another thread,
+    // calls running at once take one each and leave it for the next calls
+    packed_resizer resizer;
+    bool pooled = false;
+    {
+        std::lock_guard<std::mutex> guard(detector_gpu.mutex);
+        if (!detector_gpu.resizers.empty()) {
+            resizer = detector_gpu.resizers.back();
+            detector_gpu.resizers.pop_back();
+            pooled = true;
+        }
     }
-    //get_region_boxes(l, 1, 1, thresh, detector_gpu.probs, detector_gpu.boxes, 0, 0);
-    //if (nms) do_nms_sort(detector_gpu.boxes, detector_gpu.probs, l.w*l.h*l.n, l.classes, nms);
+    if (!pooled) resizer = make_packed_resizer(net.w, net.h, net.c);
+    int const offsets[3] = { pixels.r, pixels.g, pixels.b };
+    resize_packed_into(&resizer, pixels.data, pixels.w, pixels.h, pixels.row_bytes, pixels.pixel_inc, offsets, input);
+    std::lock_guard<std::mutex> guard(detector_gpu.mutex);
+    detector_gpu.resizers.push_back(resizer);
+}
 
-    int nboxes = 0;
-    int letterbox = 0;
-    float hier_thresh = 0.5;
-    detection *dets = get_network_boxes(&net, im.w, im.h, thresh, hier_thresh, 0, 1, &nboxes, letterbox);
-    if (nms) do_nms_sort(dets, nboxes, l.classes, nms);
+YOLODLL_API std::vector<std::vector<bbox_t> > Detector::detect_batch(const std::vector<image_t> &imgs, float thresh)
+{
+    std::vector<std::vector<bbox_t> > bbox_vecs;
+    if (imgs.empty()) return bbox_vecs;
 
-    std::vector<bbox_t> bbox_vec;
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    network &model = detector_gpu.net;
+    // only [yolo] layers keep separate results per batch entry
+    if (model.layers[model.n - 1].type != YOLO) {
+        for (auto &img : imgs) bbox_vecs.push_back(detect(img, thresh));
+        return bbox_vecs;
+    }
+    for (auto &img : imgs) {
+        if (img.data == NULL)
+            throw std::runtime_error("Image is empty");
+    }
+    int old_gpu_index;
+#ifdef GPU
+    cudaGetDevice(&old_gpu_index);
+    if(cur_gpu_id != old_gpu_index)
+        cudaSetDevice(model.gpu_index);
+#endif
 
-    for (size_t i = 0; i < nboxes; ++i) {
-        box b = dets[i].bbox;
-        int const obj_id = max_index(dets[i].prob, l.classes);
-        float const prob = dets[i].prob[obj_id];
-        
-        if (prob > thresh) 
-        {
-            bbox_t bbox;
-            bbox.x = std::max((double)0, (b.x - b.w / 2.)*im.w);
-            bbox.y = std::max((double)0, (b.y - b.h / 2.)*im.h);
-            bbox.w = b.w*im.w;
-            bbox.h = b.h*im.h;
-            bbox.obj_id = obj_id;
-            bbox.prob = prob;
-            bbox.track_id = 0;
-
-            bbox_vec.push_back(bbox);
+    int const batch = imgs.size();
+    context_lease lease(detector_gpu, batch);
+    detector_context_t &ctx = *lease.ctx;
+    network &net = *ctx.net;
+#ifdef GPU
+    net.wait_stream = wait_stream;    // 1 - wait CUDA-stream, 0 - not to wait
+#endif
+    size_t const input_size = net.w*net.h*net.c;
+    for (int b = 0; b < batch; ++b) {
+        image im;
+        im.c = imgs[b].c;
+        im.data = imgs[b].data;
+        im.h = imgs[b].h;
+        im.w = imgs[b].w;
+        if (net.w == im.w && net.h == im.h) {
+            memcpy(ctx.input + b*input_size, im.data, input_size * sizeof(float));
+        }
+        else {
+            image sized = resize_image(im, net.w, net.h);
+            memcpy(ctx.input + b*input_size, sized.data, input_size * sizeof(float));
+            free(sized.data);
         }
     }
 
-    free_detections(dets, nboxes);
-    if(sized.data)
-        free(sized.data);
+    float *prediction = network_predict(net, ctx.input);
+    for (int b = 0; b < batch; ++b) {
+        bbox_vecs.push_back(get_bbox_vec(detector_gpu, *lease.ctx, prediction, imgs[b].w, imgs[b].h, thresh, nms, false, b));
+    }
 
 #ifdef GPU
     if (cur_gpu_id != old_gpu_index)
         cudaSetDevice(old_gpu_index);
 #endif
 
+    return bbox_vecs;
+}
+
+YOLODLL_API std::vector<std::vector<bbox_t> > Detector::detect_batch(const std::vector<pixels_t> &pixels, float thresh)
+{
+    std::vector<std::vector<bbox_t> > bbox_vecs;
+    if (pixels.empty()) return bbox_vecs;
+
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    network &model = detector_gpu.net;
+    if (model.layers[model.n - 1].type != YOLO) {
+        for (auto &p : pixels) bbox_vecs.push_back(detect(p, thresh));
+        return bbox_vecs;
+    }
+    if (model.c != 3)
+        throw std::runtime_error("pixels_t input needs a 3-channel network");
+    for (auto &p : pixels) {
+        if (p.data == NULL)
+            throw std::runtime_error("Image is empty");
+    }
+    int old_gpu_index;
+#ifdef GPU
+    cudaGetDevice(&old_gpu_index);
+    if(cur_gpu_id != old_gpu_index)
+        cudaSetDevice(model.gpu_index);
+#endif
+
+    int const batch = pixels.size();
+    context_lease lease(detector_gpu, batch);
+    detector_context_t &ctx = *lease.ctx;
+    network &net = *ctx.net;
+#ifdef GPU
+    net.wait_stream = wait_stream;    // 1 - wait CUDA-stream, 0 - not to wait
+#endif
+    size_t const input_size = net.w*net.h*net.c;
+    for (int b = 0; b < batch; ++b) {
+        int const offsets[3] = { pixels[b].r, pixels[b].g, pixels[b].b };
+        resize_packed_into(&ctx.resizer, pixels[b].data, pixels[b].w, pixels[b].h, pixels[b].row_bytes,
+            pixels[b].pixel_inc, offsets, ctx.input + b*input_size);
+    }
+
+    float *prediction = network_predict(net, ctx.input);
+    for (int b = 0; b < batch; ++b) {
+        bbox_vecs.push_back(get_bbox_vec(detector_gpu, *lease.ctx, prediction, pixels[b].w, pixels[b].h, thresh, nms, false, b));
+    }
+
+#ifdef GPU
+    if (cur_gpu_id != old_gpu_index)
+        cudaSetDevice(old_gpu_index);
+#endif
+
+    return bbox_vecs;
+}
+
+// starts of the tiles covering [0, frame) with at least overlap pixels shared by neighbours, spread evenly
+static std::vector<int> tile_starts(int frame, int tile, int overlap)
+{
+    std::vector<int> starts(1, 0);
+    if (tile >= frame) return starts;
+    int const step = std::max(1, tile - overlap);
+    int const n = (frame - tile + step - 1) / step + 1;
+    for (int i = 1; i < n; ++i) starts.push_back((int)((long long)i*(frame - tile) / (n - 1)));
+    return starts;
+}
+
+YOLODLL_API std::vector<tile_t> Detector::get_tiles(int frame_w, int frame_h, int tile_w, int tile_h, int overlap) const
+{
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    if (tile_w <= 0) tile_w = detector_gpu.net.w;
+    if (tile_h <= 0) tile_h = detector_gpu.net.h;
+    tile_w = std::min(tile_w, frame_w);
+    tile_h = std::min(tile_h, frame_h);
+
+    std::vector<tile_t> tiles;
+    for (int y : tile_starts(frame_h, tile_h, overlap)) {
+        for (int x : tile_starts(frame_w, tile_w, overlap)) {
+            tile_t t = { x, y, tile_w, tile_h };
+            tiles.push_back(t);
+        }
+    }
+    return tiles;
+}
+
+// runs the tiles through the network at most max_batch at a time and calls on_tile(ctx, tile, batch entry)
+// for every tile once its batch has been predicted
+template<typename F>
+static void predict_tiles(detector_gpu_t &detector_gpu, pixels_t pixels, const std::vector<tile_t> &tiles, int max_batch,
+    bool wait_stream, F on_tile)
+{
+    network &model = detector_gpu.net;
+    if (pixels.data == NULL)
+        throw std::runtime_error("Image is empty");
+    if (model.c != 3)
+        throw std::runtime_error("pixels_t input needs a 3-channel network");
+    for (auto &t : tiles) {
+        if (t.x < 0 || t.y < 0 || t.w <= 0 || t.h <= 0 || t.x + t.w > pixels.w || t.y + t.h > pixels.h)
+            throw std::runtime_error("Tile outside of the image");
+    }
+    int old_gpu_index;
+#ifdef GPU
+    cudaGetDevice(&old_gpu_index);
+    if(model.gpu_index != old_gpu_index)
+        cudaSetDevice(model.gpu_index);
+#endif
+
+    // only [yolo] layers keep separate results per batch entry, other networks take the tiles one by one.
+    // The activations grow with the batch, so a large frame goes through in chunks of max_batch tiles
+    int const batch = (model.layers[model.n - 1].type == YOLO) ? std::max(1, max_batch) : 1;
+    int const offsets[3] = { pixels.r, pixels.g, pixels.b };
+    for (size_t first = 0; first < tiles.size(); first += batch) {
+        int const n = std::min(batch, (int)(tiles.size() - first));
+        context_lease lease(detector_gpu, n);
+        detector_context_t &ctx = *lease.ctx;
+        network &net = *ctx.net;
+#ifdef GPU
+        net.wait_stream = wait_stream;    // 1 - wait CUDA-stream, 0 - not to wait
+#endif
+        size_t const input_size = net.w*net.h*net.c;
+        // the tiles are resized straight from the frame pixels into the batch
+        for (int b = 0; b < n; ++b) {
+            tile_t const &t = tiles[first + b];
+            resize_packed_into(&ctx.resizer, pixels.data + (size_t)t.y*pixels.row_bytes + (size_t)t.x*pixels.pixel_inc,
+                t.w, t.h, pixels.row_bytes, pixels.pixel_inc, offsets, ctx.input + b*input_size);
+        }
+
+        float *prediction = network_predict(net, ctx.input);
+        for (int b = 0; b < n; ++b) on_tile(ctx, prediction, tiles[first + b], b);
+    }
+
+#ifdef GPU
+    if (model.gpu_index != old_gpu_index)
+        cudaSetDevice(old_gpu_index);
+#endif
+}
+
+YOLODLL_API std::vector<bbox_t> Detector::detect_tiles(pixels_t pixels, const std::vector<tile_t> &tiles, float thresh)
+{
+    std::vector<bbox_t> bbox_vec;
+    if (tiles.empty()) return bbox_vec;
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    predict_tiles(detector_gpu, pixels, tiles, max_tile_batch, wait_stream,
+        [&](detector_context_t &ctx, float *prediction, tile_t const &t, int b) {
+        for (auto &i : get_bbox_vec(detector_gpu, ctx, prediction, t.w, t.h, thresh, nms, false, b)) {
+            i.x += t.x;
+            i.y += t.y;
+            bbox_vec.push_back(i);
+        }
+    });
+    return bbox_vec;
+}
+
+YOLODLL_API std::vector<bbox_t> Detector::merge_tiles(std::vector<bbox_t> boxes) const
+{
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    int classes = detector_gpu.net.layers[detector_gpu.net.n - 1].classes;
+    for (auto &i : boxes) classes = std::max(classes, (int)i.obj_id + 1);
+
+    std::stable_sort(boxes.begin(), boxes.end(), [](bbox_t const &a, bbox_t const &b) { return a.prob > b.prob; });
+    std::vector<box_candidate> cands(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        box_candidate &c = cands[i];
+        c.bbox.x = boxes[i].x + boxes[i].w / 2.f;
+        c.bbox.y = boxes[i].y + boxes[i].h / 2.f;
+        c.bbox.w = boxes[i].w;
+        c.bbox.h = boxes[i].h;
+        c.prob = boxes[i].prob;
+        c.class_id = boxes[i].obj_id;
+        c.box_id = (int)i;
+    }
+    nms_arena arena = { 0 };
+    do_nms_candidates(cands.data(), (int)cands.size(), classes, nms, &arena);
+    free_nms_arena(&arena);
+
+    std::vector<bbox_t> merged;
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        if (cands[i].prob > 0) merged.push_back(boxes[i]);
+    }
+    return merged;
+}
+
+YOLODLL_API std::vector<bbox_t> Detector::detect_tiled(pixels_t pixels, float thresh, int tile_w, int tile_h, int overlap)
+{
+    detector_gpu_t &detector_gpu = *static_cast<detector_gpu_t *>(detector_gpu_ptr.get());
+    network &model = detector_gpu.net;
+    int const classes = model.layers[model.n - 1].classes;
+    int const max_candidates = max_network_candidates(&model, classes);
+    std::vector<tile_t> const tiles = get_tiles(pixels.w, pixels.h, tile_w, tile_h, overlap);
+    if (max_candidates < 0) return merge_tiles(detect_tiles(pixels, tiles, thresh));
+
+    // the candidates of all the tiles are moved to frame relative coordinates and go through one NMS,
+    // the same one detect() runs over the candidates of the whole frame
+    std::vector<box_candidate> cands;
+    int box_ids = 0;
+    predict_tiles(detector_gpu, pixels, tiles, max_tile_batch, wait_stream,
+        [&](detector_context_t &ctx, float *prediction, tile_t const &t, int b) {
+        if (ctx.candidates.size() < (size_t)max_candidates) ctx.candidates.resize(max_candidates);
+        box_candidate *tile_cands = ctx.candidates.data();
+        int const count = get_network_candidates(ctx.net, t.w, t.h, thresh, 1, 0, b, classes, tile_cands);
+        float const sx = (float)t.w / pixels.w, ox = (float)t.x / pixels.w;
+        float const sy = (float)t.h / pixels.h, oy = (float)t.y / pixels.h;
+        for (int i = 0; i < count; ++i) {
+            box_candidate c = tile_cands[i];
+            c.bbox.x = c.bbox.x*sx + ox;
+            c.bbox.y = c.bbox.y*sy + oy;
+            c.bbox.w *= sx;
+            c.bbox.h *= sy;
+            c.box_id += box_ids;
+            cands.push_back(c);
+        }
+        if (count > 0) box_ids += tile_cands[count - 1].box_id + 1;
+    });
+
+    nms_arena arena = { 0 };
+    if (nms) do_nms_candidates(cands.data(), (int)cands.size(), classes, nms, &arena);
+    free_nms_arena(&arena);
+    std::vector<bbox_t> bbox_vec;
+    append_candidates(bbox_vec, cands.data(), (int)cands.size(), pixels.w, pixels.h, thresh);
     return bbox_vec;
 }
 